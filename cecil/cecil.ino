@@ -19,12 +19,22 @@
 bool    trace = true; // To be truly global, this needs to come here
 //bool    tmpBool;
 
+/* Each user gets a SIM40 of their own, so these are kept small */
+#define SIM_POOL_SIZE    4    // SIM40s, one per web session
+#define OUTPUT_BUFFER 1024    // Bytes of video output each keeps
+#define BLOCK_POOL     256    // Size of each one's translated code cache
+#define BLOCK_LIMIT     64
+
 /* Necessary includes */
 #include "flashscreen.h"
 #include <WiFiManager.h> // See https://github.com/tzapu/WiFiManager
+#include <LittleFS.h>
 #include "sim40.h"
 #include "compiler.h"
+#include "simtask.h"
+#include "sessions.h"
 #include "webServer.h"
+#include "eventstreams.h"
 
 /* Global "defines" - may have to look like variables because of type */
 long int baudrate = 115200;     // Baudrate for serial output
@@ -35,13 +45,17 @@ long int baudrate = 115200;     // Baudrate for serial output
 bool        InetConnected;
 WiFiServer  server(80);
 WiFiClient  client;
-String      webCommand = "none"; // none/halt/compile/run/clear; to get the info around
+String      webCommand = "none"; // none/halt/compile/run/clear/step; to get the info around
 String      prevWebCommand = "none";
-sim40       sim;
-compiler    Compiler;
+sim40      *sims;        // The pool, allocated in setup(), indexed by session
+compiler   *compilers;
+simTask    *simRunner;   // Runs the pool on the other core
+sessionTable sessions;
+eventStreams streams(sessions);  // Browsers being sent the state as it changes
+simSnapshot snap;        // Latest copy of a SIM40's state, for the web page
+String      bootProgram; // Source of the program loaded at boot
 int         values[] = {1,11,37,32,31,37,0,2,38,5,3,523,65,66,23,0}; // Note: this is a program to add 2 nos.
 int         valuesSize;
-int         sv;  // For temporary startVector
 
 void setup() {
   // Start up the serial output port
@@ -67,12 +81,56 @@ void setup() {
   }
 
   // put your setup code here, to run once:
+  sims = new sim40[SIM_POOL_SIZE];
+  compilers = new compiler[SIM_POOL_SIZE];
+  Serial.printf("%i SIM40s of %i bytes each\n", SIM_POOL_SIZE, (int)sizeof(sim40));
+  // The last program saved is kept in flash; if there isn't one, the 
+  // built-in one is used. Every SIM40 starts out with it
+  bool loaded = LittleFS.begin(true) && loadBootProgram();
   valuesSize = (sizeof(values)/sizeof(values[0]));
-  if(!sim.loadMem(0,values, valuesSize)) Serial.println("Oops! Memory write failed");
-  Serial.println(sim.displayMem(0,valuesSize));
-  sim.setStartVector(0);
-  sim.setRunStatus(true);
-  //simStatus = "running";
+  for(int i=0;i<SIM_POOL_SIZE;i++){
+    // The global trace is for the web server; logging every instruction
+    // of every SIM40 would take up most of their time
+    sims[i].trace = false;
+    if(!loaded){
+      if(!sims[i].loadMem(0,values, valuesSize)) Serial.println("Oops! Memory write failed");
+      sims[i].setStartVector(0);
+    }
+    sims[i].setRunStatus(true);
+    //simStatus = "running";
+  }
+  if(!loaded)Serial.println(sims[0].displayMem(0,valuesSize));
+
+  // From here on, the SIM40s and compilers belong to the SIM40 task
+  simRunner = new simTask(sims, compilers, SIM_POOL_SIZE);
+  simRunner->begin();
+  streams.begin(simRunner);
+}
+
+/**
+ * loadBootProgram()
+ *
+ * Loads the image saved by the SIM40 task when a program was last saved
+ * into every SIM40, and keeps the source it came from for the web page.
+ * @return bool  success
+ */
+bool loadBootProgram(){
+  File file = LittleFS.open(BOOT_IMAGE, "r");
+  if(!file)return false;
+  size_t   size = file.size();
+  uint8_t *data = new uint8_t[size];
+  bool     loaded = file.read(data, size)==size;
+  for(int i=0;i<SIM_POOL_SIZE && loaded;i++)loaded = sims[i].loadImage(data, size);
+  file.close();
+  delete[] data;
+  if(!loaded)return false;
+  Serial.println("Loaded " BOOT_IMAGE);
+  file = LittleFS.open(BOOT_SOURCE, "r");
+  if(file){
+    bootProgram = file.readString();
+    file.close();
+  }
+  return true;
 }
 
 void loop() 
@@ -86,55 +144,83 @@ void loop()
     prevStatus = simStatus;
   }*/
   webCommand = "none";
+  int  session = -1;
+  bool fresh = false;
   // check for incoming web clients
   client = server.available();
   if(client) 
   {
-    Serial.printf("sim.running is: %i", sim.getRunStatus());
-    String memDump = sim.displayMem(0, 23);
-    String regs = sim.getRegs();
-    webCommand = serviceWebRequest(client, Compiler.program, memDump, regs, sim.output, sim.getRunStatus());
-    Serial.printf("webCommand set by web client, now= %s\n",webCommand);
-    Serial.printf("And sim.running is: %i", sim.getRunStatus());
+    webCommand = readWebRequest(client);
+    // Which SIM40 is this browser's? A new one is told in a cookie, as
+    // long as one is free
+    session = sessions.find(webCookie);
+    if(session<0 && wantsSession())
+    {
+      session = sessions.take();
+      fresh = session>=0;
+      if(!fresh)webError = "503 Service Unavailable";
+    }
+    if(session<0)webCommand = "none";
+    setCookie = fresh ? sessions.cookie(session) : "";
+    if(fresh)sessions.program(session) = bootProgram;
+    uint32_t fps = 0;
+    if(webPath == "/api/events" && !webError)
+    {
+      // The browser keeps this one, and is sent the state as it changes
+      queryValue("fps", fps);
+      streams.open(client, session, fps);
+      Serial.printf("Session %i opened an event stream\n", session);
+    }
+    else
+    {
+      // The reply is made straight from a copy of the SIM40's state and
+      // its output buffer; a browser that asks for the state since an
+      // epoch it was given may just need the words that have changed
+      uint32_t changed[32];
+      uint32_t since = 0;
+      simView  view = {};
+      if(session>=0)viewSession(*simRunner, sessions, session, queryValue("since", since) ? &since : NULL, snap, changed, view);
+      sendWebResponse(client, session>=0 ? sessions.program(session) : bootProgram, view);
+      Serial.printf("webCommand set by web client, now= %s\n",webCommand.c_str());
+    }
   }
-  client.stop();
+  streams.service();
   
+  // Pass any command on to the SIM40 task
+  simCommand command = {CMD_NONE, NULL, 0, session};
+  // A session that has just changed hands starts from a clean slate
+  if(fresh)
+  {
+    command.type = CMD_RESET;
+    if(!simRunner->send(command))Serial.println("Oops! SIM40 command queue is full");
+    command.type = CMD_NONE;
+  }
   if(webCommand=="compile")
   {
     //Serial.println("Updated program is:");
     //Serial.println(progUpdate);
-    Compiler.program = progUpdate;
-    if((sv=Compiler.compile(sim.getStartVector()))!=-1)
-    {
-      // Compilation was successful
-      Serial.println("Compiled successfully");
-      sim.setStartVector(sv);
-      if(!sim.loadMem(Compiler.startLoc, Compiler.code , Compiler.endLoc)) Serial.println("Oops! Memory write failed");
-    }
-    else Serial.println("Failed to compile");
-    sim.output += Compiler.output;
-    sim.setRunStatus(false);
+    sessions.program(session) = progUpdate;
+    command.type = CMD_COMPILE;
+    command.program = new String(progUpdate);
   }
   if(webCommand=="clear")
   {
-    sim.output = "";
+    command.type = CMD_CLEAR;
     webCmd = "none";
   }
-  if(webCommand == "run")
+  if(webCommand == "run") command.type = CMD_RUN;
+  if(webCommand == "halt") command.type = CMD_HALT;
+  if(webCommand == "step") command.type = CMD_STEP;
+  if(webCommand == "save") command.type = CMD_SAVE;
+  if(webCommand == "key")
   {
-    sim.setRunStatus(sim.beginRun());
-    Serial.printf("sim.getRunStatus() is now: %i\n", sim.getRunStatus());
+    command.type = CMD_KEY;
+    command.value = webKey;
   }
-  if(webCommand == "halt")
+  if(command.type != CMD_NONE && !simRunner->send(command))
   {
-    sim.setRunStatus(false);
-    Serial.printf("sim.getRunStatus() is now: %i\n", sim.getRunStatus());
+    Serial.println("Oops! SIM40 command queue is full");
+    delete command.program;
   }
-  //Serial.printf("sim.getRunStatus() is: %i\n", sim.getRunStatus());
-  while(sim.getRunStatus())
-  {
-    sim.doInstruction();
-    //if(!sim.getRunStatus())simStatus = "halted";
-  }
-  delay(100);
-}
+  delay(10);
+}
\ No newline at end of file
@@ -6,36 +6,187 @@
  * machine code  together with the starting address at which it should 
  * reside.
  * 
+ * It keeps what it found on each line of the last program it compiled,
+ * so that after an edit only the lines that changed are read again; the
+ * rest give their code, labels and listing straight from the cache.
+ * 
  * @author  David Argles, d.argles@gmx.com
  * @version 23Aug2021 15:02h
  */
+
+#include <utility>
+#include "image.h"
+
+/* A word of the program: a view into compiler::program, not a copy */
+typedef struct{
+  int start;    // Offset of its first character in the program
+  int length;   // 0 once the end of the program is reached
+  int line;     // Line it is on, from 1
+  int column;   // Column it starts in, from 1
+} token;
+
+/* The CECIL mnemonics, in opcode order. They are looked up through a
+ * perfect hash: a table of MNEMONIC_SLOTS opcodes, built by the compiler
+ * (the C++ one) at build time, in which every mnemonic has a slot of its
+ * own. Finding a word's opcode then takes one hash and one comparison.
+ * MNEMONIC_SEED is the FNV-1a starting value that makes the hash perfect;
+ * if the mnemonics change, the static_assert below will say whether a new
+ * seed has to be found. */
+#define MNEMONICS      51
+#define MNEMONIC_SLOTS 128            // A power of two
+#define MNEMONIC_SEED  2166261427UL
+
+constexpr const char *mnemonics[MNEMONICS] = {"stop","load","store","add","sub","and","or","eor","jump","comp",
+  "jineg","jipos","jizero","jmptosr","jicarry","xload","xstore","loadmx","xcomp","yload",
+  "ystore","pause","printd","return","push","pull","xpush","xpull","xinc","xdec",
+  "lshift","rshift","cset","cclear","getkey","wait","retfint","printb","print","printch",
+  "ypush","ypull","yinc","ydec","swapax","swapay","swapxy","swapas","intenable","intdisable",
+  "nop"};
+
+// These are written as single expressions so that they are C++11 constexpr
+constexpr uint32_t mnemonicHash(const char *text, uint32_t hash = MNEMONIC_SEED){
+  return *text ? mnemonicHash(text+1, (hash ^ (uint8_t)*text) * 16777619UL) : hash;
+}
+
+constexpr int mnemonicSlot(uint32_t hash){
+  return (hash ^ (hash >> 15)) & (MNEMONIC_SLOTS-1);
+}
+
+constexpr bool slotClashes(int opcode, int other){
+  return other<MNEMONICS && (mnemonicSlot(mnemonicHash(mnemonics[opcode]))==mnemonicSlot(mnemonicHash(mnemonics[other])) 
+    || slotClashes(opcode, other+1));
+}
+
+constexpr bool mnemonicsPerfect(int opcode = 0){
+  return opcode>=MNEMONICS || (!slotClashes(opcode, opcode+1) && mnemonicsPerfect(opcode+1));
+}
+
+constexpr int slotOpcode(int slot, int opcode = 0){
+  return opcode>=MNEMONICS ? -1 :
+    mnemonicSlot(mnemonicHash(mnemonics[opcode]))==slot ? opcode : slotOpcode(slot, opcode+1);
+}
+
+static_assert(sizeof(mnemonics)/sizeof(mnemonics[0])==MNEMONICS, "There should be a mnemonic for every opcode");
+static_assert(mnemonicsPerfect(), "Two mnemonics share a slot: MNEMONIC_SEED needs changing");
+static_assert(slotOpcode(mnemonicSlot(mnemonicHash("nop")))==50, "nop should be found as opcode 50");
+
+// mnemonicIndex::opcodes[slot] is slotOpcode(slot) for every slot, worked out at build time
+template<int... Slots> struct mnemonicTable{
+  static const int8_t opcodes[MNEMONIC_SLOTS];
+};
+template<int... Slots> const int8_t mnemonicTable<Slots...>::opcodes[MNEMONIC_SLOTS] = {slotOpcode(Slots)...};
+template<int N, int... Slots> struct mnemonicSlots : mnemonicSlots<N-1, N-1, Slots...> {};
+template<int... Slots> struct mnemonicSlots<0, Slots...>{
+  typedef mnemonicTable<Slots...> table;
+};
+typedef mnemonicSlots<MNEMONIC_SLOTS>::table mnemonicIndex;
+
+#define CODE_SIZE 903   // Analogue port is at 904, so can't be bigger
+#define CODE_MAP  ((CODE_SIZE+31)/32)
+#define MIN_SYMBOLS  16 // Smallest symbol table; always a power of two
+
+/* A label in the compiler's symbol table. References to a label that
+ * isn't defined yet are kept as a list threaded through code[] itself:
+ * fixups is the last entry waiting for it, and each waiting entry holds
+ * the index of the one before, or NO_FIXUP (which is -1 as code[] has it,
+ * masked to 10 bits, and can't be an index) */
+#define NO_FIXUP WORD_MASK
+typedef struct{
+  token    name;      // Its length is 0 for an empty slot
+  uint32_t hash;
+  int      location;  // -1 until the label is defined
+  int      fixups;    // Last code[] entry waiting for the location, or -1
+  token    firstUse;  // Where it was first used, for the error message
+} symbol;
+
+/* What the compiler is expecting next */
+#define EXPECT_STATEMENT 0  // A label, an instruction or insert
+#define EXPECT_COMMAND   1  // An instruction or insert, after a label
+#define EXPECT_DATA      2  // The data field of an instruction
+#define EXPECT_INSERT    3  // The value after insert
+
+/* Something the compiler found on a line, with its word's place in the
+ * line, kept so that the line needn't be read again while it is unchanged */
+#define ITEM_LABEL       0  // value is the location it was given
+#define ITEM_INSTRUCTION 1  // value is the opcode
+#define ITEM_DATA        2  // value is the label's location, or -1 if it was to follow
+#define ITEM_INSERT      3  // value is the number
+
+typedef struct{
+  uint8_t  kind;
+  uint16_t length;    // Of its word
+  int      offset;    // Of its word, from the start of the line
+  int      value;
+  uint32_t hash;      // Of a label's name, as the symbol table has it
+} lineItem;
+
+/* A line as the last compile saw it, found again by the hash of its text.
+ * With the compiler expecting the same thing at its start, the same text
+ * gives the same code. If the labels it defines and uses are also where
+ * they were, it gives the same listing too, which is copied from the last
+ * compile's output rather than made again */
+typedef struct{
+  uint64_t hash;      // 64 bit FNV-1a of its text
+  int      length;
+  uint8_t  expect;    // EXPECT_ value at its start
+  uint8_t  after;     // and at its end
+  bool     reread;    // It gave an error, so is always read again
+  int      words;     // Of code it gave
+  int      firstItem; // Its items, in lineItems
+  int      items;
+  int      listing;   // Offset of its part of the output
+  int      listed;    // and its length
+} lineRecord;
+
  
 class compiler
 {
   private:
+  int     cursor;     // Offset in the program of the next character to read
+  int     line;       // Line the cursor is on, from 1
+  int     lineStart;  // Offset of the start of that line
+  symbol *symbols = NULL;   // Open addressing hash table of labels
+  int     symbolCapacity = 0;
+  int     symbolCount;
+  uint32_t instructionMap[CODE_MAP];  // One bit per code[] entry that starts an instruction
+  uint32_t labelMap[CODE_MAP];        // One bit per code[] entry with a label on it
+  int     startVector;            // Where the program being compiled starts
+  String      lastOutput;         // Output of the last compile, while the cache is in use
+  lineRecord *lines = NULL;       // Line cache, from the last compile
+  lineItem   *lineItems = NULL;
+  int         lineCount = 0;
+  int        *lineIndex = NULL;   // Open addressing hash table of lines
+  int         lineIndexSize = 0;  // A power of two
+  lineRecord *newLines = NULL;    // Being built by this compile
+  lineItem   *newItems = NULL;
+  int         newLineCount;
+  int         newItemCount;
+  int         itemCapacity;
+  int         lineBegin;          // Offset of the line being compiled
+
+  static void setBit(uint32_t *map, int address){
+    map[address>>5] |= 1UL<<(address&31);
+  }
+
+  static bool getBit(const uint32_t *map, int address){
+    return (map[address>>5] >> (address&31)) & 1;
+  }
   
   public:
 
   String  program;
-  int     code[903];  // Analogue port is at 904, so can't be bigger
+  uint16_t *code = NULL;  // CODE_SIZE words, while there is compiled code
   int     pointer;    // Points to next free location in the code
   bool    compiled = false;
   int     errors;
-  String  input;
   String  output = "";
-  String  instructions[51]={"stop","load","store","add","sub","and","or","eor","jump","comp",
-    "jineg","jipos","jizero","jmptosr","jicarry","xload","xstore","loadmx","xcomp","yload",
-    "ystore","pause","printd","return","push","pull","xpush","xpull","xinc","xdec",
-    "lshift","rshift","cset","cclear","getkey","wait","retfint","printb","print","printch",
-    "ypush","ypull","yinc","ydec","swapax","swapay","swapxy","swapas","intenable","intdisable",
-    "nop"};
   int     takesData[51] = {0,1,1,1,1,1,1,1,1,1, 1,1,1,1,1,1,1,1,1,1,
     1,1,1,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0, 0,0,0,0,0,0,0,0,0,0, 0};
-  String  labelNames[50];
-  int     labelLocs[50];
-  int     labelPtr = 0;
   int     startLoc = 0;
   int     endLoc = 0;
+  bool    optimise = false; // Run the peephole optimiser over the code
+  int     linesRead = 0;    // Lines in the last compile,
+  int     linesReused = 0;  // and those of them found in the line cache
 
   // The constructor
   compiler(){
@@ -55,176 +206,878 @@ class compiler
     return;
   }
 
+  ~compiler(){
+    delete[] code;
+    delete[] symbols;
+    delete[] lines;
+    delete[] lineItems;
+    delete[] lineIndex;
+  }
+
   void compileError(String message){
     output += message;
     errors++;
     return;
   }
 
-  String getWord(){
-    input.trim();
-    String  nextWord;
-    String  terminator;
-    String  ignore;
-    while(input.startsWith(";")){
-      ignore = getRestOfLine();
-      input.trim();
+  void compileError(token at, String message){
+    output += "Line " + String(at.line) + ", column " + String(at.column) + ": ";
+    compileError(message);
+  }
+
+ /**
+  * rewind
+  * 
+  * Puts the lexer back to the start of the program.
+  */
+  void rewind(){
+    cursor = 0;
+    line = 1;
+    lineStart = 0;
+  }
+
+ /**
+  * getWord
+  * 
+  * Returns the next word of the program, skipping white space and comments
+  * (from a ';' at the start of a word to the end of the line). The lexer
+  * only moves a cursor through the program; nothing is copied.
+  * @param  int    limit  Offset to stop at, if not the end of the program
+  * @return token  The word; its length is 0 at the end of the program
+  */
+  token getWord(int limit = -1){
+    const char *text = program.c_str();
+    int length = limit<0 ? program.length() : limit;
+    token word;
+    while(cursor<length){
+      if(text[cursor]=='\n'){
+        line++;
+        lineStart = cursor+1;
+      }
+      else if(text[cursor]==';'){
+        while(cursor<length && text[cursor]!='\n')cursor++;
+        continue;
+      }
+      else if(!isspace((unsigned char)text[cursor]))break;
+      cursor++;
     }
-    if(input.indexOf(" ")<input.indexOf("\n"))terminator = " ";
-    else terminator = "\n";  
-    nextWord = input.substring(0,input.indexOf(terminator));
-    input = input.substring(input.indexOf(terminator),input.length());      
-    return nextWord;
+    word.start = cursor;
+    word.line = line;
+    word.column = cursor-lineStart+1;
+    while(cursor<length && !isspace((unsigned char)text[cursor]))cursor++;
+    word.length = cursor-word.start;
+    return word;
   }
 
-  String getRestOfLine(){
-    input.trim();
-    String line = input.substring(0,input.indexOf("\n"));
-    input = input.substring(input.indexOf("\n"),input.length());
-    return line;
+ /**
+  * getRestOfLine
+  * 
+  * Returns whatever is left of the current line, without the white space
+  * at either end; it may be empty.
+  */
+  token getRestOfLine(){
+    const char *text = program.c_str();
+    int length = program.length();
+    token rest;
+    while(cursor<length && text[cursor]!='\n' && isspace((unsigned char)text[cursor]))cursor++;
+    rest.start = cursor;
+    rest.line = line;
+    rest.column = cursor-lineStart+1;
+    while(cursor<length && text[cursor]!='\n')cursor++;
+    rest.length = cursor-rest.start;
+    while(rest.length>0 && isspace((unsigned char)text[rest.start+rest.length-1]))rest.length--;
+    return rest;
+  }
+
+ /**
+  * matches / wordText / listWord
+  * 
+  * Compare a word against some text, copy it out as a String (for the 
+  * odd error message), or add it to the compiler output.
+  */
+  bool matches(token word, const char *text){
+    return strncmp(program.c_str()+word.start, text, word.length)==0 && text[word.length]==0;
+  }
+
+  bool matches(token word, token other){
+    return word.length==other.length &&
+      memcmp(program.c_str()+word.start, program.c_str()+other.start, word.length)==0;
+  }
+
+  String wordText(token word){
+    return program.substring(word.start, word.start+word.length);
+  }
+
+  void listWord(token word){
+    output.concat(program.c_str()+word.start, word.length);
   }
 
   String parse(){
-    input = program;
     String stuff = "Starting parser:\n";
-    while(input.length()>0){
-      stuff += getWord();
+    token word;
+    rewind();
+    while((word = getWord()).length>0){
+      stuff.concat(program.c_str()+word.start, word.length);
       stuff += "+";
     }
     stuff += "Parser finished\n";
     return stuff;
   }
 
-  int decypher(String keyword){
-    int value = -1;
-    int i = 0;
-    while(value==-1 && i<40){
-      if(keyword==instructions[i])value = i;
-      i++;
+  int decypher(token keyword){
+    int opcode = mnemonicIndex::opcodes[mnemonicSlot(hashWord(keyword, MNEMONIC_SEED))];
+    if(opcode!=-1 && matches(keyword, mnemonics[opcode]))return opcode;
+    return -1;
+  }
+
+  uint32_t hashWord(token word, uint32_t hash = 2166136261UL){
+    // FNV-1a
+    const char *text = program.c_str()+word.start;
+    for(int i=0;i<word.length;i++)hash = (hash ^ (uint8_t)text[i]) * 16777619UL;
+    return hash;
+  }
+
+ /**
+  * clearSymbols
+  * 
+  * Empties the symbol table, making sure it has room for every label the
+  * program could define (each one starts with a '.') at no more than
+  * half full. The table is only reallocated if it has to grow.
+  */
+  void clearSymbols(){
+    int dots = 0;
+    const char *text = program.c_str();
+    for(int i=0;text[i];i++)if(text[i]=='.')dots++;
+    int capacity = MIN_SYMBOLS;
+    while(capacity<2*dots)capacity *= 2;
+    if(capacity>symbolCapacity){
+      delete[] symbols;
+      symbols = new symbol[capacity];
+      symbolCapacity = capacity;
     }
-    return value;
+    for(int i=0;i<symbolCapacity;i++)symbols[i].name.length = 0;
+    symbolCount = 0;
   }
 
-  int lookupLabel(String label){
-    int value = -1;
-    int i = 0;
-    if(labelPtr!=0){
-      while((value==-1) && (i<labelPtr)){
-        if(labelNames[i]==label)value=labelLocs[i];
-        i++;
-      }
+  void growSymbols(){
+    symbol *old = symbols;
+    int oldCapacity = symbolCapacity;
+    symbolCapacity *= 2;
+    symbols = new symbol[symbolCapacity];
+    for(int i=0;i<symbolCapacity;i++)symbols[i].name.length = 0;
+    for(int i=0;i<oldCapacity;i++)
+      if(old[i].name.length>0)symbols[findSymbol(old[i].name, old[i].hash)] = old[i];
+    delete[] old;
+  }
+
+  int findSymbol(token name, uint32_t hash){
+    int i = hash & (symbolCapacity-1);
+    while(symbols[i].name.length>0 && !(symbols[i].hash==hash && matches(symbols[i].name, name)))
+      i = (i+1) & (symbolCapacity-1);
+    return i;
+  }
+
+ /**
+  * getSymbol
+  * 
+  * Finds a label in the symbol table, adding it (as not yet defined) if
+  * it isn't there. References to undefined labels can outnumber the 
+  * definitions that sized the table, so it grows if it gets 3/4 full.
+  * @param  token    name
+  * @param  uint32_t hash  hashWord() of it, if already known
+  * @return symbol&  its entry
+  */
+  symbol &getSymbol(token name){
+    return getSymbol(name, hashWord(name));
+  }
+
+  symbol &getSymbol(token name, uint32_t hash){
+    if(4*(symbolCount+1) > 3*symbolCapacity)growSymbols();
+    symbol &entry = symbols[findSymbol(name, hash)];
+    if(entry.name.length==0){
+      entry.name = name;
+      entry.hash = hash;
+      entry.location = -1;
+      entry.fixups = -1;
+      symbolCount++;
+    }
+    return entry;
+  }
+
+  void defineLabel(token name, uint32_t hash){
+    symbol &label = getSymbol(name, hash);
+    if(label.location!=-1)compileError(name, "Label defined twice: "+wordText(name)+"\n");
+    else label.location = pointer;
+    if(pointer<CODE_SIZE)setBit(labelMap, pointer);
+  }
+
+  int lookupLabel(token label){
+    return getSymbol(label).location;
+  }
+
+ /**
+  * listLabel / listInstruction / listData
+  * 
+  * Add what was found to the listing in the output.
+  */
+  void listLabel(token name, int location){
+    output += "Label found: ";
+    listWord(name);
+    output += ", location: ";
+    output += String(location);
+    output += "\n";
+  }
+
+  void listInstruction(token word){
+    output += "Instruction found: ";
+    listWord(word);
+    output += "\n";
+  }
+
+  void listData(token word, int location){
+    output += "Data field found: ";
+    listWord(word);
+    output += ", ";
+    if(location==-1)output += "location to follow\n";
+    else output += "location: " + String(location) + "\n";
+  }
+
+ /**
+  * dataWord
+  * 
+  * What goes in code[pointer] for a data field: its label's location, or
+  * if that isn't defined yet, a link in the label's list of fixups, which
+  * resolveFixups() replaces once the program has been read.
+  * @param  token    word
+  * @param  uint32_t hash      hashWord() of it
+  * @param  int&     location  Set to the label's location, or -1
+  * @return int      the word
+  */
+  int dataWord(token word, uint32_t hash, int &location){
+    symbol &label = getSymbol(word, hash);
+    location = label.location;
+    if(location!=-1)return location;
+    if(label.fixups==-1)label.firstUse = word;
+    int link = label.fixups;
+    label.fixups = pointer;
+    return link;
+  }
+
+ /**
+  * compileLabel / compileInstruction / compileData / compileInsert
+  * 
+  * Deal with each kind of thing a line can hold, as it is read, and note
+  * it in the new line cache.
+  */
+  void keepItem(const lineItem &item){
+    if(newItemCount==itemCapacity){
+      lineItem *old = newItems;
+      itemCapacity *= 2;
+      newItems = new lineItem[itemCapacity];
+      memcpy(newItems, old, newItemCount*sizeof(lineItem));
+      delete[] old;
     }
+    newItems[newItemCount++] = item;
+  }
+
+  void addItem(uint8_t kind, token word, int value, uint32_t hash){
+    lineItem item = {kind, (uint16_t)word.length, word.start-lineBegin, value, hash};
+    keepItem(item);
+  }
+
+  void compileLabel(token name){
+    uint32_t hash = hashWord(name);
+    addItem(ITEM_LABEL, name, pointer, hash);
+    listLabel(name, pointer);
+    // Enter the label into the table
+    defineLabel(name, hash);
+    // If label = "start", reset the start vector
+    if(matches(name, "start"))startVector = pointer;
+  }
+
+  void compileInstruction(token word, int instruction){
+    if(instruction==-1){
+      compileError(word, "Unknown instruction: "+wordText(word)+"\n");
+      return;
+    }
+    addItem(ITEM_INSTRUCTION, word, instruction, 0);
+    listInstruction(word);
+    if(pointer<CODE_SIZE)setBit(instructionMap, pointer);
+    emit(word, instruction);
+  }
+
+  void compileData(token word){
+    uint32_t hash = hashWord(word);
+    int location;
+    int value = dataWord(word, hash, location);
+    addItem(ITEM_DATA, word, location, hash);
+    listData(word, location);
+    emit(word, value);
+  }
+
+  void compileInsert(token word, int value){
+    addItem(ITEM_INSERT, word, value, 0);
+    Serial.print("insert field: ");
     Serial.println(value);
-    return value;
+    emit(word, value);
   }
 
-  int getData(){
-    int location = -1;
-    String nextWord;
-    //Serial.println("Looking for data field");
-    nextWord = getWord();
-    output += "Data field found: " + nextWord + ", ";
-    location = lookupLabel(nextWord);
-    if(location==-1){
-      compileError("location not found\n");
-      //output += "location not found";
+ /**
+  * compileWord
+  * 
+  * Compiles the next word of the program, given what was expected.
+  * @return int  What is expected next
+  */
+  int compileWord(token word, int expect){
+    switch(expect){
+      case EXPECT_DATA:
+        compileData(word);
+        return EXPECT_STATEMENT;
+      case EXPECT_INSERT:
+        compileInsert(word, strtol(program.c_str()+word.start, NULL, 10));
+        return EXPECT_STATEMENT;
     }
-    else output += "location: " + String(location) + "\n";
-    return location;
+    // Check for a label
+    if(expect==EXPECT_STATEMENT && program[word.start]=='.'){
+      word.start++;
+      word.length--;
+      word.column++;
+      compileLabel(word);
+      return EXPECT_COMMAND;
+    }
+    // We should now have a command
+    if(matches(word, "insert"))return EXPECT_INSERT;
+    int instruction = decypher(word);
+    compileInstruction(word, instruction);
+    return instruction!=-1 && takesData[instruction] ? EXPECT_DATA : EXPECT_STATEMENT;
+  }
+
+ /**
+  * hashLine / findLine
+  * 
+  * Look a line up in the cache, by its text and what the compiler
+  * expects at its start. Only the first of several identical lines is
+  * indexed; they all give the same code.
+  * @return lineRecord*  or NULL
+  */
+  uint64_t hashLine(int start, int length){
+    // FNV-1a, 64 bit, so that different lines can be taken not to clash
+    const char *text = program.c_str()+start;
+    uint64_t hash = 14695981039346656037ULL;
+    for(int i=0;i<length;i++)hash = (hash ^ (uint8_t)text[i]) * 1099511628211ULL;
+    return hash;
+  }
+
+  static bool sameLine(const lineRecord &a, uint64_t hash, int length, int expect){
+    return a.hash==hash && a.length==length && a.expect==expect;
+  }
+
+  const lineRecord *findLine(uint64_t hash, int length, int expect){
+    if(lineIndexSize==0)return NULL;
+    for(int i=hash&(lineIndexSize-1);lineIndex[i]!=-1;i=(i+1)&(lineIndexSize-1))
+      if(sameLine(lines[lineIndex[i]], hash, length, expect))return &lines[lineIndex[i]];
+    return NULL;
+  }
+
+ /**
+  * replayLine
+  * 
+  * Compiles a line from what the cache has of it, without reading it:
+  * its code is emitted and its labels defined and used from the items,
+  * and then its listing is copied from the last compile's output if it
+  * would be the same, or made afresh from the items if not. A line that
+  * defines a label that is already defined would give an error, so is
+  * left to be read.
+  * @return bool  It was replayed
+  */
+  token itemWord(const lineItem &item){
+    token word = {lineBegin+item.offset, item.length, line, lineBegin+item.offset-lineStart+1};
+    return word;
+  }
+
+  bool replayLine(const lineRecord &cached){
+    const lineItem *items = lineItems+cached.firstItem;
+    for(int i=0;i<cached.items;i++){
+      if(items[i].kind!=ITEM_LABEL)continue;
+      const symbol &label = symbols[findSymbol(itemWord(items[i]), items[i].hash)];
+      if(label.name.length>0 && label.location!=-1)return false;
+    }
+    int  first = newItemCount;
+    bool same = cached.listing+cached.listed<=(int)lastOutput.length();
+    for(int i=0;i<cached.items;i++){
+      lineItem item = items[i];
+      token    word = itemWord(item);
+      switch(item.kind){
+        case ITEM_LABEL:
+          item.value = pointer;
+          defineLabel(word, item.hash);
+          if(matches(word, "start"))startVector = pointer;
+          break;
+        case ITEM_INSTRUCTION:
+          setBit(instructionMap, pointer);
+          emit(word, item.value);
+          break;
+        case ITEM_DATA:
+          emit(word, dataWord(word, item.hash, item.value));
+          break;
+        case ITEM_INSERT:
+          emit(word, item.value);
+          break;
+      }
+      same = same && item.value==items[i].value;
+      keepItem(item);
+    }
+    if(same){
+      output.concat(lastOutput.c_str()+cached.listing, cached.listed);
+      return true;
+    }
+    for(int i=first;i<newItemCount;i++){
+      const lineItem &item = newItems[i];
+      if(item.kind==ITEM_LABEL)listLabel(itemWord(item), item.value);
+      else if(item.kind==ITEM_INSTRUCTION)listInstruction(itemWord(item));
+      else if(item.kind==ITEM_DATA)listData(itemWord(item), item.value);
+    }
+    return true;
+  }
+
+ /**
+  * compileLine
+  * 
+  * Compiles the line from the cursor up to end, from the cache if it has
+  * it and otherwise a word at a time, and notes what it found in the new
+  * cache.
+  * @param  int end     Offset of the end of the line
+  * @param  int expect  What is expected at its start
+  * @return int         What is expected after it
+  */
+  int compileLine(int end, int expect){
+    lineRecord &record = newLines[newLineCount++];
+    int errorsBefore = errors;
+    int pointerBefore = pointer;
+    lineBegin = cursor;
+    record.length = end-cursor;
+    record.hash = hashLine(cursor, record.length);
+    record.expect = expect;
+    record.firstItem = newItemCount;
+    record.listing = output.length();
+    const lineRecord *cached = findLine(record.hash, record.length, expect);
+    if(cached && pointer+cached->words<=CODE_SIZE && replayLine(*cached)){
+      expect = cached->after;
+      cursor = end;
+      linesReused++;
+    }
+    else{
+      newItemCount = record.firstItem;
+      token word;
+      while((word = getWord(end)).length>0)expect = compileWord(word, expect);
+    }
+    record.after = expect;
+    record.items = newItemCount-record.firstItem;
+    record.words = pointer-pointerBefore;
+    record.listed = output.length()-record.listing;
+    // Words too long to note, and anything in error, have to be read again
+    record.reread = errors!=errorsBefore || record.length>0xffff;
+    linesRead++;
+    return expect;
+  }
+
+ /**
+  * beginLines / keepLines
+  * 
+  * Start a new line cache for the program about to be compiled, and once
+  * it has been, make that the one to look lines up in next time.
+  */
+  void beginLines(){
+    int count = 1;
+    for(const char *at=program.c_str();(at = strchr(at, '\n'));at++)count++;
+    newLines = new lineRecord[count];
+    itemCapacity = 2*count;
+    newItems = new lineItem[itemCapacity];
+    newLineCount = newItemCount = 0;
+    linesRead = linesReused = 0;
+    lastOutput = std::move(output);
+  }
+
+  void keepLines(){
+    lastOutput = String();
+    delete[] lines;
+    delete[] lineItems;
+    lines = newLines;
+    lineItems = newItems;
+    lineCount = newLineCount;
+    newLines = NULL;
+    newItems = NULL;
+    int size = MIN_SYMBOLS;
+    while(size<2*lineCount)size *= 2;
+    if(size!=lineIndexSize){
+      delete[] lineIndex;
+      lineIndex = new int[size];
+      lineIndexSize = size;
+    }
+    for(int i=0;i<size;i++)lineIndex[i] = -1;
+    for(int l=0;l<lineCount;l++){
+      const lineRecord &record = lines[l];
+      if(record.reread)continue;
+      int i = record.hash&(size-1);
+      while(lineIndex[i]!=-1 && !sameLine(lines[lineIndex[i]], record.hash, record.length, record.expect))
+        i = (i+1)&(size-1);
+      if(lineIndex[i]==-1)lineIndex[i] = l;
+    }
+  }
+
+ /**
+  * resolveFixups
+  * 
+  * Patches the location of each label into the code that referred to it
+  * before it was defined; any label still undefined is an error. Those
+  * are reported in the order they were first used, not the order they
+  * happen to sit in the symbol table.
+  */
+  void resolveFixups(){
+    for(int i=0;i<symbolCapacity;i++){
+      symbol &label = symbols[i];
+      if(label.name.length==0 || label.fixups==-1 || label.location==-1)continue;
+      int next;
+      for(int at=label.fixups;at!=-1;at=next){
+        next = code[at]==NO_FIXUP ? -1 : code[at];
+        code[at] = label.location;
+      }
+      label.fixups = -1;
+    }
+    for(int after=-1;;){
+      symbol *first = NULL;
+      for(int i=0;i<symbolCapacity;i++){
+        symbol &label = symbols[i];
+        if(label.name.length==0 || label.fixups==-1 || label.firstUse.start<=after)continue;
+        if(!first || label.firstUse.start<first->firstUse.start)first = &label;
+      }
+      if(!first)break;
+      compileError(first->firstUse, "Label not found: "+wordText(first->name)+"\n");
+      after = first->firstUse.start;
+    }
+  }
+
+  void emit(token word, int value){
+    if(pointer<CODE_SIZE)code[pointer] = value & WORD_MASK;
+    else if(pointer==CODE_SIZE)compileError(word, "Program too big for memory\n");
+    pointer++;
+  }
+
+  /**
+   * Optimiser helpers
+   * 
+   * What the peephole optimiser needs to know about opcodes and about
+   * which words of code[] are instructions.
+   */
+  bool isBranch(int opcode){
+    return opcode==8 || (opcode>=10 && opcode<=14);
+  }
+
+  bool overwritesCarry(int opcode){
+    // Sets carry without looking at it first
+    return opcode==28 || opcode==32 || opcode==33 || opcode==42;
+  }
+
+  bool ignoresCarry(int opcode){
+    // Neither reads nor writes carry, and always carries on to the next instruction
+    switch(opcode){
+      case 1: case 2: case 5: case 6: case 7: case 9:
+      case 15: case 16: case 17: case 18: case 19: case 20:
+      case 29: case 37: case 38: case 39: case 43: case 44: case 45: case 46: case 50:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  bool isCode(int address){
+    // An instruction, or the data field of one
+    return address>=0 && address<pointer &&
+      (getBit(instructionMap, address) || (address>0 && getBit(instructionMap, address-1) && takesData[code[address-1]]));
+  }
+
+  bool canOptimise(){
+    for(int i=0;i<pointer;i++){
+      if(!getBit(instructionMap, i))continue;
+      int opcode = code[i];
+      int next = i+1+takesData[opcode];
+      if(opcode==35 || opcode==36 || opcode==48)return false;
+      if(takesData[opcode] && !isBranch(opcode) && isCode(code[i+1]))return false;
+      // Control may only go to instructions the compiler placed, not to
+      // words put in with insert, or the new addresses wouldn't fit them
+      if(isBranch(opcode) && code[i+1]<pointer && !getBit(instructionMap, code[i+1]))return false;
+      if(opcode!=0 && opcode!=8 && opcode!=23 && next<pointer && !getBit(instructionMap, next))return false;
+    }
+    return true;
+  }
+
+  // The first word at or after address that hasn't been dropped
+  int keptFrom(const bool *dropped, int address){
+    while(address<pointer && dropped[address])address++;
+    return address;
+  }
+
+  int nextInstruction(const bool *dropped, int address){
+    return keptFrom(dropped, address+1+takesData[code[address]]);
+  }
+
+  /**
+   * Peephole optimiser
+   * 
+   * Works on the finished code[], using instructionMap to tell instructions
+   * from data and labelMap to see where control can arrive from elsewhere.
+   * It shortens the program without changing what it does:
+   * - jumps to a jump are pointed straight at the final target;
+   * - a jump (of any kind but jmptosr) to the next instruction is dropped;
+   * - a load (or xload, yload) straight after a store of the same register
+   *   to the same place is dropped, unless a label is on it;
+   * - cclear or cset is dropped if carry is overwritten before it is read.
+   * The code is then closed up, and every operand, label and the start
+   * vector moved to match. Programs that enable interrupts are left alone,
+   * since a handler could see the state between two instructions; so are
+   * those which use instructions as data (self-modifying code), or run
+   * words put in with insert, as the opcodes and addresses in them would
+   * change.
+   * @param  int startVector
+   * @return int startVector, moved with the code
+   */
+  int optimiseCode(int startVector){
+    if(!canOptimise()){
+      output += "Not optimised: the program uses interrupts, or mixes code and data\n";
+      return startVector;
+    }
+    bool *dropped = new bool[pointer];
+    int  *moved = new int[pointer+1];
+    for(int i=0;i<pointer;i++)dropped[i] = false;
+    bool changed = true;
+    while(changed){
+      changed = false;
+      for(int i=0;i<pointer;i++){
+        if(dropped[i] || !getBit(instructionMap, i))continue;
+        int opcode = code[i];
+        int next = nextInstruction(dropped, i);
+        bool nextIsCode = next<pointer && getBit(instructionMap, next);
+        if(isBranch(opcode)){
+          // Follow jumps to jumps, with a limit in case they go round in circles
+          int target = code[i+1];
+          for(int hops=0;hops<pointer && target>=0 && target<pointer;hops++){
+            int lands = keptFrom(dropped, target);
+            if(lands>=pointer || !getBit(instructionMap, lands) || code[lands]!=8 || lands==i)break;
+            target = code[lands+1];
+          }
+          if(target!=code[i+1]){
+            code[i+1] = target;
+            changed = true;
+          }
+          if(opcode!=13 && target>=0 && target<=pointer && keptFrom(dropped, target)==next){
+            dropped[i] = dropped[i+1] = true;
+            changed = true;
+          }
+        }
+        else if((opcode==2 || opcode==16 || opcode==20) && nextIsCode && code[next]==opcode-1 &&
+                code[next+1]==code[i+1] && !getBit(labelMap, next)){
+          dropped[next] = dropped[next+1] = true;
+          changed = true;
+        }
+        else if(opcode==32 || opcode==33){
+          int ahead = next;
+          while(ahead<pointer && getBit(instructionMap, ahead) && ignoresCarry(code[ahead]))
+            ahead = nextInstruction(dropped, ahead);
+          if(ahead<pointer && getBit(instructionMap, ahead) && overwritesCarry(code[ahead])){
+            dropped[i] = true;
+            changed = true;
+          }
+        }
+      }
+    }
+    // Close up the gaps: moved[a] is where address a ends up, which for a
+    // dropped instruction is wherever the next one that is kept goes
+    int kept = 0;
+    for(int i=0;i<pointer;i++){
+      moved[i] = kept;
+      if(!dropped[i])kept++;
+    }
+    moved[pointer] = kept;
+    kept = 0;
+    for(int i=0;i<pointer;i++){
+      if(dropped[i])continue;
+      bool operand = i>0 && getBit(instructionMap, i-1) && takesData[code[i-1]];
+      int value = code[i];
+      if(operand && value>=0 && value<=pointer)value = moved[value];
+      code[kept++] = value;
+    }
+    for(int i=kept;i<pointer;i++)code[i] = 0;
+    output += "Optimised: " + String(pointer-kept) + " words saved\n";
+    if(startVector>=0 && startVector<=pointer)startVector = moved[startVector];
+    for(int i=0;i<symbolCapacity;i++){
+      symbol &label = symbols[i];
+      if(label.name.length>0 && label.location>=0 && label.location<=pointer)label.location = moved[label.location];
+    }
+    pointer = kept;
+    delete[] dropped;
+    delete[] moved;
+    return startVector;
+  }
+
+  /**
+   * imageSize / writeImage
+   * 
+   * The size of an image (see image.h) of the last program compiled, and
+   * the image itself, with the code and every label it defined. Labels
+   * are named from program, so this should be done before it is changed.
+   * @param  uint8_t* data  Room for imageSize() bytes
+   * @return size_t   bytes written; 0 if nothing has been compiled
+   */
+  int labelBytes(int &count){
+    int bytes = 0;
+    count = 0;
+    for(int i=0;i<symbolCapacity;i++){
+      symbol &label = symbols[i];
+      if(label.name.length==0 || label.location==-1 || label.name.length>255)continue;
+      bytes += 3+label.name.length;
+      count++;
+    }
+    return bytes;
+  }
+
+  size_t imageSize(){
+    int count;
+    return compiled && code ? image::size(endLoc-startLoc, labelBytes(count)) : 0;
+  }
+
+  size_t writeImage(uint8_t *data){
+    if(!compiled || !code)return 0;
+    int count;
+    int bytes = labelBytes(count);
+    int length = endLoc-startLoc;
+    size_t size = image::size(length, bytes);
+    memset(data, 0, size);
+    uint8_t *packed = data+IMAGE_HEADER;
+    for(int i=0;i<length;i++)image::setWord(packed, i, code[startLoc+i]);
+    uint8_t *at = packed+image::codeBytes(length);
+    for(int i=0;i<symbolCapacity;i++){
+      symbol &label = symbols[i];
+      if(label.name.length==0 || label.location==-1 || label.name.length>255)continue;
+      at[0] = label.location & 0xff;
+      at[1] = label.location >> 8;
+      at[2] = label.name.length;
+      memcpy(at+3, program.c_str()+label.name.start, label.name.length);
+      at += 3+label.name.length;
+    }
+    image::writeHeader(data, startVector, startLoc, length, count, bytes);
+    return size;
+  }
+
+  /**
+   * labelLocation
+   *
+   * Where a label of the last program compiled ended up. As with
+   * writeImage(), program shouldn't have been changed since.
+   * @param  String name
+   * @return int    its location, or -1 if it wasn't defined
+   */
+  int labelLocation(const String &name){
+    for(int i=0;i<symbolCapacity;i++){
+      symbol &label = symbols[i];
+      if(label.name.length>0 && label.name.length==(int)name.length() && label.location!=-1 &&
+         memcmp(program.c_str()+label.name.start, name.c_str(), name.length())==0)return label.location;
+    }
+    return -1;
+  }
+
+  /**
+   * releaseCode
+   * 
+   * Frees code[] once it has been loaded into a sim40, which then holds
+   * the only copy; the next compile allocates it again.
+   */
+  void releaseCode(){
+    delete[] code;
+    code = NULL;
+  }
+
+  /**
+   * listCode
+   * 
+   * Adds the code to the output as numbers, a buffer full at a time,
+   * rather than a String for each word.
+   */
+  void listCode(){
+    char text[128];
+    int  used = 0;
+    for(int i=0;i<pointer;i++){
+      char digits[4];
+      int  count = 0;
+      for(int value=code[i];count==0 || value>0;value /= 10)digits[count++] = '0'+value%10;
+      while(count>0)text[used++] = digits[--count];
+      text[used++] = ' ';
+      if(used>(int)sizeof(text)-5){
+        output.concat(text, used);
+        used = 0;
+      }
+    }
+    output.concat(text, used);
   }
 
   int compile(int startVec){
-    input = program;
-    labelPtr = 0;   // i.e. reset the label table
+    beginLines();
+    output.reserve(lastOutput.length()+64);   // It will be much the same size
     output = "\n===\nStarting compiler...\n";
-    String next;
-    String nextOne = "";
+    token nextOne;
     bool success = true;
     compiled = false;
-    int   instruction;
-    int   startVector = startVec;
-
-   for(int pass=1;pass<3;pass++){
-    if(pass == 2){
-      output += "---\nErrors found, beginning second pass\n";
-      input = program;
-      errors = 0;
-      success = true;
-    }
+    startVector = startVec;
 
     errors = 0;
     pointer = 0;
-
-    // First, replace all (other) whitespace chars with spaces
-    input.replace("\t"," "); // tabs
+    if(!code)code = new uint16_t[CODE_SIZE];
+    rewind();
+    clearSymbols();
+    for(int i=0;i<CODE_MAP;i++)instructionMap[i] = labelMap[i] = 0;
     
     // ---Check the headers---
-    String keywords[] = {"program","author","date"};
+    const char *keywords[] = {"program","author","date"};
     for(int ptr=0;ptr<3;ptr++){
       nextOne = getWord();
-      if(nextOne!=keywords[ptr])compileError("Missing"+keywords[ptr]+"declaration\n");
+      if(!matches(nextOne, keywords[ptr]))compileError(nextOne, "Missing "+String(keywords[ptr])+" declaration\n");
       else{
         nextOne = getRestOfLine();
-        output += "Found "+keywords[ptr]+": " + nextOne + "\n";
+        output += "Found ";
+        output += keywords[ptr];
+        output += ": ";
+        listWord(nextOne);
+        output += "\n";
       }
     }
 
-    // ---Now compile the program---
-    while(input.length()>0){
-      // While there's text left, compile next command
-      nextOne = getWord();
-      if(nextOne == "") break;
-      // Check for a label
-      if(nextOne.startsWith(".")){
-        nextOne = nextOne.substring(1,nextOne.length());
-        //Serial.println("Label found: " + nextOne + ", location: ");
-        output += "Label found: " + nextOne + ", location: ";
-        output += String(pointer);
-        output += "\n";
-        // Enter the label into the table
-        labelNames[labelPtr] = nextOne;
-        labelLocs[labelPtr++] = pointer;
-        // If label = "start", reset the start vector
-        if(nextOne == "start")startVector = pointer;
-        nextOne = getWord();
-      }
-      // We should now have a command
-      //Serial.print("Instruction found: " + nextOne + ", code: ");
-      if(nextOne == "insert"){
-        String temp = getWord();
-        int b = temp.toInt();
-        Serial.print("insert field: ");
-        Serial.println(b);
-        code[pointer++] = b;
-        //code{pointer++] = b;
-      }
-      /*if(nextOne == "insert"){
-        code{pointer++] = 20; //toInt(getWord());
-      }*/
-      else{
-        instruction = decypher(nextOne);
-        //Serial.println(instruction);
-        if(instruction==-1){
-          compileError("Unknown instruction: "+nextOne+"\n");
-        }
-        else{
-          output+="Instruction found: "+nextOne+"\n";
-          code[pointer++]=instruction;
-        }
-        // Now check for a data field
-        if(instruction!=-1 && takesData[instruction]){
-          // Current command takes a data field, deal with it
-          code[pointer++]=getData();
-        }
+    // ---Now compile the program, a line at a time---
+    const char *text = program.c_str();
+    int length = program.length();
+    int expect = EXPECT_STATEMENT;
+    while(cursor<length){
+      if(text[cursor]=='\n'){
+        line++;
+        lineStart = ++cursor;
+        continue;
       }
+      const char *newline = (const char *)memchr(text+cursor, '\n', length-cursor);
+      expect = compileLine(newline ? newline-text : length, expect);
+    }
+    keepLines();
+    // The program may end part way through a command
+    token last = {cursor, 0, line, cursor-lineStart+1};
+    if(expect==EXPECT_COMMAND)compileError(last, "Unknown instruction: \n");
+    if(expect==EXPECT_DATA){
+      compileError(last, "Missing data field\n");
+      emit(last, -1);
     }
+    if(expect==EXPECT_INSERT)emit(last, 0);
+
     // ---Finish off---
+    if(pointer<=CODE_SIZE)resolveFixups();
     if(errors>0) success = false;
-    if(success){
-      compiled = true;
-      pass = 2;
-    }
-   }
+    if(success) compiled = true;
+    if(success && optimise) startVector = optimiseCode(startVector);
 
     // ** NEED TO SET THE START VECTOR, haven't done this yet ** 
     
@@ -232,7 +1085,7 @@ class compiler
       endLoc = pointer;
       output += "There are "+String(pointer)+" memory locations of code\n";
       output += "Code block is:\n";
-      for(int i=0;i<pointer;i++)output += String(code[i])+" ";      
+      listCode();
       output += "\n==Program compiled==\n";
     }
     else{
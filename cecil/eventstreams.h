@@ -0,0 +1,219 @@
+/**
+ * Class definition for pushing SIM40 state to browsers as it changes
+ *
+ * Rather than asking for /api/state every so often, the page opens
+ * /api/events and keeps the connection open: a Server-Sent Events stream
+ * (text/event-stream), which browsers read with EventSource and reconnect
+ * by themselves. Every frame (1000/fps ms: EVENT_FPS, or ?fps= when the
+ * stream was opened) each stream's SIM40 is looked at, and if anything
+ * has changed, the stream is sent
+ *
+ *   event: state
+ *   data: {...}        as /api/state, with just the memory and output
+ *                      that have changed since the last frame
+ *
+ * and, when a program stops,
+ *
+ *   event: halted
+ *   data: {"pc":12,"paused":false}
+ *
+ * When there has been nothing to say for EVENT_KEEPALIVE, a comment line
+ * is sent, so that a connection that has gone is found and closed. Commands
+ * go the other way, POSTed to /api/run and so on (see webserver.h), so
+ * what a button does is on the page a frame later.
+ */
+
+#ifndef MAX_EVENT_STREAMS
+#define MAX_EVENT_STREAMS    4    // Open at once; a fifth closes the oldest
+#endif
+#ifndef EVENT_FPS
+#define EVENT_FPS           10    // Frames a second, unless ?fps= says otherwise
+#endif
+#define EVENT_MAX_FPS       50
+#define EVENT_KEEPALIVE  15000    // ms of nothing before a comment is sent
+#define EVENT_RETRY       2000    // ms the browser waits before reconnecting
+
+/**
+ * viewSession()
+ *
+ * What the web side is told of a session's SIM40. Notes which words of
+ * memory have changed, then takes a copy of its state; neither holds up
+ * the SIM40. Given an epoch the browser has, memory is just the words
+ * changed since, if that epoch is still remembered.
+ * @param uint32_t*   since    or NULL for all of memory
+ * @param simSnapshot snap     Where to put the copy, which view points into
+ * @param uint32_t*   changed  32 words, likewise
+ */
+void viewSession(simTask &runner, sessionTable &table, int session, const uint32_t *since,
+                 simSnapshot &snap, uint32_t *changed, simView &view){
+  memset(changed, 0, 32*sizeof(uint32_t));
+  runner.readChanges(session, changed);
+  table.noteChanges(session, changed);
+  runner.read(session, snap);
+  bool delta = since && table.changedSince(session, *since, changed);
+  view = {snap.memory, SNAPSHOT_MEM, snap.regs, (long)snap.instructionsPerSecond, &runner.output(session),
+          snap.running, table.epoch(session), delta ? changed : NULL, snap.paused};
+}
+
+typedef struct{
+  WiFiClient    client;
+  bool          open;
+  int           session;
+  uint32_t      owner;          // The session's id when the stream opened
+  unsigned long period;         // ms between frames
+  unsigned long opened;
+  unsigned long lastFrame;      // millis() when it was last looked at
+  unsigned long lastSent;       // and last sent anything
+  bool          sentAny;        // False until the first frame, which has everything
+  uint32_t      epoch;          // Of the memory the browser has
+  uint32_t      outputCursor;   // The end of the output it has
+  registers     regs;           // and the rest of what it was last sent
+  bool          running;
+  bool          paused;
+} eventStream;
+
+class eventStreams
+{
+  private:
+  eventStream   streams[MAX_EVENT_STREAMS];
+  simTask      *runner = NULL;
+  sessionTable &table;
+  simSnapshot   snap;           // Shared by the streams, which are served one at a time
+  outputPart    part;
+  uint32_t      changed[32];
+
+  void close(eventStream &s){
+    s.client.stop();
+    s.client = WiFiClient();
+    s.open = false;
+  }
+
+  static bool sameRegisters(const registers &a, const registers &b){
+    return a.acc==b.acc && a.xReg==b.xReg && a.yReg==b.yReg && a.progCounter==b.progCounter &&
+           a.zeroFlag==b.zeroFlag && a.negFlag==b.negFlag && a.carryFlag==b.carryFlag;
+  }
+
+  /**
+   * frame
+   *
+   * Sends a stream whatever has changed since its last frame, if anything.
+   */
+  void frame(eventStream &s, unsigned long now){
+    simView view;
+    viewSession(*runner, table, s.session, s.sentAny ? &s.epoch : NULL, snap, changed, view);
+    bool news = !s.sentAny || view.epoch!=s.epoch || view.output->cursor()!=s.outputCursor ||
+                view.running!=s.running || view.paused!=s.paused || !sameRegisters(view.regs, s.regs);
+    if(!news)return;
+    readOutputPart(*view.output, part, s.sentAny ? &s.outputCursor : NULL);
+    httpWriter out(s.client);
+    out.print("event: state\ndata: ");
+    printState(out, table.program(s.session), view, part);
+    out.print("\n\n");
+    if(s.running && !view.running){
+      out.printf("event: halted\ndata: {\"pc\":%d,\"paused\":%s}\n\n", view.regs.progCounter, view.paused ? "true" : "false");
+    }
+    out.end();
+    s.sentAny = true;
+    s.epoch = view.epoch;
+    s.outputCursor = part.from+part.length;
+    s.regs = view.regs;
+    s.running = view.running;
+    s.paused = view.paused;
+    s.lastSent = now;
+  }
+
+  public:
+  eventStreams(sessionTable &sessions) : table(sessions) {
+    for(int i=0;i<MAX_EVENT_STREAMS;i++)streams[i].open = false;
+  }
+
+  /**
+   * begin
+   *
+   * Streams can be opened once the SIM40 task is running.
+   */
+  void begin(simTask *simRunner){
+    runner = simRunner;
+  }
+
+  /**
+   * open
+   *
+   * Takes over a client that has asked for /api/events: answers it with
+   * the stream's headers and a first frame with everything in it, and
+   * keeps it. The caller mustn't stop() the client afterwards.
+   * @param WiFiClient client
+   * @param int        session  Whose SIM40 it is to follow
+   * @param uint32_t   fps      Frames a second; 0 for EVENT_FPS
+   */
+  void open(WiFiClient client, int session, uint32_t fps){
+    eventStream *s = &streams[0];
+    for(int i=0;i<MAX_EVENT_STREAMS;i++){
+      if(!streams[i].open){
+        s = &streams[i];
+        break;
+      }
+      if(streams[i].opened<s->opened)s = &streams[i];
+    }
+    if(s->open){
+      Serial.printf("Too many event streams; closing session %i's\n", s->session);
+      close(*s);
+    }
+    if(fps==0)fps = EVENT_FPS;
+    if(fps>EVENT_MAX_FPS)fps = EVENT_MAX_FPS;
+    s->client = client;
+    s->open = true;
+    s->session = session;
+    s->owner = table.id(session);
+    s->period = 1000/fps;
+    s->opened = s->lastFrame = millis();
+    s->sentAny = false;
+    s->running = false;
+    // Frames are small and should go at once, not wait to be joined up
+    s->client.setNoDelay(true);
+    httpWriter out(s->client);
+    sendHeaders(out, "200 OK", "text/event-stream", STREAMED);
+    out.header("Cache-Control", "no-store");
+    out.endHeaders();
+    out.printf("retry: %i\n\n", EVENT_RETRY);
+    out.end();
+    frame(*s, s->opened);
+  }
+
+  /**
+   * service
+   *
+   * Sends each stream that is due a frame whatever has changed, and closes
+   * any whose browser has gone or whose session has been given away.
+   * Called every time round loop().
+   */
+  void service(){
+    unsigned long now = millis();
+    for(int i=0;i<MAX_EVENT_STREAMS;i++){
+      eventStream &s = streams[i];
+      if(!s.open || now-s.lastFrame<s.period)continue;
+      s.lastFrame = now;
+      if(!s.client.connected() || table.id(s.session)!=s.owner){
+        close(s);
+        continue;
+      }
+      table.touch(s.session);
+      frame(s, now);
+      if(now-s.lastSent>=EVENT_KEEPALIVE){
+        s.client.print(":\n\n");
+        s.lastSent = now;
+      }
+    }
+  }
+
+  /**
+   * streamsOpen
+   *
+   * How many streams there are.
+   */
+  int streamsOpen(){
+    int n = 0;
+    for(int i=0;i<MAX_EVENT_STREAMS;i++)if(streams[i].open)n++;
+    return n;
+  }
+};
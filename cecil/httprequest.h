@@ -0,0 +1,385 @@
+/**
+ * Class definitions for reading HTTP requests
+ *
+ * An httpRequest is fed the bytes of a request as they arrive, in pieces
+ * of any size, and works through them as a state machine: the request
+ * line, the headers, then a body of Content-Length bytes. Nothing is built
+ * up a character at a time: header lines are collected in a fixed buffer
+ * (those longer than HTTP_LINE_MAX are cut short, which none that matter
+ * are) and only the few headers CECIL needs are kept.
+ *
+ * A program can be sent to /compile as a POST body, either form encoded
+ * (program=...) or as text/plain, or as the old form's GET query. Either
+ * way it is decoded by a formField as it goes by, in a single pass, and
+ * however long it is, only ever held once: all %XX escapes are decoded,
+ * + is a space, and line endings (CR LF) become LF, as the compiler
+ * expects. A query's program may be no longer than a body (HTTP_BODY_MAX)
+ * once decoded, and a request to /compile with no program in it is turned
+ * down.
+ *
+ *   httpRequest request;
+ *   request.expect("/compile", "program");
+ *   while(!request.finished())request.parse(data, length);
+ *   if(request.status)...           // Malformed, or the body is too big
+ */
+
+#ifndef CECIL_HTTPREQUEST_H
+#define CECIL_HTTPREQUEST_H
+
+#define HTTP_LINE_MAX    256    // Longest header line kept whole
+#define HTTP_PATH_MAX     64
+#define HTTP_QUERY_MAX   128    // Longest query kept for an /api/ request
+#define HTTP_BODY_MAX  16384    // Longest body taken; a program is at most about 1K words
+#define HTTP_METHOD_MAX    8
+#define HTTP_REQUEST_TIMEOUT 2000   // ms a client has to send the whole request
+#define FORM_NAME_MAX     16
+#define FORM_CHUNK        64    // Decoded bytes added to the value at a time
+
+/**
+ * formField
+ *
+ * Picks one field out of form-encoded text (name=value&name=value) fed to
+ * it a byte at a time, decoding its value into a String. With no name, all
+ * the text is the value, taken as it is apart from its line endings.
+ */
+class formField
+{
+  private:
+  const char *name = NULL;
+  String     *value = NULL;
+  bool        encoded = true;
+  char        fieldName[FORM_NAME_MAX+1];
+  int         nameLength = 0;
+  bool        inValue = false;     // Past the '=' of the current field
+  bool        wanted = false;      // and it is the one asked for
+  bool        seen = false;        // The field asked for has turned up
+  long        decoded = 0;         // Bytes of its value so far
+  int         escape = 0;          // Hex digits of a %XX read so far, plus one; 0 if not in one
+  char        escaped[2];
+  bool        pendingCR = false;   // A CR was decoded; dropped if an LF follows
+  char        chunk[FORM_CHUNK];
+  int         used = 0;
+
+  void flush(){
+    if(used>0)value->concat(chunk, used);
+    used = 0;
+  }
+
+  void emit(char c){
+    if(pendingCR && c!='\n')add('\r');
+    pendingCR = c=='\r';
+    if(!pendingCR)add(c);
+  }
+
+  void add(char c){
+    if(used==FORM_CHUNK)flush();
+    chunk[used++] = c;
+    decoded++;
+  }
+
+  static int hexValue(char c){
+    if(c>='0' && c<='9')return c-'0';
+    if(c>='a' && c<='f')return c-'a'+10;
+    if(c>='A' && c<='F')return c-'A'+10;
+    return -1;
+  }
+
+  /* Ends a % that turned out not to be an escape: it stands for itself */
+  void endEscape(){
+    if(escape==0)return;
+    emit('%');
+    for(int i=0;i<escape-1;i++)emit(escaped[i]);
+    escape = 0;
+  }
+
+  void decode(char c){
+    if(escape>0){
+      escaped[escape-1] = c;
+      if(hexValue(c)<0){
+        escape++;
+        endEscape();
+        return;
+      }
+      if(++escape<3)return;
+      escape = 0;
+      emit((char)(hexValue(escaped[0])*16+hexValue(escaped[1])));
+    }
+    else if(c=='%')escape = 1;
+    else emit(c=='+' ? ' ' : c);
+  }
+
+  public:
+  /**
+   * begin
+   *
+   * Starts picking out a field.
+   * @param const char* field   Its name, or NULL to take all the text
+   * @param String*     into    Where its value goes; emptied first
+   * @param bool        form    Whether the text is form-encoded
+   */
+  void begin(const char *field, String *into, bool form = true){
+    name = field;
+    value = into;
+    encoded = form;
+    *value = "";
+    nameLength = escape = used = 0;
+    decoded = 0;
+    inValue = !name;
+    wanted = seen = !name;
+    pendingCR = false;
+  }
+
+  void feed(char c){
+    if(!value)return;
+    if(!inValue){
+      if(c=='='){
+        fieldName[nameLength] = '\0';
+        inValue = true;
+        wanted = strcmp(fieldName, name)==0;
+        seen = seen || wanted;
+      }
+      else if(c=='&')nameLength = 0;
+      else if(nameLength<FORM_NAME_MAX)fieldName[nameLength++] = c;
+      return;
+    }
+    if(name && c=='&'){
+      if(wanted)end();
+      inValue = wanted = false;
+      nameLength = 0;
+      return;
+    }
+    if(!wanted)return;
+    if(encoded)decode(c);
+    else emit(c);
+  }
+
+  /**
+   * found / size
+   *
+   * Whether the field has turned up, and how long its value is so far,
+   * decoded.
+   */
+  bool found(){
+    return seen;
+  }
+
+  long size(){
+    return decoded;
+  }
+
+  /**
+   * end
+   *
+   * Finishes off the value, once there is no more text. Only the first
+   * field of the name is taken.
+   */
+  void end(){
+    if(!value)return;
+    if(wanted){
+      endEscape();
+      if(pendingCR)add('\r');
+      pendingCR = false;
+      flush();
+    }
+    value = NULL;
+  }
+};
+
+typedef enum{
+  PARSE_METHOD,
+  PARSE_PATH,
+  PARSE_QUERY,
+  PARSE_VERSION,
+  PARSE_HEADER,
+  PARSE_BODY,
+  PARSE_DONE
+} parseState;
+
+/**
+ * httpRequest
+ *
+ * What a request asked for, filled in by parse(). status is 0 while all is
+ * well, or the status line to answer with if not.
+ */
+class httpRequest
+{
+  private:
+  parseState  state = PARSE_METHOD;
+  char        line[HTTP_LINE_MAX+1];
+  int         lineLength = 0;
+  int         methodLength = 0;
+  int         pathLength = 0;
+  int         queryLength = 0;
+  long        remaining = 0;        // Bytes of body still to come
+  const char *programPath = NULL;   // Where a program may be sent, and the field it is in
+  const char *programField = NULL;
+  formField   field;
+  bool        reading = false;      // A program is being fed to field
+  bool        formBody = false;
+
+  bool addTo(char *text, int &length, int max, char c){
+    if(length>=max)return false;
+    text[length++] = c;
+    text[length] = '\0';
+    return true;
+  }
+
+  void fail(const char *why){
+    status = why;
+    state = PARSE_DONE;
+  }
+
+  bool takesProgram(){
+    return programPath && strcmp(path, programPath)==0;
+  }
+
+  void endProgram(){
+    field.end();
+    reading = false;
+    hasProgram = field.found();
+  }
+
+  /* The request has all been read; one sent to the program's path must
+     have had a program in it */
+  void finish(){
+    state = PARSE_DONE;
+    if(!status && takesProgram() && !hasProgram)fail("400 Bad Request");
+  }
+
+  /* A header "Name: value", case and all as it came, or the blank line after them */
+  void header(){
+    if(lineLength==0){
+      bodyStart();
+      return;
+    }
+    char *colon = strchr(line, ':');
+    if(!colon)return;
+    *colon = '\0';
+    char *value = colon+1;
+    while(*value==' ' || *value=='\t')value++;
+    if(strcasecmp(line, "Cookie")==0)cookie = value;
+    else if(strcasecmp(line, "If-None-Match")==0)ifNoneMatch = value;
+    else if(strcasecmp(line, "Content-Length")==0)contentLength = strtol(value, NULL, 10);
+    else if(strcasecmp(line, "Content-Type")==0)formBody = strncasecmp(value, "application/x-www-form-urlencoded", 33)==0;
+  }
+
+  void bodyStart(){
+    if(contentLength<0)fail("400 Bad Request");
+    else if(contentLength>HTTP_BODY_MAX)fail("413 Payload Too Large");
+    if(status)return;
+    if(contentLength==0){
+      finish();
+      return;
+    }
+    remaining = contentLength;
+    state = PARSE_BODY;
+    if(strcmp(method, "POST")==0 && takesProgram()){
+      program.reserve(contentLength);
+      field.begin(formBody ? programField : NULL, &program, formBody);
+      reading = true;
+    }
+  }
+
+  public:
+  char        method[HTTP_METHOD_MAX+1] = "";
+  char        path[HTTP_PATH_MAX+1] = "";
+  char        query[HTTP_QUERY_MAX+1] = "";  // Only kept for /api/ paths
+  String      cookie;
+  String      ifNoneMatch;
+  long        contentLength = 0;
+  String      program;              // As sent to the path given to expect()
+  bool        hasProgram = false;   // One was sent; a request to that path without one is a 400
+  const char *status = NULL;
+
+  /**
+   * expect
+   *
+   * Says which path a program may be sent to, and the name of the form
+   * field it comes in. Call it before parse().
+   */
+  void expect(const char *toPath, const char *fieldName){
+    programPath = toPath;
+    programField = fieldName;
+  }
+
+  bool finished(){
+    return state==PARSE_DONE;
+  }
+
+  /**
+   * parse
+   *
+   * Works through the next bytes of the request.
+   * @param  uint8_t* data
+   * @param  int      length
+   * @return int      how many bytes were used; any after the end of the
+   *                  request are left
+   */
+  int parse(const uint8_t *data, int length){
+    int i;
+    for(i=0;i<length && state!=PARSE_DONE;i++){
+      char c = data[i];
+      switch(state){
+        case PARSE_METHOD:
+          if(c==' ')state = methodLength>0 ? PARSE_PATH : PARSE_METHOD;
+          else if(c=='\r' || c=='\n'){
+            if(methodLength>0)fail("400 Bad Request");
+          }
+          else if(!addTo(method, methodLength, HTTP_METHOD_MAX, c))fail("501 Not Implemented");
+          break;
+        case PARSE_PATH:
+          if(c==' ' || c=='?'){
+            if(pathLength==0 || path[0]!='/'){
+              fail("400 Bad Request");
+              break;
+            }
+            state = c=='?' ? PARSE_QUERY : PARSE_VERSION;
+            reading = c=='?' && takesProgram();
+            if(reading)field.begin(programField, &program);
+          }
+          else if(c=='\r' || c=='\n')fail("400 Bad Request");
+          else if(!addTo(path, pathLength, HTTP_PATH_MAX, c))fail("414 URI Too Long");
+          break;
+        case PARSE_QUERY:
+          if(c==' '){
+            if(reading)endProgram();
+            state = PARSE_VERSION;
+          }
+          else if(c=='\r' || c=='\n')fail("400 Bad Request");
+          else if(reading){
+            // However it is sent, a program is no longer than a body may be
+            field.feed(c);
+            if(field.size()>HTTP_BODY_MAX)fail("414 URI Too Long");
+          }
+          else if(strncmp(path, "/api/", 5)==0)addTo(query, queryLength, HTTP_QUERY_MAX, c);
+          break;
+        case PARSE_VERSION:
+          if(c=='\n'){
+            state = PARSE_HEADER;
+            lineLength = 0;
+          }
+          break;
+        case PARSE_HEADER:
+          if(c=='\n'){
+            line[lineLength] = '\0';
+            header();
+            lineLength = 0;
+          }
+          else if(c!='\r' && lineLength<HTTP_LINE_MAX)line[lineLength++] = c;
+          break;
+        case PARSE_BODY:
+          if(reading)field.feed(c);
+          if(--remaining==0){
+            if(reading)endProgram();
+            finish();
+          }
+          break;
+        default:
+          break;
+      }
+    }
+    return i;
+  }
+};
+
+#endif
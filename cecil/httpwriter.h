@@ -0,0 +1,198 @@
+/**
+ * Class definition for a buffered HTTP response writer
+ *
+ * Every print to a WiFiClient can go out as a TCP segment of its own, so a
+ * page printed a line at a time costs a segment per line. An httpWriter
+ * is a Print that collects what is printed to it in a buffer of one
+ * segment's size, and only writes to the client when that is full or the
+ * response is finished. Since it can't know the length of the page before
+ * it starts sending it, the body goes as HTTP/1.1 chunked transfer
+ * encoding, a chunk per buffer full: room for the chunk's size line is
+ * kept at the front, and filled in when the chunk is sent. A reply whose
+ * length is known beforehand, that has no body, or that is streamed until
+ * the connection closes, is sent plain; so is anything printed to an
+ * httpWriter that was never begun, such as the next part of a stream.
+ *
+ *   httpWriter out(client);
+ *   out.begin("200 OK", "text/html");   // or with the body's length
+ *   out.header("Set-Cookie", cookie);   // if need be
+ *   out.endHeaders();
+ *   out.print(...);                     // as often as you like
+ *   out.end();
+ */
+
+#ifndef CECIL_HTTPWRITER_H
+#define CECIL_HTTPWRITER_H
+
+#ifndef HTTP_SEND_BUFFER
+#define HTTP_SEND_BUFFER 1436   // Bytes sent at a time; the ESP32's TCP segment size
+#endif
+#define CHUNK_HEAD 6            // A chunk's size line: four hex digits, CR LF
+#define CHUNK_TAIL 2            // and the CR LF after its data
+#define CHUNKED    -1           // begin()'s length for a body sent in chunks
+#define NO_BODY    -2           // and for a reply with no body, e.g. 304
+#define STREAMED   -3           // and for one that goes on until the connection closes
+
+class httpWriter : public Print
+{
+  private:
+  WiFiClient client;
+  uint8_t    buffer[HTTP_SEND_BUFFER];
+  int        used = 0;          // Bytes in buffer
+  int        chunkStart = -1;   // Where the current chunk's size line goes; -1 if not in one
+  bool       chunked = false;
+  bool       finished = false;
+
+  void add(const char *text){
+    write((const uint8_t *)text, strlen(text));
+  }
+
+  /* Fills in the size line of the chunk being collected and ends it; one with nothing in it is dropped */
+  void closeChunk(){
+    int size = used-chunkStart-CHUNK_HEAD;
+    if(size==0){
+      used = chunkStart;
+      return;
+    }
+    for(int i=3;i>=0;i--,size>>=4)buffer[chunkStart+i] = "0123456789abcdef"[size & 15];
+    buffer[chunkStart+4] = '\r';
+    buffer[chunkStart+5] = '\n';
+    buffer[used++] = '\r';
+    buffer[used++] = '\n';
+  }
+
+  void openChunk(){
+    chunkStart = used;
+    used += CHUNK_HEAD;
+  }
+
+  void sendBuffer(){
+    if(used>0)client.write(buffer, used);
+    used = 0;
+  }
+
+  public:
+  httpWriter(WiFiClient c) : client(c) {}
+
+  /**
+   * begin / header / endHeaders
+   *
+   * The status line, the headers, and the blank line after them. begin()
+   * sends the ones every reply has.
+   * @param const char* status  e.g. "200 OK"
+   * @param const char* type    the Content-Type, or NULL if there's no body
+   * @param long        length  of the body, or CHUNKED, NO_BODY or STREAMED
+   */
+  void begin(const char *status, const char *type, long length = CHUNKED){
+    add("HTTP/1.1 ");
+    add(status);
+    add("\r\n");
+    if(type)header("Content-Type", type);
+    chunked = length==CHUNKED;
+    if(chunked)add("Transfer-Encoding: chunked\r\n");
+    else if(length>=0){
+      char digits[24];
+      snprintf(digits, sizeof(digits), "%ld", length);
+      header("Content-Length", digits);
+    }
+    add("Connection: close\r\n");
+  }
+
+  void header(const char *name, const char *value){
+    add(name);
+    add(": ");
+    add(value);
+    add("\r\n");
+  }
+
+  void header(const char *name, const String &value){
+    header(name, value.c_str());
+  }
+
+  void endHeaders(){
+    add("\r\n");
+    if(!chunked)return;
+    if(HTTP_SEND_BUFFER-used < CHUNK_HEAD+CHUNK_TAIL+1)sendBuffer();
+    openChunk();
+  }
+
+  /**
+   * write
+   *
+   * What Print's print()s and println()s all come down to: copies bytes
+   * into the buffer, sending it each time it fills.
+   */
+  size_t write(uint8_t c) override {
+    return write(&c, 1);
+  }
+
+  size_t write(const uint8_t *data, size_t size) override {
+    if(finished)return 0;
+    size_t done = 0;
+    while(done<size){
+      int room = HTTP_SEND_BUFFER-used-(chunkStart<0 ? 0 : CHUNK_TAIL);
+      if(room<=0){
+        if(chunkStart>=0)closeChunk();
+        sendBuffer();
+        if(chunkStart>=0)openChunk();
+        continue;
+      }
+      int count = size-done<(size_t)room ? size-done : room;
+      memcpy(buffer+used, data+done, count);
+      used += count;
+      done += count;
+    }
+    return size;
+  }
+  using Print::write;
+
+  /**
+   * end
+   *
+   * Sends what is left, with the empty chunk that ends a chunked body.
+   */
+  void end(){
+    if(finished)return;
+    finished = true;
+    if(!chunked){
+      sendBuffer();
+      return;
+    }
+    if(chunkStart<0)endHeaders();
+    closeChunk();
+    if(HTTP_SEND_BUFFER-used < 5)sendBuffer();
+    memcpy(buffer+used, "0\r\n\r\n", 5);
+    used += 5;
+    sendBuffer();
+  }
+};
+
+/**
+ * jsonText
+ *
+ * A Print that passes what is printed to it on to another as the inside
+ * of a JSON string, escaped, so that text can be sent as JSON without
+ * being copied first. Bytes from 128 up, which a SIM40 can print but which
+ * needn't be UTF-8, are sent as the Latin-1 characters they'd be.
+ */
+class jsonText : public Print
+{
+  private:
+  Print &out;
+
+  public:
+  jsonText(Print &to) : out(to) {}
+  size_t write(uint8_t c) override {
+    if(c=='"' || c=='\\'){
+      out.write('\\');
+      out.write(c);
+    }
+    else if(c=='\n')out.print("\\n");
+    else if(c<0x20 || c>=0x7f)out.printf("\\u%04x", c);
+    else out.write(c);
+    return 1;
+  }
+  using Print::write;
+};
+
+#endif
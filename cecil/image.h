@@ -0,0 +1,173 @@
+/**
+ * Definitions for SIM40 program images
+ *
+ * An image is a compiled program as it is saved: a header, the machine
+ * code packed four 10 bit words to five bytes, and the program's labels.
+ * The sim40 can load one straight from wherever it is held (a file read
+ * into RAM, or mapped into memory on the host) as each word is unpacked
+ * from a fixed place, so nothing has to be parsed. All numbers are little
+ * endian. The layout is:
+ *   0  4  "C40I"
+ *   4  1  IMAGE_VERSION
+ *   5  1  0 (reserved)
+ *   6  2  start vector
+ *   8  2  load address
+ *  10  2  length, in words
+ *  12  2  number of labels
+ *  14  2  bytes of labels
+ *  16  4  checksum: FNV-1a of every byte of the image but these four
+ *  20     code: word i is bits 10i to 10i+9, counting from the lowest bit
+ *         of byte 0
+ *  then   labels: each is its location (2 bytes), the length of its name
+ *         (1 byte) and the name
+ */
+
+#ifndef CECIL_IMAGE_H
+#define CECIL_IMAGE_H
+
+#define WORD_MASK   1023    // A SIM40 word is 10 bits
+
+#define IMAGE_VERSION  1
+#define IMAGE_HEADER  20    // Bytes before the code
+#define IMAGE_CHECKSUM 16   // Where the checksum is in the header
+
+/* Where the parts of an image are, once its header has been checked */
+typedef struct{
+  int            startVector;
+  int            loadAddress;
+  int            length;        // Words of code
+  int            labelCount;
+  int            labelBytes;
+  const uint8_t *code;          // Packed
+  const uint8_t *labels;
+} imageInfo;
+
+class image
+{
+  private:
+  static void put16(uint8_t *at, int value){
+    at[0] = value & 0xff;
+    at[1] = (value>>8) & 0xff;
+  }
+
+  static int get16(const uint8_t *at){
+    return at[0] | (at[1]<<8);
+  }
+
+  public:
+
+  /**
+   * codeBytes / size
+   *
+   * Bytes taken by length words of packed code, and by a whole image.
+   */
+  static size_t codeBytes(int length){
+    return (10*(size_t)length+7)/8;
+  }
+
+  static size_t size(int length, int labelBytes){
+    return IMAGE_HEADER + codeBytes(length) + labelBytes;
+  }
+
+  /**
+   * checksum
+   *
+   * FNV-1a of an image of size bytes, leaving out the checksum itself.
+   */
+  static uint32_t checksum(const uint8_t *data, size_t size){
+    uint32_t hash = 2166136261UL;
+    for(size_t i=0;i<size;i++){
+      if(i==IMAGE_CHECKSUM)i += 4;
+      if(i<size)hash = (hash ^ data[i]) * 16777619UL;
+    }
+    return hash;
+  }
+
+  /**
+   * word / setWord
+   *
+   * Unpack or pack word i of some packed code. Every word spans two bytes,
+   * since it starts at bit 0, 2, 4 or 6 of the first.
+   */
+  static int word(const uint8_t *code, int i){
+    size_t bit = 10*(size_t)i;
+    return ((code[bit>>3] | (code[(bit>>3)+1]<<8)) >> (bit&7)) & WORD_MASK;
+  }
+
+  static void setWord(uint8_t *code, int i, int value){
+    size_t bit = 10*(size_t)i;
+    int    both = (code[bit>>3] | (code[(bit>>3)+1]<<8)) & ~(WORD_MASK << (bit&7));
+    both |= (value & WORD_MASK) << (bit&7);
+    code[bit>>3] = both & 0xff;
+    code[(bit>>3)+1] = (both>>8) & 0xff;
+  }
+
+  /**
+   * writeHeader
+   *
+   * Fills in the header of an image whose code and labels are already in
+   * place, checksum and all. The code should have started out zeroed.
+   * @param  uint8_t* data  The image, size(length, labelBytes) bytes
+   */
+  static void writeHeader(uint8_t *data, int startVector, int loadAddress, int length, int labelCount, int labelBytes){
+    data[0] = 'C';
+    data[1] = '4';
+    data[2] = '0';
+    data[3] = 'I';
+    data[4] = IMAGE_VERSION;
+    data[5] = 0;
+    put16(data+6, startVector);
+    put16(data+8, loadAddress);
+    put16(data+10, length);
+    put16(data+12, labelCount);
+    put16(data+14, labelBytes);
+    uint32_t sum = checksum(data, size(length, labelBytes));
+    put16(data+IMAGE_CHECKSUM, sum & 0xffff);
+    put16(data+IMAGE_CHECKSUM+2, sum >> 16);
+  }
+
+  /**
+   * read
+   *
+   * Checks that size bytes at data are a whole, undamaged image of a
+   * program that fits in memory, and says where its parts are.
+   * @param  imageInfo info  Filled in if it is
+   * @return bool      whether it is
+   */
+  static bool read(const uint8_t *data, size_t size, imageInfo &info){
+    if(size<IMAGE_HEADER || memcmp(data, "C40I", 4)!=0 || data[4]!=IMAGE_VERSION)return false;
+    info.startVector = get16(data+6);
+    info.loadAddress = get16(data+8);
+    info.length = get16(data+10);
+    info.labelCount = get16(data+12);
+    info.labelBytes = get16(data+14);
+    if(info.loadAddress+info.length>1024 || info.startVector>1023)return false;
+    if(size!=image::size(info.length, info.labelBytes))return false;
+    uint32_t sum = get16(data+IMAGE_CHECKSUM) | ((uint32_t)get16(data+IMAGE_CHECKSUM+2) << 16);
+    if(sum!=checksum(data, size))return false;
+    info.code = data+IMAGE_HEADER;
+    info.labels = info.code+codeBytes(info.length);
+    return true;
+  }
+
+  /**
+   * label
+   *
+   * Steps through the labels of an image read by read(): offset starts at
+   * 0, and each call moves it on to the next label.
+   * @return bool  false once there are no more
+   */
+  static bool label(const imageInfo &info, int &offset, int &location, String &name){
+    if(offset+3>info.labelBytes)return false;
+    const uint8_t *at = info.labels+offset;
+    int length = at[2];
+    if(offset+3+length>info.labelBytes)return false;
+    location = get16(at);
+    name = "";
+    name.concat((const char *)at+3, length);
+    offset += 3+length;
+    return true;
+  }
+};
+
+#endif
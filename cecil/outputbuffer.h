@@ -0,0 +1,132 @@
+/**
+ * Class definition for the SIM40 output buffer
+ *
+ * The outputBuffer holds what the SIM40 has sent to its video output in a
+ * fixed ring of bytes, allocated once, so that output-heavy programs don't
+ * fragment the heap and old output falls off the end rather than growing
+ * without bound. Every byte ever written has a position, its cursor, which
+ * only goes up; a reader keeps the cursor it has read up to and asks for
+ * whatever has been written since. Reading doesn't stop the writer: one
+ * task may write while others read, and a reader that falls more than the
+ * buffer's size behind simply skips to the oldest output still held.
+ */
+
+#include <atomic>
+
+#ifndef OUTPUT_BUFFER
+#define OUTPUT_BUFFER 4096    // Bytes of output held; must be a power of two
+#endif
+
+class outputBuffer
+{
+  private:
+  char                  ring[OUTPUT_BUFFER];
+  std::atomic<uint32_t> written{0};   // Cursor after the last byte written
+  std::atomic<uint32_t> start{0};     // Cursor of the first byte since clear()
+
+  public:
+
+  /**
+   * write
+   *
+   * Adds bytes to the buffer. Only one task may write.
+   */
+  void write(char c){
+    uint32_t end = written.load(std::memory_order_relaxed);
+    ring[end & (OUTPUT_BUFFER-1)] = c;
+    written.store(end+1, std::memory_order_release);
+  }
+
+  void write(const char *text){
+    uint32_t end = written.load(std::memory_order_relaxed);
+    while(*text)ring[end++ & (OUTPUT_BUFFER-1)] = *text++;
+    written.store(end, std::memory_order_release);
+  }
+
+  void print(long number){
+    char digits[12];
+    snprintf(digits, sizeof(digits), "%ld", number);
+    write(digits);
+  }
+
+  /**
+   * clear
+   *
+   * Forgets the output so far. Cursors carry on counting from where they
+   * were, so a reader just sees nothing new.
+   */
+  void clear(){
+    start.store(written.load(std::memory_order_relaxed), std::memory_order_release);
+  }
+
+  /**
+   * cursor / oldest
+   *
+   * The cursor the next byte will be written at, and that of the oldest
+   * byte still held.
+   */
+  uint32_t cursor(){
+    return written.load(std::memory_order_acquire);
+  }
+
+  uint32_t oldest(){
+    uint32_t end = written.load(std::memory_order_acquire);
+    uint32_t first = start.load(std::memory_order_acquire);
+    if(end-first > OUTPUT_BUFFER)first = end-OUTPUT_BUFFER;
+    return first;
+  }
+
+  /**
+   * read
+   *
+   * Copies up to max bytes written since the cursor since, and moves since
+   * on past them. If some of that output has already been lost (or cleared)
+   * the copy starts at the oldest byte still held.
+   * @param  uint32_t since  Reader's cursor; updated
+   * @param  char*    dest   Where to copy to
+   * @param  int      max    Room in dest
+   * @return int      bytes copied
+   */
+  int read(uint32_t &since, char *dest, int max){
+    uint32_t from, end;
+    int count;
+    do{
+      from = since;
+      uint32_t first = oldest();
+      if((int32_t)(from-first) < 0)from = first;
+      end = written.load(std::memory_order_acquire);
+      count = end-from < (uint32_t)max ? end-from : max;
+      for(int i=0;i<count;i++)dest[i] = ring[(from+i) & (OUTPUT_BUFFER-1)];
+      std::atomic_thread_fence(std::memory_order_acquire);
+      // Try again if the writer lapped us while we were copying
+    }while(written.load(std::memory_order_relaxed)-from > OUTPUT_BUFFER);
+    since = from+count;
+    return count;
+  }
+
+  /**
+   * text / printTo
+   *
+   * Everything still held, as a String, or sent straight to a Print such
+   * as a web reply. printTo() stops at what had been written when it
+   * started, so a busy program can't keep it going.
+   */
+  String text(){
+    char     chunk[256];
+    String   result;
+    uint32_t since = oldest();
+    int      count;
+    result.reserve(cursor()-since);
+    while((count = read(since, chunk, sizeof(chunk)))>0)result.concat(chunk, count);
+    return result;
+  }
+
+  void printTo(Print &out){
+    char     chunk[256];
+    uint32_t since = oldest();
+    uint32_t end = cursor();
+    int      count;
+    while((int32_t)(end-since)>0 &&
+          (count = read(since, chunk, end-since<sizeof(chunk) ? end-since : sizeof(chunk)))>0)out.write(chunk, count);
+  }
+};
@@ -0,0 +1,125 @@
+/**
+ * Class definition for the SIM40 event scheduler
+ *
+ * The eventScheduler holds timed events for the SIM40 (the end of a pause,
+ * the next tick of the timer) in a min-heap ordered by the time they are
+ * due, so that the next event is always at the top. Times are in ms of the
+ * SIM40's virtual clock, and compare correctly when the clock wraps round.
+ */
+
+#define MAX_EVENTS 16
+
+typedef enum{
+  EVENT_WAKE,     // The end of a pause
+  EVENT_TIMER     // A tick of the TIMER port
+} eventType;
+
+typedef struct{
+  unsigned long when;
+  eventType     type;
+} simEvent;
+
+class eventScheduler
+{
+  private:
+  simEvent heap[MAX_EVENTS];
+  int      count = 0;
+
+  static bool before(unsigned long a, unsigned long b){
+    return (long)(a-b) < 0;
+  }
+
+  void swap(int i, int j){
+    simEvent tmp = heap[i];
+    heap[i] = heap[j];
+    heap[j] = tmp;
+  }
+
+  void siftUp(int i){
+    while(i>0 && before(heap[i].when, heap[(i-1)/2].when)){
+      swap(i, (i-1)/2);
+      i = (i-1)/2;
+    }
+  }
+
+  void siftDown(int i){
+    while(true){
+      int smallest = i;
+      int left = 2*i+1;
+      int right = 2*i+2;
+      if(left<count && before(heap[left].when, heap[smallest].when))smallest = left;
+      if(right<count && before(heap[right].when, heap[smallest].when))smallest = right;
+      if(smallest==i)return;
+      swap(i, smallest);
+      i = smallest;
+    }
+  }
+
+  public:
+
+  /**
+   * schedule
+   *
+   * Adds an event to the heap.
+   * @param  unsigned long when  Virtual time the event is due
+   * @param  eventType     type
+   * @return bool success (false if the heap is full)
+   */
+  bool schedule(unsigned long when, eventType type){
+    if(count>=MAX_EVENTS)return false;
+    heap[count].when = when;
+    heap[count].type = type;
+    siftUp(count++);
+    return true;
+  }
+
+  /**
+   * cancel
+   *
+   * Removes every event of the given type.
+   */
+  void cancel(eventType type){
+    int kept = 0;
+    for(int i=0;i<count;i++)if(heap[i].type!=type)heap[kept++] = heap[i];
+    count = kept;
+    for(int i=count/2-1;i>=0;i--)siftDown(i);
+  }
+
+  void clear(){
+    count = 0;
+  }
+
+  bool empty(){
+    return count==0;
+  }
+
+  /**
+   * due
+   *
+   * True if the next event is due at or before now.
+   */
+  bool due(unsigned long now){
+    return count>0 && !before(now, heap[0].when);
+  }
+
+  /**
+   * next
+   *
+   * Time of the next event; only meaningful if the heap isn't empty.
+   */
+  unsigned long next(){
+    return heap[0].when;
+  }
+
+  /**
+   * pop
+   *
+   * Removes and returns the next event; the heap mustn't be empty.
+   */
+  simEvent pop(){
+    simEvent top = heap[0];
+    heap[0] = heap[--count];
+    siftDown(0);
+    return top;
+  }
+};
@@ -0,0 +1,180 @@
+/**
+ * Class definition for the table of web sessions
+ *
+ * Each browser that visits gets a session: one of the SIM40s in the pool
+ * that simTask runs, with the program last sent from that browser. The
+ * browser is told its session's id in a cookie, and sends it back with
+ * every request. There are only as many sessions as SIM40s, so when a new
+ * browser turns up and they are all taken, it is given the one that has
+ * gone unused for longest, but only once that has been left alone for
+ * SESSION_IDLE; until then, the newcomer is turned away. Only the page and
+ * the /api/ requests take a session (see wantsSession() in webserver.h).
+ *
+ * Each session also remembers which words of its SIM40's memory changed
+ * over its last few epochs, so that a browser polling /api/state can be
+ * sent just those. An epoch ends whenever a request finds that some have
+ * changed (see noteChanges()); a browser that has been away for more than
+ * STATE_EPOCHS of them is sent all of memory again.
+ */
+
+#ifndef SIM_POOL_SIZE
+#define SIM_POOL_SIZE  4     // SIM40s, and so sessions; each takes about 16K
+#endif
+#define SESSION_COOKIE "cecil"
+#ifndef SESSION_IDLE
+#define SESSION_IDLE   600000  // ms a session must go unused before it can be given away
+#endif
+#define STATE_EPOCHS   8     // Epochs of memory changes remembered; about 1K per session
+
+typedef struct{
+  uint32_t      id = 0;      // 0 while the slot is free
+  unsigned long lastSeen = 0;  // millis() of its last request
+  String        program;     // As last sent to the compiler
+  uint32_t      epoch = 0;   // The latest epoch
+  uint32_t      firstEpoch = 0;  // The first of this session's owner
+  uint32_t      changes[STATE_EPOCHS][32];  // Words changed in each epoch, a bit each
+} session;
+
+class sessionTable
+{
+  private:
+  session slots[SIM_POOL_SIZE];
+
+  public:
+
+  /**
+   * cookieId
+   *
+   * The session id in a Cookie: header ("name=value; name=value"), or 0 if
+   * there isn't one. Only a cookie named exactly SESSION_COOKIE counts.
+   */
+  static uint32_t cookieId(const String &cookie){
+    const char *text = cookie.c_str();
+    while(*text){
+      while(*text==' ' || *text==';')text++;
+      const char *end = text;
+      while(*end && *end!='=' && *end!=';')end++;
+      if(*end=='=' && end-text==(int)strlen(SESSION_COOKIE) && strncmp(text, SESSION_COOKIE, end-text)==0)
+        return strtoul(end+1, NULL, 16);
+      while(*end && *end!=';')end++;
+      text = end;
+    }
+    return 0;
+  }
+
+  /**
+   * find
+   *
+   * Finds the session a cookie belongs to.
+   * @param  String cookie  The value of the request's Cookie: header
+   * @return int    the session, or -1 if it doesn't belong to one
+   */
+  int find(const String &cookie){
+    uint32_t id = cookieId(cookie);
+    if(id==0)return -1;
+    for(int i=0;i<SIM_POOL_SIZE;i++)if(slots[i].id==id){
+      slots[i].lastSeen = millis();
+      return i;
+    }
+    return -1;
+  }
+
+  /**
+   * take
+   *
+   * Gives a new browser a session: a free one, or failing that the one
+   * that has gone unused for longest, if nobody has used it for
+   * SESSION_IDLE. Its SIM40 should then be reset.
+   * @return int  the session, or -1 if they are all in use
+   */
+  int take(){
+    unsigned long now = millis();
+    int found = -1;
+    for(int i=0;i<SIM_POOL_SIZE;i++){
+      if(slots[i].id==0){
+        found = i;
+        break;
+      }
+      if(now-slots[i].lastSeen>=SESSION_IDLE && (found<0 || slots[i].lastSeen<slots[found].lastSeen))found = i;
+    }
+    if(found<0)return -1;
+    slots[found].id = random(1, 0x7fffffff);
+    slots[found].program = "";
+    // Epochs carry on counting, so those the last owner was given are
+    // no longer any use
+    slots[found].firstEpoch = ++slots[found].epoch;
+    memset(slots[found].changes[slots[found].epoch % STATE_EPOCHS], 0xff, sizeof(slots[found].changes[0]));
+    slots[found].lastSeen = now;
+    return found;
+  }
+
+  /**
+   * cookie
+   *
+   * The Set-Cookie: value that hands a session's id to the browser.
+   */
+  String cookie(int slot){
+    char text[48];
+    snprintf(text, sizeof(text), SESSION_COOKIE "=%08lx; Path=/", (unsigned long)slots[slot].id);
+    return String(text);
+  }
+
+  /**
+   * id / touch
+   *
+   * The id of a session's owner, which changes when it is given to someone
+   * else, and a way to keep it from being given away while its owner is
+   * watching it without sending requests (see eventStreams).
+   */
+  uint32_t id(int slot){
+    return slots[slot].id;
+  }
+
+  void touch(int slot){
+    slots[slot].lastSeen = millis();
+  }
+
+  String &program(int slot){
+    return slots[slot].program;
+  }
+
+  uint32_t epoch(int slot){
+    return slots[slot].epoch;
+  }
+
+  /**
+   * noteChanges
+   *
+   * Ends the current epoch if any words of memory changed in it.
+   * @param int       slot
+   * @param uint32_t* changed  From simTask::readChanges()
+   */
+  void noteChanges(int slot, const uint32_t *changed){
+    session &s = slots[slot];
+    uint32_t any = 0;
+    for(int w=0;w<32;w++)any |= changed[w];
+    if(!any)return;
+    s.epoch++;
+    memcpy(s.changes[s.epoch % STATE_EPOCHS], changed, sizeof(s.changes[0]));
+  }
+
+  /**
+   * changedSince
+   *
+   * Which words of memory have changed since an epoch, if it is recent
+   * enough to know.
+   * @param  int       slot
+   * @param  uint32_t  since  An epoch that the browser was given
+   * @param  uint32_t* map    Set to a bit for each word changed (32 words)
+   * @return bool      false if since is too old, or not this owner's
+   */
+  bool changedSince(int slot, uint32_t since, uint32_t *map){
+    session &s = slots[slot];
+    if(since<s.firstEpoch || since>s.epoch || s.epoch-since>STATE_EPOCHS)return false;
+    memset(map, 0, sizeof(s.changes[0]));
+    for(uint32_t e=since+1;e<=s.epoch;e++){
+      for(int w=0;w<32;w++)map[w] |= s.changes[e % STATE_EPOCHS][w];
+    }
+    return true;
+  }
+};
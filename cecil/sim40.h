@@ -8,6 +8,10 @@
  * @author  David Argles, d.argles@gmx.com
  * @version 06Aug2021 05:53h
  */
+
+#include "scheduler.h"
+#include "outputbuffer.h"
+#include "image.h"
  
 #define ANALOGUE_IN  904  // From ADC
 #define ANALOGUE_OUT 905  // To DAC
@@ -28,6 +32,47 @@
 #define PARALLEL_IN  1021
 #define START_V      1023
 
+/* The I/O page: loads and stores here may be routed to device handlers */
+#define IO_BASE      ANALOGUE_IN
+#define IO_SIZE      (1024-IO_BASE)
+
+/* Interrupt sources, as bits of the pending interrupt mask */
+#define INT_TIMER       1   // The TIMER port has counted down to zero
+#define INT_KEYB        2   // A key has arrived in KEYB_IN
+#define INT_SERIAL      4   // A character has arrived in SERIAL_IN
+
+class sim40;
+
+/* A Print that adds to a String, so that anything laid out for a Print
+ * (printMem, printRegs) can be had as a String too */
+class stringPrint : public Print
+{
+  private:
+  String &text;
+
+  public:
+  stringPrint(String &to) : text(to) {}
+  size_t write(uint8_t c) override {
+    text += (char)c;
+    return 1;
+  }
+  size_t write(const uint8_t *buffer, size_t size) override {
+    text.concat((const char *)buffer, size);
+    return size;
+  }
+  using Print::write;
+};
+
+/* Device handlers for the I/O page. A read handler supplies the value that
+ * a load sees; a write handler is called after the value has been stored */
+typedef int  (*deviceRead)(sim40 &sim, int address);
+typedef void (*deviceWrite)(sim40 &sim, int address, int data);
+
+typedef struct{
+  deviceRead  read;
+  deviceWrite write;
+} ioDevice;
+
 typedef struct{
   int  acc;
   int  xReg;
@@ -38,28 +83,397 @@ typedef struct{
   bool carryFlag;
 } registers;
 
+/* A decoded instruction, as held in the sim40 decode cache */
+#define DECODE_UNKNOWN 51   // opcode value for anything outside the 0 - 50 range
+#define DECODE_INVALID 255  // opcode until decoded, and again after a store into it
+
+typedef struct{
+  uint8_t opcode;   // Selects the handler in doInstruction's switch
+  uint8_t length;   // Instruction length in words: 1, or 2 if it takes data
+  int16_t operand;  // Resolved operand, i.e. memory[address+1]
+} decoded;
+
+/* Sizes for the translated block cache used by runBlocks(). A sketch that
+ * runs several SIM40s may define smaller ones before including this */
+#ifndef BLOCK_POOL
+#define BLOCK_POOL  512   // Operations shared between all the cached blocks
+#endif
+#ifndef BLOCK_LIMIT
+#define BLOCK_LIMIT 128   // Most blocks held in the cache at once
+#endif
+#define BLOCK_MAX    32   // Most instructions translated into one block
+#define NO_BLOCK    255   // blockIndex of an address no cached block starts at
+static_assert(BLOCK_LIMIT<NO_BLOCK, "blockIndex holds block numbers in a byte");
+
+/* Superinstructions: common pairs fused into one block operation. They are
+ * numbered on from DECODE_UNKNOWN so that they share a switch with opcodes */
+#define FUSED_LOADADD   52  // load a;  add b
+#define FUSED_LOADSUB   53  // load a;  sub b
+#define FUSED_COMPJZ    54  // comp a;  jizero b
+#define FUSED_XINCXCOMP 55  // xinc;    xcomp b
+#define FUSED_XCOMPJZ   56  // xcomp a; jizero b
+
+typedef struct{
+  uint8_t opcode;   // An opcode, or one of the FUSED_ operations
+  uint8_t done;     // Instructions of the block run once this one has been
+  int16_t a;        // Operand of the (first) instruction
+  int16_t b;        // Operand of the second instruction of a fused pair
+  int16_t nextPc;   // Address following this operation
+} blockOp;
+
+typedef struct{
+  int16_t first;    // Index of the block's first operation in blockPool
+  uint8_t count;    // Number of operations in the block
+  uint8_t length;   // Number of SIM40 instructions they stand for
+  int16_t endPc;    // Address following the block's last instruction
+} block;
+
+/* Why run() or runUntil() handed control back to the caller */
+typedef enum{
+  STOP_HALTED,      // The program stopped, or was halted
+  STOP_BUDGET,      // The instruction budget (or time slice) ran out
+  STOP_BREAKPOINT,  // The next instruction is at a breakpoint
+  STOP_ERROR,       // A run error ended the program
+  STOP_WAITING      // The program is paused, waiting for its wake time
+} stopReason;
+
+#define RUN_BATCH  1000 // Instructions run by runUntil() between clock checks
+#define TIMER_TICK  100 // ms per unit of pause, and per count of the TIMER port
+#define FF_RATE    1000 // Instructions per ms of virtual time in fast-forward
+
 class sim40
 {
   private:
   /* NOTE WELL!! Memory needs to go from 0 - 1023, but it is essential that 
-   * you declare memory[1024] to say you need 1024 spaces! 
+   * you declare memory[1024] to say you need 1024 spaces! Words are 10 
+   * bits, so everything written is masked down to that.
    */
-  int       memory[1024]; 
+  uint16_t  memory[1024]; 
+  decoded   decodeCache[1024];
+  uint8_t   blockIndex[1024];       // Cached block starting at each address, or NO_BLOCK
+  uint32_t  codeMap[32];            // One bit per address covered by a cached block
+  block     blocks[BLOCK_LIMIT];
+  blockOp   blockPool[BLOCK_POOL];
+  int       blockCount;
+  int       opCount;
+  bool      leaveBlock;             // The running block must stop after this store
+  ioDevice  devices[IO_SIZE];       // Handlers for each address of the I/O page
+  uint32_t  ioReadMap[4];           // One bit per I/O address with a read handler
+  uint32_t  ioWriteMap[4];          // One bit per I/O address with a write handler
+  uint32_t  breakMap[32];           // One bit per address with a breakpoint
+  uint32_t  dirtyMap[32];           // One bit per address written since takeDirty()
+  int       breakCount;
+  int       breakSkip;              // Breakpoint the run is resuming from
+  bool      breakHit;
+  bool      runError;
+  eventScheduler events;
+  unsigned long  clock = 0;         // Virtual time in ms
+  unsigned long  clockInstructions = 0;
+  unsigned long  lastMillis = 0;
+  bool      suspended = false;      // Paused, waiting for an EVENT_WAKE
+  bool      waitingForInt = false;  // Suspended by wait, until an interrupt
+  int       intLatched = 0;         // Interrupt sources raised but not yet taken
+  bool      intPending = false;     // An interrupt is latched and INT_ENABLE is set
+  bool      fastForward = false;
   registers regs;
   int       value;
   char      item;
-  char      buff[5];
   bool      simRunning = false;
   
   public:
-  bool      trace = true;
-  String    output = "";
+  bool      trace = false;             // Log every instruction; far slower, see run()
+  unsigned long instructionCount = 0;  // Instructions run by run() since power-up
+  outputBuffer output;                 // What the program has sent to VID_OUT
 
   // The constructor
   sim40(){
+    // Not every sim40 lives in zeroed static memory: a pool of them is
+    // allocated on the heap
+    memset(memory, 0, sizeof(memory));
+    memset(dirtyMap, 0xff, sizeof(dirtyMap));
+    regs = registers();
+    breakHit = runError = false;
+    flushDecodeCache();
+    flushBlocks();
+    clearBreakpoints();
     memory[STACK_PTR] = STACK;
+    for(int i=0;i<IO_SIZE;i++)detachDevice(IO_BASE+i);
+    attachDevice(TIMER, NULL, timerWrite);
+    attachDevice(RANDOM_GEN, randomRead, NULL);
+    attachDevice(DURATION, NULL, soundWrite);
+    attachDevice(VID_OUT, NULL, videoWrite);
+    attachDevice(SERIAL_OUT, NULL, serialWrite);
+    attachDevice(PARALLEL_OUT, NULL, parallelWrite);
+  }
+
+  /**
+   * attachDevice / detachDevice
+   * 
+   * Routes loads and stores at an address in the I/O page to a device's
+   * handlers; either handler may be NULL. Anything not attached behaves
+   * as plain memory.
+   * @param  int         address  IO_BASE - 1023
+   * @param  deviceRead  read
+   * @param  deviceWrite write
+   * @return bool        success
+   */
+  bool attachDevice(int address, deviceRead read, deviceWrite write){
+    if(address<IO_BASE || address>1023)return false;
+    int i = address-IO_BASE;
+    devices[i].read = read;
+    devices[i].write = write;
+    if(read)ioReadMap[i>>5] |= 1UL<<(i&31);
+    else ioReadMap[i>>5] &= ~(1UL<<(i&31));
+    if(write)ioWriteMap[i>>5] |= 1UL<<(i&31);
+    else ioWriteMap[i>>5] &= ~(1UL<<(i&31));
+    return true;
   }
 
+  bool detachDevice(int address){
+    return attachDevice(address, NULL, NULL);
+  }
+
+  /**
+   * flushDecodeCache
+   * 
+   * Throws away every decoded instruction, so that each address will be
+   * decoded afresh the next time it is executed.
+   */
+   void flushDecodeCache(){
+    for(int i=0;i<1024;i++)decodeCache[i].opcode = DECODE_INVALID;
+   }
+
+  /**
+   * decode
+   * 
+   * Returns the decoded form of the instruction at address, decoding it 
+   * first if it isn't already in the cache. Decoding looks up the opcode
+   * and the operand once, so that loops don't pay for it on every pass.
+   * @param  int     address
+   * @return decoded instruction
+   */
+   const decoded &decode(int address){
+    decoded &d = decodeCache[address];
+    if(d.opcode==DECODE_INVALID){
+      int instruction = memory[address];
+      if(instruction<0 || instruction>50)d.opcode = DECODE_UNKNOWN;
+      else d.opcode = instruction;
+      // Opcodes 1 - 22 are the ones followed by a data field
+      if(d.opcode>=1 && d.opcode<=22 && address<1023){
+        d.length = 2;
+        d.operand = memory[address+1];
+      }
+      else{
+        d.length = 1;
+        d.operand = 0;
+      }
+    }
+    return d;
+   }
+
+  /**
+   * writeMem
+   * 
+   * Writes a value into memory on behalf of the running program. Only its
+   * low 10 bits are kept. Any cached decode that the write affects is 
+   * thrown away: the instruction at the address itself, and the one 
+   * before it, whose operand may live there.
+   * @param int address
+   * @param int value
+   */
+   void writeMem(int address, int value){
+    memory[address] = value & WORD_MASK;
+    dirtyMap[address>>5] |= 1UL<<(address&31);
+    decodeCache[address].opcode = DECODE_INVALID;
+    if(address>0)decodeCache[address-1].opcode = DECODE_INVALID;
+    if(codeMap[address>>5] & (1UL<<(address&31)))flushBlocks();
+    if(address==INT_ENABLE){
+      updateInterrupts();
+      leaveBlock = true;
+    }
+   }
+
+  /**
+   * readMem
+   * 
+   * What a program sees when it loads from address. Below the I/O page this
+   * is plain memory, at the cost of one comparison; in it, an attached read
+   * handler supplies the value, which is kept in memory as the port's last
+   * reading. Addresses outside 0 - 1023 (from loadmx, say) wrap round. All
+   * loads made by instructions come through here.
+   * @param  int address
+   * @return int value
+   */
+   int readMem(int address){
+    if((unsigned)address<IO_BASE)return memory[address];
+    address &= 1023;
+    if(address<IO_BASE)return memory[address];
+    int i = address-IO_BASE;
+    if(ioReadMap[i>>5] & (1UL<<(i&31)))writeMem(address, devices[i].read(*this, address));
+    return memory[address];
+   }
+
+  /**
+   * flushBlocks
+   * 
+   * Empties the translated block cache. This happens when the program writes
+   * into code that has been translated, or when the cache fills up.
+   */
+   void flushBlocks(){
+    memset(blockIndex, NO_BLOCK, sizeof(blockIndex));
+    for(int i=0;i<32;i++)codeMap[i] = 0;
+    blockCount = 0;
+    opCount = 0;
+    leaveBlock = true;
+   }
+
+  /**
+   * endsBlock
+   * 
+   * True for the instructions which have to be the last in a block: those
+   * which change the program counter, and those which can halt the run.
+   */
+   bool endsBlock(int opcode){
+    switch(opcode){
+      case 0:  case 8:  case 10: case 11: case 12: case 13: case 14: 
+      case 21: case 23: case 24: case 25: case 26: case 27: 
+      case 35: case 36: case 40: case 41: case 47: case 48: case 49:
+        return true;
+      case 1:  case 2:  case 3:  case 4:  case 5:  case 6:  case 7:  case 9:
+      case 15: case 16: case 17: case 18: case 19: case 20: case 22:
+      case 28: case 29: case 30: case 31: case 32: case 33: case 34:
+      case 37: case 38: case 39: case 42: case 43: case 44: case 45: case 46:
+      case 50:
+        return false;
+      default:  // Unknown instructions halt the run
+        return true;
+    }
+   }
+
+  /**
+   * fuse
+   * 
+   * Returns the superinstruction for a pair of opcodes, or -1 if the pair
+   * doesn't have one.
+   */
+   int fuse(int first, int second){
+    if(first==1 && second==3)return FUSED_LOADADD;
+    if(first==1 && second==4)return FUSED_LOADSUB;
+    if(first==9 && second==12)return FUSED_COMPJZ;
+    if(first==28 && second==18)return FUSED_XINCXCOMP;
+    if(first==18 && second==12)return FUSED_XCOMPJZ;
+    return -1;
+   }
+
+  /**
+   * translateBlock
+   * 
+   * Translates the straight-line run of code from start up to the next
+   * branch (or anything else that ends a block) into a sequence of block
+   * operations, fusing common pairs of instructions as it goes. Every
+   * branch target gets its own block the first time it is jumped to.
+   * @param  int start  Address of the block's first instruction
+   * @return int        Index of the new block
+   */
+   int translateBlock(int start){
+    if(blockCount>=BLOCK_LIMIT || opCount+BLOCK_MAX>BLOCK_POOL)flushBlocks();
+    block &blk = blocks[blockCount];
+    blk.first = opCount;
+    blk.count = 0;
+    blk.length = 0;
+    int  address = start;
+    bool ended = false;
+    while(!ended && blk.length<BLOCK_MAX && address<=1023){
+      // Breakpoints have to start a block of their own
+      if(breakCount && address!=start && isBreakpoint(address))break;
+      const decoded d = decode(address);
+      blockOp &op = blockPool[opCount++];
+      op.opcode = d.opcode;
+      op.a = d.opcode==DECODE_UNKNOWN ? address : d.operand;
+      op.b = 0;
+      markCode(address, d.length);
+      address += d.length;
+      blk.length++;
+      ended = endsBlock(d.opcode);
+      if(!ended && blk.length<BLOCK_MAX && address<=1023 && !(breakCount && isBreakpoint(address))){
+        const decoded next = decode(address);
+        int fused = fuse(d.opcode, next.opcode);
+        if(fused!=-1){
+          op.opcode = fused;
+          op.b = next.operand;
+          markCode(address, next.length);
+          address += next.length;
+          blk.length++;
+          ended = endsBlock(next.opcode);
+        }
+      }
+      op.nextPc = address;
+      op.done = blk.length;
+      blk.count++;
+    }
+    blk.endPc = address;
+    blockIndex[start] = blockCount;
+    return blockCount++;
+   }
+
+   void markCode(int address, int length){
+    for(int i=address;i<address+length && i<=1023;i++)codeMap[i>>5] |= (1UL<<(i&31));
+   }
+
+  /**
+   * setBreakpoint
+   * 
+   * Sets or clears a breakpoint. run() returns STOP_BREAKPOINT when the
+   * next instruction to run is at a breakpoint; calling run() again carries
+   * on from there. The block cache is flushed so that blocks are split at
+   * the new breakpoint.
+   * @param  int  address
+   * @param  bool set      true to set the breakpoint, false to clear it
+   * @return bool success
+   */
+   bool setBreakpoint(int address, bool set){
+    if(address<0 || address>1023)return false;
+    bool wasSet = isBreakpoint(address);
+    if(set && !wasSet){
+      breakMap[address>>5] |= (1UL<<(address&31));
+      breakCount++;
+    }
+    if(!set && wasSet){
+      breakMap[address>>5] &= ~(1UL<<(address&31));
+      breakCount--;
+    }
+    flushBlocks();
+    return true;
+   }
+
+   void clearBreakpoints(){
+    for(int i=0;i<32;i++)breakMap[i] = 0;
+    breakCount = 0;
+    flushBlocks();
+   }
+
+   bool isBreakpoint(int address){
+    return breakMap[address>>5] & (1UL<<(address&31));
+   }
+
+  /**
+   * atBreakpoint
+   * 
+   * Called by the engines before each instruction (or block) when any 
+   * breakpoints are set. The breakpoint a run starts on is stepped over, so
+   * that a stopped program can be carried on with.
+   */
+   bool atBreakpoint(){
+    int pc = regs.progCounter;
+    if(!isBreakpoint(pc))return false;
+    if(pc==breakSkip){
+      breakSkip = -1;
+      return false;
+    }
+    breakHit = true;
+    return true;
+   }
+
   /**
    * stackPush
    * 
@@ -75,14 +489,15 @@ class sim40
         Serial.printf("Stack pointer is %i\n",memory[STACK_PTR]);
         //output += "Stack pointer is  " + String(memory[STACK_PTR]) + "\n";
       }
-      memory[memory[STACK_PTR]] = value;
-      memory[STACK_PTR]++;
+      writeMem(memory[STACK_PTR], value);
+      writeMem(STACK_PTR, memory[STACK_PTR]+1);
       if(trace)Serial.printf("Stack pointer is %i\n",memory[STACK_PTR]);
     }
     else{
       Serial.println("Stack overflow\nRun terminated");
-      output += "!!RUN ERROR: Stack overflow\n";
+      output.write("!!RUN ERROR: Stack overflow\n");
       simRunning = false;
+      runError = true;
       return false;
     }
     return true;
@@ -100,13 +515,14 @@ class sim40
     if(memory[STACK_PTR]>(STACK)){
       value = memory[memory[STACK_PTR]-1];
       if(trace)Serial.printf("Pulling %i from stack\n",value);
-      memory[STACK_PTR]--;
+      writeMem(STACK_PTR, memory[STACK_PTR]-1);
       if(trace)Serial.printf("Stack pointer is %i\n",memory[STACK_PTR]);
     }
     else{
       Serial.println("Stack underflow\nRun terminated");
-      output += "!!RUN ERROR: Stack underflow\n";
+      output.write("!!RUN ERROR: Stack underflow\n");
       simRunning = false;
+      runError = true;
     }
     return value;
    }
@@ -114,12 +530,16 @@ class sim40
   /**
    * loadMem
    * 
-   * loadMem uploads values into the sim40 memory.
+   * loadMem uploads values into the sim40 memory. Only words that differ
+   * from what is there already are written, so reloading a program after
+   * a small change leaves the decoded instructions and cached blocks for
+   * the rest of it alone. Values are masked to 10 bits, as by writeMem.
    * @param int startAddress
-   * @param array int values[]
+   * @param array values[]  of int, or the compiler's uint16_t
    * @return bool success
    */
-   bool loadMem(int startAddress, int values[], int noOfEntries){
+   template<typename word>
+   bool loadMem(int startAddress, const word values[], int noOfEntries){
      bool success = true;
      // Check the parameters
      int endAddress = startAddress + noOfEntries - 1;
@@ -129,13 +549,57 @@ class sim40
       return success;
      }
      int arrayPtr = 0;
-     for(int i=startAddress;i<=endAddress;i++){
-      if(trace)Serial.printf("Writing %i to memory\n", values[arrayPtr]);
-      memory[i]=values[arrayPtr++];
+     for(int i=startAddress;i<=endAddress;i++,arrayPtr++){
+      int value = values[arrayPtr] & WORD_MASK;
+      if(memory[i]==value)continue;
+      if(trace)Serial.printf("Writing %i to memory\n", value);
+      writeMem(i, value);
      }
      return success;
    }
 
+  /**
+   * loadImage
+   * 
+   * Loads a program image (see image.h) into memory and sets the start
+   * vector from it. The image is checked first; if it is damaged, or not
+   * an image at all, nothing is changed. As with loadMem, only words that
+   * differ are written.
+   * @param  uint8_t* data
+   * @param  size_t   size  Bytes at data
+   * @return bool     success
+   */
+   bool loadImage(const uint8_t *data, size_t size){
+     imageInfo info;
+     if(!image::read(data, size, info)){
+      Serial.println("Not a valid SIM40 image");
+      return false;
+     }
+     unpackMem(info.code, info.loadAddress, info.length);
+     return setStartVector(info.startVector);
+   }
+
+  /**
+   * packMem / unpackMem
+   * 
+   * Copy count words of memory from address on to or from the packed form
+   * used by images (see image.h): four words to five bytes, so all of 
+   * memory takes 1280 bytes. For snapshots and for sending memory 
+   * elsewhere; unpacking writes only the words that differ.
+   * @param  uint8_t* packed  image::codeBytes(count) bytes
+   */
+   void packMem(uint8_t *packed, int address, int count){
+     memset(packed, 0, image::codeBytes(count));
+     for(int i=0;i<count;i++)image::setWord(packed, i, memory[address+i]);
+   }
+
+   void unpackMem(const uint8_t *packed, int address, int count){
+     for(int i=0;i<count;i++){
+      int value = image::word(packed, i);
+      if(memory[address+i]!=value)writeMem(address+i, value);
+     }
+   }
+
   /**
    * displayMem
    * 
@@ -146,30 +610,38 @@ class sim40
    */
    String displayMem(int startAddress, int endAddress){
      //Serial.println("Entering display dump routine");
-     String result = "";
      // Check the parameters
      if(startAddress<0 || endAddress>1023 || startAddress>endAddress){
-      result = "Start or end address is out of range for memory access";
-      return result;
+      return "Start or end address is out of range for memory access";
      }
      // We're clear to go
-     int  pointer = startAddress;
-     int  counter = 0;
-     int  itemsOnLine = 0;
-     while(pointer<=endAddress){
-       sprintf(buff," %04d", memory[pointer++]);
-       //Serial.print("Adding next memory content: ");
-       //Serial.println(memory[pointer]);
-       //result += " ";
-       result += buff;
-       //for(int i=0;i<5;i++)result += buff[i];
-       if(itemsOnLine++%8==7){
-        result += "\n";
-        //Serial.println();
-       }
+     return formatMem(&memory[startAddress], endAddress-startAddress+1);
+   }
+
+  /**
+   * formatMem / printMem
+   * 
+   * Lay out a run of memory words eight to a line, as displayMem shows
+   * them: as a String, or straight to a Print such as a web reply, with
+   * no String in between. They are static so that copies of the memory
+   * can be shown too.
+   * @param  uint16_t* words
+   * @param  int       count
+   * @return String memory (memory contents)
+   */
+   static String formatMem(const uint16_t *words, int count){
+     String      result = "";
+     stringPrint out(result);
+     printMem(out, words, count);
+     return result;
+   }
+
+   static void printMem(Print &out, const uint16_t *words, int count){
+     char   buff[12];
+     for(int i=0;i<count;i++){
+       out.write(buff, snprintf(buff, sizeof(buff), i%8==7 ? " %04d\n" : " %04d", words[i]));
      }
-     result += "\n";
-     return result; //"[memory dump]";//
+     out.write('\n');
    }
 
   /**
@@ -178,38 +650,73 @@ class sim40
    * displayRegs displays values in the sim40 registers.
    */
    String getRegs(){
-     String op = "";
-     sprintf(buff," %04d", regs.acc);
-     op += "Accumulator:  ";
-     op += buff;
      Serial.printf("\nX Register:    %04d",regs.xReg);
-     sprintf(buff," %04d", regs.xReg);
-     op += "\nX Register:   ";
-     op += buff;
      Serial.printf("\nY Register:    %04d",regs.yReg);
-     sprintf(buff," %04d", regs.yReg);
-     op += "\nY Register:   ";
-     op += buff;
      Serial.printf("\nProg Counter:  %04d",regs.progCounter);
-     sprintf(buff," %04d", regs.progCounter);
-     op += "\nProg Counter: ";
-     op += buff;
      Serial.printf("\nZero Flag:     %i",regs.zeroFlag);
-     sprintf(buff," %04d", regs.zeroFlag);
-     op += "\nZero Flag:    ";
-     op += buff;
      Serial.printf("\nNegative Flag: %i",regs.negFlag);
-     sprintf(buff," %04d", regs.negFlag);
-     op += "\nNegative Flag:";
-     op += buff;
      Serial.printf("\nCarry Flag:    %i\n",regs.carryFlag);
-     sprintf(buff," %04d", regs.carryFlag);
-     op += "\nCarry Flag:   ";
-     op += buff;
      Serial.println("Stack:");
      //Serial.println(displayMem(908,1007));
+     return formatRegs(regs);
+   }
+
+  /**
+   * formatRegs / printRegs
+   * 
+   * Lay out a set of registers as getRegs shows them. Static, like 
+   * formatMem, so that they work on copies too.
+   * @param  registers r
+   * @return String    registers (register contents)
+   */
+   static String formatRegs(const registers &r){
+     String      op = "";
+     stringPrint out(op);
+     printRegs(out, r);
      return op;
    }
+
+   static void printRegs(Print &out, const registers &r){
+     out.printf("Accumulator:   %04d", r.acc);
+     out.printf("\nX Register:    %04d", r.xReg);
+     out.printf("\nY Register:    %04d", r.yReg);
+     out.printf("\nProg Counter:  %04d", r.progCounter);
+     out.printf("\nZero Flag:     %04d", r.zeroFlag);
+     out.printf("\nNegative Flag: %04d", r.negFlag);
+     out.printf("\nCarry Flag:    %04d", r.carryFlag);
+   }
+
+  /**
+   * getRegisters / peekMem
+   * 
+   * Raw access to the registers and memory, for taking snapshots.
+   */
+   registers getRegisters(){
+     return regs;
+   }
+
+   int peekMem(int address){
+     return memory[address];
+   }
+
+  /**
+   * takeDirty
+   * 
+   * Adds a bit for each address written since the last call (by a store,
+   * a device, loadMem, anything) to map, which has 32 words, and starts
+   * again with none. At first, every address counts as written.
+   * @param  uint32_t* map
+   * @return bool      whether there were any
+   */
+   bool takeDirty(uint32_t *map){
+     uint32_t any = 0;
+     for(int i=0;i<32;i++){
+       map[i] |= dirtyMap[i];
+       any |= dirtyMap[i];
+       dirtyMap[i] = 0;
+     }
+     return any!=0;
+   }
    
  /**
   * setStartVector
@@ -225,7 +732,7 @@ class sim40
       success = false;
       return success;
     }
-    memory[START_V] = address;
+    writeMem(START_V, address);
     //output += "Setting start vector to " + String(memory[START_V]) + "\n";
     if(!simRunning)regs.progCounter = address;
     return success;
@@ -265,6 +772,13 @@ class sim40
     //output += "Start vector is " + String(memory[START_V])+"\n";
     Serial.println("Setting progCounter to " + String(regs.progCounter));
     simRunning = true;
+    runError = false;
+    suspended = false;
+    waitingForInt = false;
+    intLatched = 0;
+    intPending = false;
+    events.clear();
+    lastMillis = millis();
     return true;
   }
 
@@ -273,26 +787,289 @@ class sim40
  *   
  *   Deals with output to the video port
  */
-void videoOut(String oput){
-  output += oput;
+void videoOut(const char *oput){
+  output.write(oput);
   // Code to send to screen via I2C needs to go here:
   
   return;
 }
+
+void videoOut(char chr){
+  output.write(chr);
+}
  
+ /**
+  * Instruction helpers
+  * 
+  * These carry out the register and flag arithmetic for the instructions
+  * that need more than a line or two, so that doInstruction and the 
+  * threaded engine below share exactly the same behaviour.
+  */
+  void doAdd(int data){
+    regs.acc = regs.acc + data;
+    if(regs.carryFlag)regs.acc++;
+    if(regs.acc>1023){
+      regs.acc = regs.acc%1024;
+      regs.carryFlag = true;
+    }
+    if(regs.acc==0)regs.zeroFlag=true;
+  }
+
+  void doSub(int data){
+    regs.acc = regs.acc + (data ^ 1023) + regs.carryFlag;
+    if(regs.acc>1023){
+      regs.acc = regs.acc%1024;
+      regs.carryFlag = true;
+      regs.negFlag = false;
+    }
+    else{
+      regs.acc = (regs.acc ^ 1023) + 1;
+      regs.carryFlag = false;
+      regs.negFlag = true;
+    }
+    if(regs.acc==0)regs.zeroFlag = true;
+  }
+
+  void doCompare(int reg, int data){
+    value = reg - data;
+    if(value==0)regs.zeroFlag = true;
+    else regs.zeroFlag = false;
+    if(value<0)regs.negFlag = true;
+    else regs.negFlag = false;
+  }
+
+  void doXinc(){
+    doIncrement(regs.xReg);
+  }
+
+  void doXdec(){
+    doDecrement(regs.xReg);
+  }
+
+  void doIncrement(int &reg){
+    reg++;
+    if(reg==0)regs.zeroFlag = true;
+    else regs.zeroFlag = false;
+    if(reg>1023){
+      regs.carryFlag = true;
+      reg = reg%1024;
+    }
+    else regs.carryFlag = false;
+  }
+
+  void doDecrement(int &reg){
+    reg--;
+    if(reg==0)regs.zeroFlag = true;
+    else regs.zeroFlag = false;
+    if(reg<0){
+      regs.negFlag = true;
+      reg = reg + 1024;
+    }
+    else regs.negFlag = false;
+  }
+
+  void doSwap(int &first, int &second){
+    int held = first;
+    first = second;
+    second = held;
+  }
+
+  void doSwapas(){
+    // Swaps the accumulator with the value on top of the stack
+    int top = stackPull();
+    if(runError)return;
+    stackPush(regs.acc);
+    regs.acc = top;
+  }
+
+  void doLshift(){
+    regs.acc = (regs.acc * 2) + regs.carryFlag;
+    if(regs.acc>1023){
+      regs.acc = regs.acc%1024;
+      regs.carryFlag = true;
+    }
+    else regs.carryFlag = false;
+  }
+
+  void doRshift(){
+    if(regs.acc & 1){
+      value = 1;
+      regs.acc--;
+    }
+    else value = 0;     // value holds the LSB which will become the carry flag
+    regs.acc = regs.acc/2;
+    if(regs.carryFlag) regs.acc = regs.acc + 512; // Set the MSB
+    if(value==1) regs.carryFlag = true;
+    else regs.carryFlag = false;
+  }
+
+  void doStore(int address, int data){
+    address &= 1023;
+    data &= WORD_MASK;
+    writeMem(address, data);
+    if(address<IO_BASE)return;
+    int i = address-IO_BASE;
+    if(ioWriteMap[i>>5] & (1UL<<(i&31)))devices[i].write(*this, address, data);
+  }
+
+  void doGetkey(){
+    // Takes the key from the keyboard port, leaving 0 for "no key"
+    regs.acc = readMem(KEYB_IN);
+    writeMem(KEYB_IN, 0);
+  }
+
+ /**
+  * Built-in devices
+  * 
+  * The standard SIM40 ports, attached by the constructor. Boards with real
+  * hardware to drive can attach their own handlers over the top of these.
+  */
+  static void timerWrite(sim40 &sim, int address, int data){
+    // Writing to the timer (re)starts it counting down to zero
+    sim.events.cancel(EVENT_TIMER);
+    if(data>0)sim.events.schedule(sim.clock+TIMER_TICK, EVENT_TIMER);
+  }
+
+  static int randomRead(sim40 &sim, int address){
+    return random(1024);
+  }
+
+  static void soundWrite(sim40 &sim, int address, int data){
+    // Writing the duration (in tenths of a second) plays the note at PITCH (Hz)
+    if(sim.trace)Serial.printf("Sound: %i Hz for %i\n", sim.memory[PITCH], data);
+#ifdef SIM40_SPEAKER_PIN
+    if(sim.memory[PITCH]>0 && data>0)tone(SIM40_SPEAKER_PIN, sim.memory[PITCH], data*100);
+#endif
+  }
+
+  static void videoWrite(sim40 &sim, int address, int data){
+    char chr = data;
+    sim.videoOut(chr);
+  }
+
+  static void serialWrite(sim40 &sim, int address, int data){
+    Serial.write((uint8_t)data);
+  }
+
+  static void parallelWrite(sim40 &sim, int address, int data){
+    if(sim.trace)Serial.printf("Parallel out: %i\n", data);
+  }
+
+  void doPause(int tenths){
+    suspended = true;
+    events.schedule(clock+tenths*TIMER_TICK, EVENT_WAKE);
+  }
+
+  void doWait(){
+    if(intPending)return;
+    suspended = true;
+    waitingForInt = true;
+  }
+
+  void doRetfint(){
+    regs.progCounter = stackPull();
+    writeMem(INT_ENABLE, 1);
+  }
+
+ /**
+  * Interrupts
+  * 
+  * A source raises an interrupt by setting its bit in intLatched. While 
+  * INT_ENABLE is non-zero, the engines take a latched interrupt before the
+  * next instruction: the return address is pushed, INT_ENABLE is cleared so
+  * that handlers aren't interrupted themselves, and the program counter is
+  * loaded from INT_V. retfint pulls the return address and sets INT_ENABLE
+  * again. The engines only look at intPending, which is kept up to date 
+  * here, so a program that doesn't use interrupts pays for one flag test.
+  */
+  void raiseInterrupt(int source){
+    intLatched |= source;
+    updateInterrupts();
+  }
+
+  void updateInterrupts(){
+    intPending = intLatched!=0 && memory[INT_ENABLE]!=0;
+    if(intPending && waitingForInt){
+      suspended = false;
+      waitingForInt = false;
+    }
+  }
+
+  bool takeInterrupt(){
+    int source = intLatched & -intLatched;  // Lowest numbered source first
+    intLatched &= ~source;
+    if(trace)Serial.printf("Taking interrupt %i\n", source);
+    writeMem(INT_ENABLE, 0);
+    if(!stackPush(regs.progCounter))return false;
+    regs.progCounter = memory[INT_V];
+    return true;
+  }
+
+ /**
+  * keyPress / serialIn
+  * 
+  * Deliver input to the KEYB_IN and SERIAL_IN ports, raising their
+  * interrupts.
+  */
+  void keyPress(int key){
+    writeMem(KEYB_IN, key);
+    raiseInterrupt(INT_KEYB);
+  }
+
+  void serialIn(int value){
+    writeMem(SERIAL_IN, value);
+    raiseInterrupt(INT_SERIAL);
+  }
+
+  void doPrintb(){
+    Serial.print(regs.acc, BIN);
+    for(int i=9;i>=0;i--)if(bitRead(regs.acc,i))videoOut('1');else videoOut('0');
+  }
+
+  void doPrintd(int address){
+    value = readMem(address) + (readMem((address+1) & WORD_MASK)*1024);
+    Serial.print(value);
+    output.print(value);
+  }
+
+  void doUnknown(int address){
+    videoOut("!!RUN ERROR: unknown program instruction: ");
+    output.print(memory[address]);
+    simRunning=false;
+    runError=true;
+  }
+
+  void doOverflow(){
+    Serial.println("!!Error: program counter overflow");
+    videoOut("!!RUN ERROR: program counter overflow");
+    simRunning=false;
+    runError=true;
+  }
+
  /**
   * doInstruction
   * 
-  * Actions the next instruction
+  * Actions the next instruction. The instruction comes from the decode
+  * cache, so the opcode and operand are only looked up in memory the first
+  * time round; the program counter is stepped past it before it is actioned.
   */
   void doInstruction(){
     char chr;
-    String tmp;
+
+    // A paused program stays put until its wake time
+    if(suspended){
+      tickClock(0);
+      if(fastForward)skipIdle();
+      if(suspended)return;
+    }
+    if(intPending && !takeInterrupt())return;
 
     //Serial.println("Doing next instruction...");
-    int instruction = memory[regs.progCounter++];
-    if(trace)Serial.printf("Next instruction is %i\n", instruction);
-    switch(instruction){
+    const decoded d = decode(regs.progCounter);
+    int address = d.operand;
+    regs.progCounter += d.length;
+    if(trace)Serial.printf("Next instruction is %i\n", memory[regs.progCounter-d.length]);
+    switch(d.opcode){
       case  0: //stop
         simRunning=false;
         Serial.println("Program run concluded");
@@ -307,139 +1084,89 @@ void videoOut(String oput){
         }
         break;
       case  1: //load
-        regs.acc = memory[memory[regs.progCounter++]];
+        regs.acc = readMem(address);
         if(trace) Serial.printf("Setting acc to %i\n",regs.acc);
         break;
       case  2: //store
-        memory[memory[regs.progCounter]] = regs.acc;
-        if(trace) Serial.printf("Storing %i in %i\n",regs.acc,memory[regs.progCounter]);
-        if(memory[regs.progCounter]==1015){
-          chr = regs.acc;
-          tmp = chr;
-          videoOut(tmp); // 1015 is video out port
-        }
-        regs.progCounter++;
+        if(trace) Serial.printf("Storing %i in %i\n",regs.acc,address);
+        doStore(address, regs.acc);
         break;
       case  3: //add
-        regs.acc = regs.acc + memory[memory[regs.progCounter++]];
-        if(regs.carryFlag)regs.acc++;
-        if(regs.acc>1023){
-          regs.acc = regs.acc%1024;
-          regs.carryFlag = true;
-        }
-        if(regs.acc==0)regs.zeroFlag=true;
+        doAdd(readMem(address));
         if(trace){
           Serial.printf("acc is now %i\n",regs.acc);
           //output += "acc is now " + String(regs.acc) + "\n";
         }
         break;
       case  4: //sub
-        regs.acc = regs.acc + (memory[memory[regs.progCounter++]] ^ 1023) + regs.carryFlag;
-        if(regs.acc>1023){
-          regs.acc = regs.acc%1024;
-          regs.carryFlag = true;
-          regs.negFlag = false;
-        }
-        else{
-          regs.acc = (regs.acc ^ 1023) + 1;
-          regs.carryFlag = false;
-          regs.negFlag = true;
-        }
-        if(regs.acc==0)regs.zeroFlag = true;
+        doSub(readMem(address));
         if(trace)Serial.printf("acc is now %i\n",regs.acc);
         break;
       case  5: //bitwise and (&)
-        regs.acc = regs.acc & memory[memory[regs.progCounter]];
-        if(trace)Serial.printf("A: %i, memory[PC]: %i, memory[memory[PC]]: %i\n", regs.acc,memory[regs.progCounter],memory[memory[regs.progCounter]]);
-        regs.progCounter++;
-        if(regs.acc==0)regs.zeroFlag=true;
-        else regs.zeroFlag=false;
+        regs.acc = regs.acc & readMem(address);
+        if(trace)Serial.printf("A: %i, memory[PC]: %i, memory[memory[PC]]: %i\n", regs.acc,address,memory[address]);
+        regs.zeroFlag = (regs.acc==0);
         break;
       case  6: //bitwise or (|)
-        regs.acc = regs.acc | memory[memory[regs.progCounter++]];
-        if(regs.acc==0)regs.zeroFlag=true;
-        else regs.zeroFlag=false;
+        regs.acc = regs.acc | readMem(address);
+        regs.zeroFlag = (regs.acc==0);
         break;
       case  7: //bitwise eor (^)
-        regs.acc = regs.acc ^ memory[memory[regs.progCounter++]];
-        if(regs.acc==0)regs.zeroFlag=true;
-        else regs.zeroFlag=false;
+        regs.acc = regs.acc ^ readMem(address);
+        regs.zeroFlag = (regs.acc==0);
         break;
       case  8: //jump
-        regs.progCounter = memory[regs.progCounter];
+        regs.progCounter = address;
         break;
       case  9: //comp
-        value = regs.acc - memory[memory[regs.progCounter++]];
-        if(value==0)regs.zeroFlag = true;
-        else regs.zeroFlag = false;
-        if(value<0)regs.negFlag = true;
-        else regs.negFlag = false;
+        doCompare(regs.acc, readMem(address));
         break;
       case  10: //jineg
-        if(regs.negFlag)regs.progCounter = memory[regs.progCounter];
-        else regs.progCounter++;
+        if(regs.negFlag)regs.progCounter = address;
         break;
       case  11: //jipos
-        if(!regs.negFlag)regs.progCounter = memory[regs.progCounter];
-        else regs.progCounter++;
+        if(!regs.negFlag)regs.progCounter = address;
         break;
       case  12: //jizero
-        if(regs.zeroFlag)regs.progCounter = memory[regs.progCounter];
-        else regs.progCounter++;
+        if(regs.zeroFlag)regs.progCounter = address;
         break;
       case  13: //jmptosr
-        // Get the jump address
-        value = memory[regs.progCounter++];
         // Push the return address onto the stack
         stackPush(regs.progCounter);
         // point to the subroutine
-        regs.progCounter = value;
+        regs.progCounter = address;
         break;
       case  14: //jicarry
-        if(regs.carryFlag)regs.progCounter = memory[regs.progCounter];
-        else regs.progCounter++;
+        if(regs.carryFlag)regs.progCounter = address;
         break;
       case 15: //xload
-        regs.xReg = memory[memory[regs.progCounter++]];
+        regs.xReg = readMem(address);
         if(trace)Serial.printf("Setting xReg to %i\n",regs.xReg);
         break;
       case 16: //xstore
-        memory[memory[regs.progCounter]] = regs.xReg;
-        if(trace){
-          Serial.printf("Storing %i in %i\n",regs.xReg,memory[regs.progCounter]);
-        }
-        regs.progCounter++;
+        if(trace)Serial.printf("Storing %i in %i\n",regs.xReg,address);
+        doStore(address, regs.xReg);
         break;
       case 17: //loadmx
-        regs.acc = memory[memory[regs.progCounter++]+regs.xReg];
+        regs.acc = readMem(address+regs.xReg);
         if(trace)Serial.printf("Setting acc to %i\n",regs.acc);
         break;
       case 18: //xcomp
-        value = regs.xReg - memory[memory[regs.progCounter++]];
-        if(value==0)regs.zeroFlag = true;
-        else regs.zeroFlag = false;
-        if(value<0)regs.negFlag = true;
-        else regs.negFlag = false;
+        doCompare(regs.xReg, readMem(address));
         break;
       case 19: //yload
-        regs.yReg = memory[memory[regs.progCounter++]];
+        regs.yReg = readMem(address);
         if(trace)Serial.printf("Setting yReg to %i\n",regs.yReg);
         break;
       case 20: //ystore
-        memory[memory[regs.progCounter]] = regs.yReg;
-        if(trace){
-          Serial.printf("Storing %i in %i\n",regs.yReg,memory[regs.progCounter]);
-        }
-        regs.progCounter++;
+        if(trace)Serial.printf("Storing %i in %i\n",regs.yReg,address);
+        doStore(address, regs.yReg);
         break;
       case 21: //pause
-        value = memory[memory[regs.progCounter++]] * 100;
-        delay(value);
+        doPause(readMem(address));
         break;
       case 22: //printd
-        value = memory[memory[regs.progCounter]] + (memory[memory[regs.progCounter++]+1]*1024);
-        Serial.print(value);
-        output += value;
+        doPrintd(address);
         break;
       case 23: //return
         // get the return address
@@ -458,80 +1185,706 @@ void videoOut(String oput){
         regs.xReg = stackPull();
         break;
       case 28: //xinc
-        regs.xReg++;
-        if(regs.xReg==0)regs.zeroFlag = true;
-        else regs.zeroFlag = false;
-        if(regs.xReg>1023){
-          regs.carryFlag = true;
-          regs.xReg = regs.xReg%1024;
-        }
-        else regs.carryFlag = false;
+        doXinc();
         break;
       case 29: //xdec
-        regs.xReg--;
-        if(regs.xReg==0)regs.zeroFlag = true;
-        else regs.zeroFlag = false;
-        if(regs.xReg<0){
-          regs.negFlag = true;
-          regs.xReg = regs.xReg + 1024;
-        }
-        else regs.negFlag = false;
+        doXdec();
         break;
       case 30: //lshift
-        regs.acc = (regs.acc * 2) + regs.carryFlag;
-        if(regs.acc>1023){
-          regs.acc = regs.acc%1024;
-          regs.carryFlag = true;
-        }
-        else regs.carryFlag = false;
+        doLshift();
         break;
       case 31: //rshift
-        if(regs.acc & 1){
-          value = 1;
-          regs.acc--;
-        }
-        else value = 0;     // value holds the LSB which will become the carry flag
-        regs.acc = regs.acc/2;
-        if(regs.carryFlag) regs.acc = regs.acc + 512; // Set the MSB
-        if(value==1) regs.carryFlag = true;
-        else regs.carryFlag = false;
+        doRshift();
         break;
       case 32: //cset
         regs.carryFlag=true;
         break;
       case 33: //cclear
         regs.carryFlag=false;
-        if(trace) //output += "Setting carry flag to " + String(regs.carryFlag) + "\n";
+        //if(trace)output += "Setting carry flag to " + String(regs.carryFlag) + "\n";
+        break;
+      case 34: //getkey
+        doGetkey();
+        if(trace)Serial.printf("Setting acc to %i\n",regs.acc);
+        break;
+      case 35: //wait
+        doWait();
+        break;
+      case 36: //retfint
+        doRetfint();
         break;
       case 37: //printb
-        Serial.print(regs.acc, BIN);
-        for(int i=9;i>=0;i--)if(bitRead(regs.acc,i))videoOut("1");else videoOut("0");
+        doPrintb();
         break;
       case 38: //print
         Serial.print(regs.acc);
-        videoOut(String(regs.acc));
+        output.print(regs.acc);
         break;
       case 39: //printch
         chr = regs.acc;
         if(trace)Serial.print(chr);
-        videoOut(String(chr));
+        videoOut(chr);
+        break;
+      case 40: //ypush
+        stackPush(regs.yReg);
+        break;
+      case 41: //ypull
+        regs.yReg = stackPull();
+        break;
+      case 42: //yinc
+        doIncrement(regs.yReg);
+        break;
+      case 43: //ydec
+        doDecrement(regs.yReg);
+        break;
+      case 44: //swapax
+        doSwap(regs.acc, regs.xReg);
+        break;
+      case 45: //swapay
+        doSwap(regs.acc, regs.yReg);
+        break;
+      case 46: //swapxy
+        doSwap(regs.xReg, regs.yReg);
+        break;
+      case 47: //swapas
+        doSwapas();
+        break;
+      case 48: //intenable
+        writeMem(INT_ENABLE, 1);
+        break;
+      case 49: //intdisable
+        writeMem(INT_ENABLE, 0);
         break;
       case 50: //NOP - but uncomment for stop instead
         //running = false;
         break;
       default:
-        tmp = "!!RUN ERROR: unknown program instruction: "+String(instruction);
-        videoOut(tmp);
-        simRunning=false;
+        doUnknown(regs.progCounter-d.length);
         break;
     }
     
-    if(regs.progCounter>1023){
-      Serial.println("!!Error: program counter overflow");
-      videoOut("!!RUN ERROR: program counter overflow");
+    if(regs.progCounter>1023)doOverflow();
+    tickClock(1);
+    if(trace)Serial.println("Instruction completed");
+    return;
+  }
+
+ /**
+  * runThreaded
+  * 
+  * A second execution engine which runs up to budget instructions, stopping
+  * early if the program halts or reaches a breakpoint. Rather than going 
+  * round a switch, each handler jumps straight to the next one through a 
+  * table of label addresses (a GCC extension, which the ESP32 toolchain 
+  * supports). Trace is a template parameter, so runThreaded<false> contains
+  * no logging at all; run() picks the version to use.
+  * @param  uint32_t budget  Most instructions to run; must be at least 1
+  * @return uint32_t         Number of instructions actually run
+  */
+  template<bool Trace> uint32_t runThreaded(uint32_t budget){
+    static void *const handlers[DECODE_UNKNOWN+1] = {
+      &&op_stop, &&op_load, &&op_store, &&op_add, &&op_sub,
+      &&op_and, &&op_or, &&op_eor, &&op_jump, &&op_comp,
+      &&op_jineg, &&op_jipos, &&op_jizero, &&op_jmptosr, &&op_jicarry,
+      &&op_xload, &&op_xstore, &&op_loadmx, &&op_xcomp, &&op_yload,
+      &&op_ystore, &&op_pause, &&op_printd, &&op_return, &&op_push,
+      &&op_pull, &&op_xpush, &&op_xpull, &&op_xinc, &&op_xdec,
+      &&op_lshift, &&op_rshift, &&op_cset, &&op_cclear, &&op_getkey,
+      &&op_wait, &&op_retfint, &&op_printb, &&op_print, &&op_printch,
+      &&op_ypush, &&op_ypull, &&op_yinc, &&op_ydec, &&op_swapax,
+      &&op_swapay, &&op_swapxy, &&op_swapas, &&op_intenable, &&op_intdisable,
+      &&op_nop, &&op_unknown
+    };
+    decoded  d;
+    char     chr;
+    uint32_t count = 0;
+
+    // Fetch the next instruction, step past it and jump to its handler
+    #define SIM40_DISPATCH() \
+      if(intPending && !takeInterrupt())return count; \
+      if(breakCount && atBreakpoint())return count; \
+      d = decode(regs.progCounter); \
+      regs.progCounter += d.length; \
+      if(Trace)Serial.printf("Next instruction is %i\n", memory[regs.progCounter-d.length]); \
+      goto *handlers[d.opcode]
+    // Finish off the instruction, then carry on if we're still running
+    #define SIM40_NEXT() \
+      if(regs.progCounter>1023)doOverflow(); \
+      if(Trace)Serial.println("Instruction completed"); \
+      if(++count>=budget || !simRunning)return count; \
+      SIM40_DISPATCH()
+
+    if(!simRunning)return count;
+    SIM40_DISPATCH();
+
+    op_stop:
       simRunning=false;
+      Serial.println("Program run concluded");
+      videoOut("\n===\nProgram run concluded\n");
+      if(Trace){
+        Serial.println("Program memory: ");
+        Serial.println(displayMem(0,23));
+      }
+      SIM40_NEXT();
+    op_load:
+      regs.acc = readMem(d.operand);
+      if(Trace)Serial.printf("Setting acc to %i\n",regs.acc);
+      SIM40_NEXT();
+    op_store:
+      if(Trace)Serial.printf("Storing %i in %i\n",regs.acc,d.operand);
+      doStore(d.operand, regs.acc);
+      SIM40_NEXT();
+    op_add:
+      doAdd(readMem(d.operand));
+      if(Trace)Serial.printf("acc is now %i\n",regs.acc);
+      SIM40_NEXT();
+    op_sub:
+      doSub(readMem(d.operand));
+      if(Trace)Serial.printf("acc is now %i\n",regs.acc);
+      SIM40_NEXT();
+    op_and:
+      regs.acc = regs.acc & readMem(d.operand);
+      if(Trace)Serial.printf("A: %i, memory[PC]: %i, memory[memory[PC]]: %i\n", regs.acc,d.operand,memory[d.operand]);
+      regs.zeroFlag = (regs.acc==0);
+      SIM40_NEXT();
+    op_or:
+      regs.acc = regs.acc | readMem(d.operand);
+      regs.zeroFlag = (regs.acc==0);
+      SIM40_NEXT();
+    op_eor:
+      regs.acc = regs.acc ^ readMem(d.operand);
+      regs.zeroFlag = (regs.acc==0);
+      SIM40_NEXT();
+    op_jump:
+      regs.progCounter = d.operand;
+      SIM40_NEXT();
+    op_comp:
+      doCompare(regs.acc, readMem(d.operand));
+      SIM40_NEXT();
+    op_jineg:
+      if(regs.negFlag)regs.progCounter = d.operand;
+      SIM40_NEXT();
+    op_jipos:
+      if(!regs.negFlag)regs.progCounter = d.operand;
+      SIM40_NEXT();
+    op_jizero:
+      if(regs.zeroFlag)regs.progCounter = d.operand;
+      SIM40_NEXT();
+    op_jmptosr:
+      stackPush(regs.progCounter);
+      regs.progCounter = d.operand;
+      SIM40_NEXT();
+    op_jicarry:
+      if(regs.carryFlag)regs.progCounter = d.operand;
+      SIM40_NEXT();
+    op_xload:
+      regs.xReg = readMem(d.operand);
+      if(Trace)Serial.printf("Setting xReg to %i\n",regs.xReg);
+      SIM40_NEXT();
+    op_xstore:
+      if(Trace)Serial.printf("Storing %i in %i\n",regs.xReg,d.operand);
+      doStore(d.operand, regs.xReg);
+      SIM40_NEXT();
+    op_loadmx:
+      regs.acc = readMem(d.operand+regs.xReg);
+      if(Trace)Serial.printf("Setting acc to %i\n",regs.acc);
+      SIM40_NEXT();
+    op_xcomp:
+      doCompare(regs.xReg, readMem(d.operand));
+      SIM40_NEXT();
+    op_yload:
+      regs.yReg = readMem(d.operand);
+      if(Trace)Serial.printf("Setting yReg to %i\n",regs.yReg);
+      SIM40_NEXT();
+    op_ystore:
+      if(Trace)Serial.printf("Storing %i in %i\n",regs.yReg,d.operand);
+      doStore(d.operand, regs.yReg);
+      SIM40_NEXT();
+    op_pause:
+      // Pausing always ends the run, so it is finished off here
+      doPause(readMem(d.operand));
+      if(regs.progCounter>1023)doOverflow();
+      if(Trace)Serial.println("Instruction completed");
+      return count+1;
+    op_printd:
+      doPrintd(d.operand);
+      SIM40_NEXT();
+    op_return:
+      regs.progCounter = stackPull();
+      SIM40_NEXT();
+    op_push:
+      stackPush(regs.acc);
+      SIM40_NEXT();
+    op_pull:
+      regs.acc = stackPull();
+      SIM40_NEXT();
+    op_xpush:
+      stackPush(regs.xReg);
+      SIM40_NEXT();
+    op_xpull:
+      regs.xReg = stackPull();
+      SIM40_NEXT();
+    op_xinc:
+      doXinc();
+      SIM40_NEXT();
+    op_xdec:
+      doXdec();
+      SIM40_NEXT();
+    op_lshift:
+      doLshift();
+      SIM40_NEXT();
+    op_rshift:
+      doRshift();
+      SIM40_NEXT();
+    op_cset:
+      regs.carryFlag=true;
+      SIM40_NEXT();
+    op_cclear:
+      regs.carryFlag=false;
+      SIM40_NEXT();
+    op_getkey:
+      doGetkey();
+      if(Trace)Serial.printf("Setting acc to %i\n",regs.acc);
+      SIM40_NEXT();
+    op_printb:
+      doPrintb();
+      SIM40_NEXT();
+    op_print:
+      Serial.print(regs.acc);
+      output.print(regs.acc);
+      SIM40_NEXT();
+    op_printch:
+      chr = regs.acc;
+      if(Trace)Serial.print(chr);
+      videoOut(chr);
+      SIM40_NEXT();
+    op_wait:
+      // Waiting may end the run, so it is finished off here
+      doWait();
+      if(Trace)Serial.println("Instruction completed");
+      if(suspended)return count+1;
+      SIM40_NEXT();
+    op_retfint:
+      doRetfint();
+      SIM40_NEXT();
+    op_ypush:
+      stackPush(regs.yReg);
+      SIM40_NEXT();
+    op_ypull:
+      regs.yReg = stackPull();
+      SIM40_NEXT();
+    op_yinc:
+      doIncrement(regs.yReg);
+      SIM40_NEXT();
+    op_ydec:
+      doDecrement(regs.yReg);
+      SIM40_NEXT();
+    op_swapax:
+      doSwap(regs.acc, regs.xReg);
+      SIM40_NEXT();
+    op_swapay:
+      doSwap(regs.acc, regs.yReg);
+      SIM40_NEXT();
+    op_swapxy:
+      doSwap(regs.xReg, regs.yReg);
+      SIM40_NEXT();
+    op_swapas:
+      doSwapas();
+      SIM40_NEXT();
+    op_intenable:
+      writeMem(INT_ENABLE, 1);
+      SIM40_NEXT();
+    op_intdisable:
+      writeMem(INT_ENABLE, 0);
+      SIM40_NEXT();
+    op_nop:
+      SIM40_NEXT();
+    op_unknown:
+      doUnknown(regs.progCounter-d.length);
+      SIM40_NEXT();
+
+    #undef SIM40_NEXT
+    #undef SIM40_DISPATCH
+  }
+
+ /**
+  * runBlocks
+  * 
+  * A third execution engine, which works a block at a time rather than an
+  * instruction at a time. Each block is translated once and then runs with
+  * a single lookup and a single program counter check at its end. If the
+  * program writes into code that has been translated, the cache is flushed
+  * and the block stops straight after the write, so self-modifying code 
+  * still behaves as it would under doInstruction. There is no trace output.
+  * When the budget has less left in it than the next block needs, the 
+  * remaining instructions are run one at a time by runThreaded<false>.
+  * @param  uint32_t budget  Most instructions to run
+  * @return uint32_t         Number of instructions actually run
+  */
+  uint32_t runBlocks(uint32_t budget){
+    char     chr;
+    uint32_t count = 0;
+
+    while(simRunning && !suspended && count<budget){
+      if(intPending && !takeInterrupt())break;
+      if(breakCount && atBreakpoint())break;
+      int index = blockIndex[regs.progCounter];
+      if(index==NO_BLOCK)index = translateBlock(regs.progCounter);
+      const block   &blk = blocks[index];
+      if(blk.length>budget-count){
+        breakSkip = regs.progCounter;   // Already checked for a breakpoint
+        count += runThreaded<false>(budget-count);
+        break;
+      }
+      const blockOp *op  = &blockPool[blk.first];
+      const blockOp *end = op + blk.count;
+      regs.progCounter = blk.endPc;
+      leaveBlock = false;
+      for(;op<end;op++){
+        switch(op->opcode){
+          case  0: //stop
+            simRunning=false;
+            Serial.println("Program run concluded");
+            videoOut("\n===\nProgram run concluded\n");
+            break;
+          case  1: //load
+            regs.acc = readMem(op->a);
+            break;
+          case  2: //store
+            doStore(op->a, regs.acc);
+            if(leaveBlock){
+              regs.progCounter = op->nextPc;
+              goto blockDone;
+            }
+            break;
+          case  3: //add
+            doAdd(readMem(op->a));
+            break;
+          case  4: //sub
+            doSub(readMem(op->a));
+            break;
+          case  5: //bitwise and (&)
+            regs.acc = regs.acc & readMem(op->a);
+            regs.zeroFlag = (regs.acc==0);
+            break;
+          case  6: //bitwise or (|)
+            regs.acc = regs.acc | readMem(op->a);
+            regs.zeroFlag = (regs.acc==0);
+            break;
+          case  7: //bitwise eor (^)
+            regs.acc = regs.acc ^ readMem(op->a);
+            regs.zeroFlag = (regs.acc==0);
+            break;
+          case  8: //jump
+            regs.progCounter = op->a;
+            break;
+          case  9: //comp
+            doCompare(regs.acc, readMem(op->a));
+            break;
+          case 10: //jineg
+            if(regs.negFlag)regs.progCounter = op->a;
+            break;
+          case 11: //jipos
+            if(!regs.negFlag)regs.progCounter = op->a;
+            break;
+          case 12: //jizero
+            if(regs.zeroFlag)regs.progCounter = op->a;
+            break;
+          case 13: //jmptosr
+            stackPush(op->nextPc);
+            regs.progCounter = op->a;
+            break;
+          case 14: //jicarry
+            if(regs.carryFlag)regs.progCounter = op->a;
+            break;
+          case 15: //xload
+            regs.xReg = readMem(op->a);
+            break;
+          case 16: //xstore
+            doStore(op->a, regs.xReg);
+            if(leaveBlock){
+              regs.progCounter = op->nextPc;
+              goto blockDone;
+            }
+            break;
+          case 17: //loadmx
+            regs.acc = readMem(op->a+regs.xReg);
+            break;
+          case 18: //xcomp
+            doCompare(regs.xReg, readMem(op->a));
+            break;
+          case 19: //yload
+            regs.yReg = readMem(op->a);
+            break;
+          case 20: //ystore
+            doStore(op->a, regs.yReg);
+            if(leaveBlock){
+              regs.progCounter = op->nextPc;
+              goto blockDone;
+            }
+            break;
+          case 21: //pause
+            doPause(readMem(op->a));
+            break;
+          case 22: //printd
+            doPrintd(op->a);
+            break;
+          case 23: //return
+            regs.progCounter = stackPull();
+            break;
+          case 24: //push
+            stackPush(regs.acc);
+            break;
+          case 25: //pull
+            regs.acc = stackPull();
+            break;
+          case 26: //xpush
+            stackPush(regs.xReg);
+            break;
+          case 27: //xpull
+            regs.xReg = stackPull();
+            break;
+          case 28: //xinc
+            doXinc();
+            break;
+          case 29: //xdec
+            doXdec();
+            break;
+          case 30: //lshift
+            doLshift();
+            break;
+          case 31: //rshift
+            doRshift();
+            break;
+          case 32: //cset
+            regs.carryFlag=true;
+            break;
+          case 33: //cclear
+            regs.carryFlag=false;
+            break;
+          case 34: //getkey
+            doGetkey();
+            break;
+          case 37: //printb
+            doPrintb();
+            break;
+          case 38: //print
+            Serial.print(regs.acc);
+            output.print(regs.acc);
+            break;
+          case 39: //printch
+            chr = regs.acc;
+            videoOut(chr);
+            break;
+          case 35: //wait
+            doWait();
+            break;
+          case 36: //retfint
+            doRetfint();
+            break;
+          case 40: //ypush
+            stackPush(regs.yReg);
+            break;
+          case 41: //ypull
+            regs.yReg = stackPull();
+            break;
+          case 42: //yinc
+            doIncrement(regs.yReg);
+            break;
+          case 43: //ydec
+            doDecrement(regs.yReg);
+            break;
+          case 44: //swapax
+            doSwap(regs.acc, regs.xReg);
+            break;
+          case 45: //swapay
+            doSwap(regs.acc, regs.yReg);
+            break;
+          case 46: //swapxy
+            doSwap(regs.xReg, regs.yReg);
+            break;
+          case 47: //swapas
+            doSwapas();
+            break;
+          case 48: //intenable
+            writeMem(INT_ENABLE, 1);
+            break;
+          case 49: //intdisable
+            writeMem(INT_ENABLE, 0);
+            break;
+          case 50: //nop
+            break;
+          case FUSED_LOADADD:
+            regs.acc = readMem(op->a);
+            doAdd(readMem(op->b));
+            break;
+          case FUSED_LOADSUB:
+            regs.acc = readMem(op->a);
+            doSub(readMem(op->b));
+            break;
+          case FUSED_COMPJZ:
+            doCompare(regs.acc, readMem(op->a));
+            if(regs.zeroFlag)regs.progCounter = op->b;
+            break;
+          case FUSED_XINCXCOMP:
+            doXinc();
+            doCompare(regs.xReg, readMem(op->b));
+            break;
+          case FUSED_XCOMPJZ:
+            doCompare(regs.xReg, readMem(op->a));
+            if(regs.zeroFlag)regs.progCounter = op->b;
+            break;
+          default:
+            doUnknown(op->a);
+            break;
+        }
+      }
+      blockDone:
+      // A store that leaves the block early leaves op at itself
+      count += op<end ? op->done : blk.length;
+      if(regs.progCounter>1023)doOverflow();
     }
-    Serial.println("Instruction completed");
-    return;
+    return count;
   }
-};
+
+ /**
+  * tickClock
+  * 
+  * Moves the virtual clock on and deals with any events that have become
+  * due. Normally the clock keeps pace with millis(); in fast-forward mode it
+  * moves on by 1 ms for every FF_RATE instructions run instead, which makes
+  * timings the same from one run to the next.
+  * @param uint32_t ran  Instructions run since the last tick
+  */
+  void tickClock(uint32_t ran){
+    if(fastForward){
+      clockInstructions += ran;
+      clock += clockInstructions / FF_RATE;
+      clockInstructions %= FF_RATE;
+    }
+    else{
+      unsigned long now = millis();
+      clock += now - lastMillis;
+      lastMillis = now;
+    }
+    while(events.due(clock))doEvent(events.pop());
+  }
+
+  void doEvent(simEvent event){
+    switch(event.type){
+      case EVENT_WAKE:
+        suspended = false;
+        break;
+      case EVENT_TIMER:
+        if(memory[TIMER]>0){
+          writeMem(TIMER, memory[TIMER]-1);
+          if(memory[TIMER]>0)events.schedule(event.when+TIMER_TICK, EVENT_TIMER);
+          else raiseInterrupt(INT_TIMER);
+        }
+        break;
+    }
+  }
+
+ /**
+  * skipIdle
+  * 
+  * In fast-forward mode, a paused program doesn't wait: the clock jumps
+  * straight to each event in turn until the program wakes up.
+  * @return bool  true if the program is now awake
+  */
+  bool skipIdle(){
+    while(suspended && !events.empty()){
+      if((long)(events.next()-clock)>0)clock = events.next();
+      while(events.due(clock))doEvent(events.pop());
+    }
+    return !suspended;
+  }
+
+  void setFastForward(bool on){
+    fastForward = on;
+    lastMillis = millis();
+  }
+
+  bool getFastForward(){
+    return fastForward;
+  }
+
+  unsigned long getClock(){
+    return clock;
+  }
+
+ /**
+  * run
+  * 
+  * Runs the program for at most maxCycles instructions and says why it
+  * stopped. The trace setting is read once, here: with trace on, the 
+  * logging version of the threaded engine is used, and with it off, the 
+  * block engine. Calling run() again carries on where it left off, 
+  * including from a breakpoint. A paused program returns STOP_WAITING
+  * until its wake time comes round, unless fast-forward is on.
+  * @param  uint32_t   maxCycles  Most instructions to run
+  * @return stopReason
+  */
+  stopReason run(uint32_t maxCycles){
+    uint32_t count = 0;
+    uint32_t ran;
+    breakHit = false;
+    breakSkip = regs.progCounter;
+    tickClock(0);
+    while(simRunning && count<maxCycles && !breakHit){
+      if(suspended && !(fastForward && skipIdle()))break;
+      if(trace)ran = runThreaded<true>(maxCycles-count);
+      else ran = runBlocks(maxCycles-count);
+      count += ran;
+      tickClock(ran);
+    }
+    if(suspended && fastForward)skipIdle();
+    instructionCount += count;
+    if(!simRunning)return runError ? STOP_ERROR : STOP_HALTED;
+    if(breakHit)return STOP_BREAKPOINT;
+    if(suspended)return STOP_WAITING;
+    return STOP_BUDGET;
+  }
+
+ /**
+  * step
+  *
+  * Runs exactly one instruction of a program that isn't running, as run()
+  * would, and leaves it stopped again after it; run(1) won't do, as the
+  * block engine counts whole blocks. A paused program doesn't move until
+  * its wake time comes round, unless fast-forward is on.
+  * @return stopReason  STOP_HALTED or STOP_ERROR if that instruction ended
+  *                     the program, STOP_WAITING if it is paused, and
+  *                     STOP_BUDGET otherwise
+  */
+  stopReason step(){
+    uint32_t ran = 0;
+    simRunning = true;
+    breakSkip = regs.progCounter;
+    tickClock(0);
+    if(!suspended || (fastForward && skipIdle())){
+      ran = trace ? runThreaded<true>(1) : runThreaded<false>(1);
+      tickClock(ran);
+    }
+    instructionCount += ran;
+    if(!simRunning)return runError ? STOP_ERROR : STOP_HALTED;
+    simRunning = false;
+    return suspended ? STOP_WAITING : STOP_BUDGET;
+  }
+
+ /**
+  * runUntil
+  * 
+  * Runs the program in batches until millis() reaches deadline, or until
+  * run() stops for any reason other than its budget running out.
+  * @param  unsigned long deadline  Time, in millis(), to hand back control
+  * @return stopReason
+  */
+  stopReason runUntil(unsigned long deadline){
+    stopReason reason;
+    do{
+      reason = run(RUN_BATCH);
+    }while(reason==STOP_BUDGET && (long)(millis()-deadline)<0);
+    return reason;
+  }
+};
\ No newline at end of file
@@ -0,0 +1,462 @@
+/**
+ * Class definitions for running the SIM40s in a task of their own
+ *
+ * The simTask class runs a pool of SIM40s, each with its own compiler, in
+ * a FreeRTOS task pinned to one core of the ESP32, leaving loop() and the
+ * web server with the other core to themselves. Each SIM40 belongs to one
+ * session (see sessions.h), so a room full of users each get a machine of
+ * their own. The running machines take turns: every round, each gets an
+ * equal share of SIM_TASK_SLICE, and the one that goes first moves on by
+ * one, so none is always kept waiting. How many instructions a second each
+ * one manages is measured, to show how far the pool can be stretched.
+ * The two sides never touch the same data:
+ * - commands (compile/run/halt/step/clear/key/save/reset) go to the SIM40s through a
+ *   lock-free single producer, single consumer queue (commandQueue), each
+ *   naming the session it is for;
+ * - each SIM40 publishes snapshots of its state (registers, memory)
+ *   through a seqlock (snapshotBuffer) which the web side can read at any
+ *   time without stopping it. Only the words written since the last
+ *   snapshot are copied into it, and they are added to a set of atomic
+ *   bits that the web side takes with readChanges(), so it can tell
+ *   browsers just what has changed;
+ * - their output is read straight from each SIM40's outputBuffer, which is
+ *   built to be read while it is being written.
+ * On the host build, a std::thread stands in for the FreeRTOS task.
+ * On the board, a session's program can be saved to LittleFS as an
+ * image, with its source, to be loaded again at the next boot.
+ */
+
+#include <atomic>
+#ifdef ARDUINO
+#include <LittleFS.h>
+#else
+#include <thread>
+#endif
+
+#define SIM_TASK_CORE      0     // loop() runs on core 1
+#define SIM_TASK_STACK  8192
+#define SIM_TASK_SLICE    20     // ms of running per round, shared by the running SIM40s
+#define COMMAND_QUEUE_SIZE 8     // Must be a power of two
+#ifndef SNAPSHOT_MEM
+#define SNAPSHOT_MEM    1024     // Words of memory in a snapshot, from 0
+#endif
+#define RATE_PERIOD     1000     // ms over which instructions per second are counted
+#define RATE_REPORT    10000     // ms between reports of them on the serial port
+#define BOOT_IMAGE   "/boot.img"    // The last program saved, in LittleFS
+#define BOOT_SOURCE  "/boot.cecil"
+
+typedef enum{
+  CMD_NONE,
+  CMD_COMPILE,
+  CMD_RUN,
+  CMD_HALT,
+  CMD_CLEAR,
+  CMD_KEY,
+  CMD_RESET,        // The session has a new owner: halt, and clear its output
+  CMD_STEP,         // Run one instruction, from where it was halted or from the start
+  CMD_SAVE          // Save the session's program to be loaded at the next boot
+} simCommandType;
+
+typedef struct{
+  simCommandType type;
+  String        *program;   // CMD_COMPILE only; the SIM40 side deletes it
+  int            value;     // CMD_KEY only; the key code
+  int            session;   // Which SIM40 it is for
+} simCommand;
+
+typedef struct{
+  registers regs;
+  bool      running;
+  bool      paused;         // Halted part way through, so CMD_STEP carries on
+  int       startVector;
+  uint16_t  memory[SNAPSHOT_MEM];
+  unsigned long instructionCount;
+  unsigned long instructionsPerSecond;  // Over the last RATE_PERIOD
+  uint32_t  outputCursor;   // Cursor of the output at the time
+} simSnapshot;
+
+/**
+ * commandQueue
+ *
+ * A fixed-size ring of commands, safe for exactly one writer (loop()) and
+ * one reader (the SIM40 task) without any locking. head is only written
+ * by the writer and tail only by the reader.
+ */
+class commandQueue
+{
+  private:
+  simCommand            slots[COMMAND_QUEUE_SIZE];
+  std::atomic<uint32_t> head{0};
+  std::atomic<uint32_t> tail{0};
+
+  public:
+  bool push(const simCommand &command){
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if(h - tail.load(std::memory_order_acquire) >= COMMAND_QUEUE_SIZE)return false;
+    slots[h & (COMMAND_QUEUE_SIZE-1)] = command;
+    head.store(h+1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(simCommand &command){
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if(head.load(std::memory_order_acquire) == t)return false;
+    command = slots[t & (COMMAND_QUEUE_SIZE-1)];
+    tail.store(t+1, std::memory_order_release);
+    return true;
+  }
+};
+
+/**
+ * snapshotBuffer
+ *
+ * A snapshot and a sequence number (a seqlock). The writer makes the
+ * number odd before it starts filling the snapshot and even again once it
+ * has finished. A reader copies the snapshot and checks the number again
+ * afterwards: if it was odd, or has changed at all, the writer was at work
+ * on it in the meantime, so the copy may be torn and it tries again. The
+ * writer never waits for readers.
+ */
+class snapshotBuffer
+{
+  private:
+  simSnapshot           buffer;
+  std::atomic<uint32_t> sequence{0};
+
+  public:
+  simSnapshot &begin(){
+    sequence.store(sequence.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return buffer;
+  }
+
+  void publish(){
+    sequence.store(sequence.load(std::memory_order_relaxed)+1, std::memory_order_release);
+  }
+
+  void read(simSnapshot &snap){
+    uint32_t before, after;
+    do{
+      before = sequence.load(std::memory_order_acquire);
+      if(before & 1)continue;
+      snap = buffer;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = sequence.load(std::memory_order_relaxed);
+      if(after==before)return;
+    }while(true);
+  }
+};
+
+/**
+ * simTask
+ *
+ * Owns the running of a pool of sim40s and their compilers once begin() is
+ * called. From then on, the rest of the program should only talk to them
+ * through send() and read(). Sessions are numbered from 0 to count-1.
+ */
+class simTask
+{
+  private:
+  sim40          *sims;
+  compiler       *comps;
+  int             count;
+  snapshotBuffer *snapshots;
+  unsigned long  *rates;            // Instructions per second, per SIM40
+  unsigned long  *rateMarks;        // instructionCount at the start of the period
+  bool           *paused;           // Per SIM40: see simSnapshot
+  std::atomic<uint32_t> *changes;   // Per SIM40, 32 words: written since readChanges()
+  unsigned long   rateStart = 0;
+  unsigned long   lastReport = 0;
+  int             first = 0;        // Which SIM40 goes first this round
+  commandQueue    commands;
+  std::atomic<bool> stopping{false};
+#ifdef ARDUINO
+  TaskHandle_t    handle = NULL;
+#else
+  std::thread     thread;
+#endif
+
+  static void entry(void *param){
+    ((simTask *)param)->taskLoop();
+#ifdef ARDUINO
+    vTaskDelete(NULL);
+#endif
+  }
+
+  void doCommand(simCommand &command){
+    if(command.session<0 || command.session>=count){
+      delete command.program;
+      return;
+    }
+    sim40    &sim = sims[command.session];
+    compiler &comp = comps[command.session];
+    int sv;
+    switch(command.type){
+      case CMD_COMPILE:
+        comp.program = *command.program;
+        delete command.program;
+        if((sv=comp.compile(sim.getStartVector()))!=-1){
+          // Compilation was successful
+          Serial.printf("Session %i compiled successfully\n", command.session);
+          sim.setStartVector(sv);
+          if(!sim.loadMem(comp.startLoc, comp.code, comp.endLoc)) Serial.println("Oops! Memory write failed");
+          comp.releaseCode();   // The sim40 has the only copy needed now
+        }
+        else Serial.printf("Session %i failed to compile\n", command.session);
+        sim.output.write(comp.output.c_str());
+        sim.setRunStatus(false);
+        paused[command.session] = false;
+        break;
+      case CMD_RUN:
+        sim.setRunStatus(sim.beginRun());
+        paused[command.session] = false;
+        break;
+      case CMD_HALT:
+        paused[command.session] = paused[command.session] || sim.getRunStatus();
+        sim.setRunStatus(false);
+        break;
+      case CMD_STEP:
+        if(sim.getRunStatus())sim.setRunStatus(false);
+        else if(!paused[command.session])sim.beginRun();
+        sv = sim.step();
+        paused[command.session] = sv==STOP_BUDGET || sv==STOP_WAITING;
+        break;
+      case CMD_RESET:
+        sim.setRunStatus(false);
+        paused[command.session] = false;
+        // Fall through
+      case CMD_CLEAR:
+        sim.output.clear();
+        break;
+      case CMD_KEY:
+        sim.keyPress(command.value);
+        break;
+      case CMD_SAVE:
+        // The code was released after it was loaded, so it is compiled
+        // again from the program kept with it
+        if(comp.program.length()==0 || comp.compile(sim.getStartVector())==-1){
+          Serial.printf("Session %i has no program to save\n", command.session);
+          break;
+        }
+#ifdef ARDUINO
+        saveBootProgram(comp);
+        Serial.printf("Session %i saved its program for the next boot\n", command.session);
+#endif
+        comp.releaseCode();
+        break;
+      default:
+        break;
+    }
+  }
+
+#ifdef ARDUINO
+  /**
+   * saveBootProgram
+   *
+   * Saves the program just compiled as an image and as source, so that
+   * setup() can load it next time without compiling it. Only done when a
+   * session asks, with CMD_SAVE, to spare the flash.
+   */
+  void saveBootProgram(compiler &comp){
+    size_t   size = comp.imageSize();
+    uint8_t *data = new uint8_t[size];
+    comp.writeImage(data);
+    File file = LittleFS.open(BOOT_IMAGE, "w");
+    if(!file || file.write(data, size)!=size)Serial.println("Oops! Couldn't save the boot image");
+    file.close();
+    delete[] data;
+    file = LittleFS.open(BOOT_SOURCE, "w");
+    if(file)file.print(comp.program);
+    file.close();
+  }
+#endif
+
+  /**
+   * publish
+   *
+   * Brings the session's snapshot up to date, copying only the words
+   * written since it was last published.
+   */
+  void publish(int session){
+    sim40       &sim = sims[session];
+    simSnapshot &snap = snapshots[session].begin();
+    uint32_t     dirty[32] = {0};
+    sim.takeDirty(dirty);
+    for(int w=0;w<32 && w*32<SNAPSHOT_MEM;w++){
+      uint32_t bits = dirty[w];
+      for(;bits;bits &= bits-1){
+        int address = w*32+__builtin_ctz(bits);
+        if(address<SNAPSHOT_MEM)snap.memory[address] = sim.peekMem(address);
+      }
+    }
+    snap.regs = sim.getRegisters();
+    snap.running = sim.getRunStatus();
+    snap.paused = paused[session];
+    snap.startVector = sim.getStartVector();
+    snap.instructionCount = sim.instructionCount;
+    snap.instructionsPerSecond = rates[session];
+    snap.outputCursor = sim.output.cursor();
+    snapshots[session].publish();
+    for(int w=0;w<32;w++)if(dirty[w])changes[session*32+w].fetch_or(dirty[w], std::memory_order_release);
+  }
+
+  /**
+   * measureRates
+   *
+   * Once every RATE_PERIOD, works out how many instructions a second each
+   * SIM40 ran over it, and every RATE_REPORT, lists those of the running
+   * ones on the serial port.
+   */
+  void measureRates(){
+    unsigned long now = millis();
+    if(now-rateStart<RATE_PERIOD)return;
+    for(int i=0;i<count;i++){
+      rates[i] = (sims[i].instructionCount-rateMarks[i])*1000/(now-rateStart);
+      rateMarks[i] = sims[i].instructionCount;
+    }
+    rateStart = now;
+    if(now-lastReport<RATE_REPORT)return;
+    lastReport = now;
+    for(int i=0;i<count;i++){
+      if(sims[i].getRunStatus())Serial.printf("Session %i: %lu instructions/s\n", i, rates[i]);
+    }
+  }
+
+  void taskLoop(){
+    simCommand command;
+    while(!stopping.load(std::memory_order_relaxed)){
+      while(commands.pop(command))doCommand(command);
+      // Characters arriving on the serial port go to SERIAL_IN of the
+      // first SIM40; there is only the one port
+      while(Serial.available())sims[0].serialIn(Serial.read());
+      int running = 0;
+      for(int i=0;i<count;i++)if(sims[i].getRunStatus())running++;
+      unsigned long slice = running>0 && SIM_TASK_SLICE/running>1 ? SIM_TASK_SLICE/running : 1;
+      for(int n=0;n<count;n++){
+        int i = (first+n)%count;
+        if(sims[i].getRunStatus() && sims[i].runUntil(millis() + slice)==STOP_BREAKPOINT){
+          Serial.printf("Session %i reached a breakpoint\n", i);
+          sims[i].setRunStatus(false);
+          paused[i] = true;
+        }
+      }
+      first = (first+1)%count;
+      measureRates();
+      for(int i=0;i<count;i++)publish(i);
+      // Let the idle task in, or the watchdog bites
+      delay(running>0 ? 1 : 10);
+    }
+  }
+
+  public:
+  simTask(sim40 *machines, compiler *compilers, int sessions) : sims(machines), comps(compilers), count(sessions) {
+    snapshots = new snapshotBuffer[count];
+    rates = new unsigned long[count]();
+    rateMarks = new unsigned long[count]();
+    paused = new bool[count]();
+    changes = new std::atomic<uint32_t>[count*32]();
+  }
+
+  ~simTask(){
+    end();
+    delete[] snapshots;
+    delete[] rates;
+    delete[] rateMarks;
+    delete[] paused;
+    delete[] changes;
+  }
+
+  /**
+   * begin
+   *
+   * Publishes a first snapshot of each SIM40 and starts the task.
+   */
+  void begin(){
+    for(int i=0;i<count;i++){
+      rateMarks[i] = sims[i].instructionCount;
+      publish(i);
+    }
+    rateStart = lastReport = millis();
+#ifdef ARDUINO
+    xTaskCreatePinnedToCore(entry, "sim40", SIM_TASK_STACK, this, 1, &handle, SIM_TASK_CORE);
+#else
+    thread = std::thread(entry, this);
+#endif
+  }
+
+  /**
+   * end
+   *
+   * Asks the task to finish, and on the host waits for it to do so.
+   */
+  void end(){
+    stopping.store(true);
+#ifndef ARDUINO
+    if(thread.joinable())thread.join();
+#endif
+  }
+
+  /**
+   * sessions
+   *
+   * How many SIM40s there are.
+   */
+  int sessions(){
+    return count;
+  }
+
+  /**
+   * send
+   *
+   * Queues a command for the SIM40 of command.session. Returns false if the
+   * queue is full, in which case the caller still owns command.program.
+   * @param  simCommand command
+   * @return bool       success
+   */
+  bool send(const simCommand &command){
+    return commands.push(command);
+  }
+
+  /**
+   * read
+   *
+   * Copies the latest snapshot of a SIM40's state.
+   * @param int         session
+   * @param simSnapshot snap  Where to put the copy
+   */
+  void read(int session, simSnapshot &snap){
+    snapshots[session].read(snap);
+  }
+
+  /**
+   * readChanges
+   *
+   * Adds a bit to map (32 words) for each word of a SIM40's memory written
+   * since the last call, and starts again with none. Call it before
+   * read(): the snapshot then has all those words in it, and maybe more
+   * written since, which will be marked next time.
+   * @param int       session
+   * @param uint32_t* map
+   */
+  void readChanges(int session, uint32_t *map){
+    for(int w=0;w<32;w++)map[w] |= changes[session*32+w].exchange(0, std::memory_order_acquire);
+  }
+
+  /**
+   * readOutput / outputText / output
+   * 
+   * A SIM40's output since a cursor, or all of it that is still held, or
+   * the buffer itself, to print from. See outputBuffer.
+   */
+  int readOutput(int session, uint32_t &since, char *dest, int max){
+    return sims[session].output.read(since, dest, max);
+  }
+
+  String outputText(int session){
+    return sims[session].output.text();
+  }
+
+  outputBuffer &output(int session){
+    return sims[session].output;
+  }
+};
\ No newline at end of file
@@ -0,0 +1,162 @@
+/**
+ * The web page, gzipped, for serving from flash
+ *
+ * Made by host/make-assets from the files in web; don't edit it, but
+ * change those and run make-assets again. See webserver.h.
+ */
+
+#ifndef CECIL_WEBASSETS_H
+#define CECIL_WEBASSETS_H
+
+/* index.html: 6031 bytes, 2250 gzipped */
+const uint8_t webAsset0[] PROGMEM = {
+  0x1f,0x8b,0x08,0x00,0x00,0x00,0x00,0x00,0x02,0x03,0x9d,0x58,0x69,0x73,0xdb,0x38,
+  0x12,0xfd,0xee,0x5f,0x81,0xb0,0x66,0x33,0x52,0x59,0x97,0xe3,0x4c,0x6d,0xca,0x3a,
+  0x52,0x89,0xe2,0x54,0xbc,0x93,0xab,0x22,0xcf,0xd6,0x66,0x33,0xa9,0x2d,0x98,0x84,
+  0x44,0xac,0x29,0x80,0x45,0x80,0x56,0x34,0x99,0xfc,0xf7,0x7d,0x0d,0xf0,0x14,0x95,
+  0x63,0xd6,0x1f,0x2c,0x02,0x68,0xbc,0x6e,0xf4,0x0d,0xcc,0xee,0x3d,0x7b,0xb3,0xbc,
+  0x7e,0xff,0xf6,0x92,0xc5,0x76,0x9b,0x2c,0x4e,0x66,0xf7,0x86,0xc3,0x13,0xc6,0xae,
+  0x63,0xc1,0x96,0x97,0xcb,0xab,0x97,0x2c,0xe5,0x1b,0x31,0x62,0x57,0x96,0x29,0x71,
+  0x27,0x32,0x16,0xc6,0x5c,0x6d,0x84,0x19,0x30,0xa3,0x99,0xb4,0x4c,0x1a,0x76,0x2b,
+  0x52,0xfc,0x2a,0x66,0xb1,0xe5,0x72,0xf5,0xf6,0xfc,0xc1,0xcf,0x86,0xad,0x13,0x6e,
+  0x62,0xc0,0x6c,0xfe,0x90,0x69,0x2a,0x22,0xd6,0x33,0x42,0xb0,0x50,0x84,0x32,0x19,
+  0xef,0xc4,0x0d,0x37,0x46,0x58,0x33,0x8a,0x07,0x6c,0xcb,0x23,0xc1,0xd6,0x99,0xde,
+  0x62,0x37,0xa0,0x6e,0xf6,0x2c,0xd6,0xc6,0x8e,0xb7,0xfc,0x56,0x0c,0x3d,0x55,0x9f,
+  0x71,0x15,0x01,0xe9,0x26,0xd3,0x3b,0x23,0x32,0x83,0x2d,0x7b,0x16,0xf2,0x10,0xcc,
+  0xa4,0x9d,0xb2,0x5d,0xcc,0xad,0xe3,0xbc,0xba,0x7a,0xf5,0x70,0x42,0xe2,0x44,0x5a,
+  0xaa,0x0d,0x7d,0xa4,0xb9,0x89,0xc1,0xda,0x3a,0x39,0xb9,0xc1,0x7f,0xc0,0x14,0xe2,
+  0x33,0x4d,0x67,0x19,0xf3,0x54,0x8e,0x71,0x2a,0x65,0x71,0x1e,0x9d,0x01,0x4c,0x64,
+  0x02,0x68,0x80,0x0c,0xb9,0xfa,0xd9,0xb2,0x1b,0xc1,0x62,0x1e,0x0d,0xd8,0x5a,0xd8,
+  0x90,0xb0,0x48,0x52,0x80,0xb8,0x7d,0xc6,0x72,0x2b,0x06,0xd8,0x23,0xc3,0x98,0xf1,
+  0xb5,0x05,0x1e,0xc9,0xb1,0x96,0x99,0x81,0x44,0x72,0x2b,0x98,0x56,0xc9,0x9e,0x19,
+  0xa1,0x22,0xe3,0xc5,0x8c,0x21,0x84,0xe7,0x1f,0x8d,0x4e,0x86,0x43,0xe8,0x9a,0x54,
+  0xce,0x12,0xcc,0xcc,0x03,0xa1,0x82,0x05,0xa0,0x67,0xb1,0xe0,0x11,0x7d,0xe0,0x73,
+  0x2b,0x2c,0xa7,0x0d,0x19,0xf4,0x30,0x0f,0x7e,0xbb,0x7e,0x3e,0x7c,0x14,0x34,0x97,
+  0x14,0xdf,0x8a,0x79,0x70,0x27,0xc5,0x2e,0xd5,0x99,0x0d,0x58,0xa8,0x95,0xc5,0x59,
+  0xe6,0xc1,0x4e,0x46,0x36,0x9e,0x47,0xe2,0x4e,0x86,0x62,0xe8,0x06,0x03,0x18,0x48,
+  0x5a,0xc9,0x93,0xa1,0x09,0x79,0x22,0xe6,0x67,0xa3,0x49,0x09,0x65,0xa5,0x4d,0xc4,
+  0x62,0x49,0xb6,0x99,0x8d,0xfd,0xc0,0x2f,0x18,0xbb,0xc7,0xf7,0x8d,0x8e,0xf6,0x9f,
+  0xd7,0x40,0x1e,0xae,0xf9,0x56,0x26,0xfb,0x0b,0xf6,0x24,0x03,0xce,0x80,0xbd,0x10,
+  0xc9,0x9d,0xb0,0x32,0xe4,0x70,0x05,0xae,0xcc,0x10,0xc6,0x91,0xeb,0x29,0xbb,0xe1,
+  0xe1,0xed,0x26,0xd3,0xb9,0x8a,0x86,0xa1,0x4e,0x74,0x76,0xc1,0xc2,0x3d,0x57,0xd3,
+  0x2f,0xb3,0xb1,0xc7,0xa3,0x33,0x8e,0xcb,0x43,0xce,0x08,0xbd,0x60,0x17,0x9f,0x2d,
+  0x9c,0xc3,0x61,0xf5,0xac,0x98,0x4a,0x17,0xcb,0x3c,0xcb,0x70,0x24,0x46,0xca,0xce,
+  0x61,0xb5,0xb5,0xb7,0xf3,0x05,0x49,0x97,0x69,0xb2,0x73,0x34,0x0f,0xfc,0x62,0xb0,
+  0xc8,0xd5,0xad,0xd2,0x3b,0x45,0x9c,0x68,0x6d,0x31,0x1b,0xa7,0xe5,0x51,0x44,0x68,
+  0xa5,0x56,0x7e,0x44,0xbc,0x1e,0x2c,0xde,0x66,0x7a,0x93,0xf1,0x2d,0xb8,0x3d,0xa8,
+  0xa6,0xd7,0x3a,0xdb,0x3a,0xc4,0x50,0x6f,0x53,0x99,0x88,0xa0,0x5c,0x21,0x59,0x32,
+  0xb1,0x98,0x59,0xf1,0xc9,0xf2,0x4c,0x94,0xaa,0x4f,0x3d,0x46,0xe0,0xf6,0x54,0x03,
+  0x72,0xd4,0x79,0x70,0xf6,0x0b,0x19,0x24,0xc1,0xd7,0x43,0x58,0x0d,0x9a,0x2d,0xb6,
+  0x92,0x54,0x99,0x68,0x00,0x4b,0x95,0xe6,0x70,0x98,0x7d,0x0a,0x40,0x93,0xdf,0x6c,
+  0x25,0x2c,0x79,0xc7,0x93,0x1c,0xc3,0x65,0x57,0x8c,0x9b,0xdc,0x5a,0xad,0x0a,0x72,
+  0x3f,0xf0,0xec,0x0d,0xbf,0x03,0xe1,0x0a,0xff,0x19,0x8e,0x81,0x60,0xfd,0x04,0xf7,
+  0xd5,0xda,0xce,0xc6,0x9e,0xaa,0x3a,0xe4,0x98,0x4e,0x59,0xe8,0x65,0xdc,0x52,0xcc,
+  0x31,0x35,0xbd,0x12,0x5b,0x9d,0xed,0x5b,0x5a,0x8a,0xcf,0x17,0xaf,0x38,0xe2,0x1d,
+  0x96,0x60,0xdb,0x72,0xf9,0xbc,0x5a,0x6e,0x2b,0x8a,0x44,0xf3,0x44,0xa5,0x62,0x9a,
+  0x7a,0x61,0x20,0x89,0x28,0x4c,0xbe,0xaa,0x20,0xe2,0xf6,0x4e,0x6c,0xa4,0x41,0x7c,
+  0x99,0xef,0xf0,0xc9,0x4a,0xba,0x92,0xd5,0xa3,0xbf,0xc6,0xaa,0xd0,0xad,0x83,0xca,
+  0xd5,0x0b,0x9e,0xd8,0x60,0xf1,0x2e,0x57,0x1d,0x0d,0x36,0xe8,0xc0,0x2e,0x85,0xd6,
+  0xf1,0xbf,0x43,0x05,0x8d,0xfd,0x53,0x46,0x42,0xb3,0x37,0xb9,0x85,0x85,0x5b,0x2a,
+  0xec,0xca,0xae,0x1d,0xd1,0x51,0xe7,0xf9,0x6b,0x92,0x87,0x89,0xe0,0x59,0xb0,0x58,
+  0xd2,0x4f,0x5b,0xa6,0x8e,0xb5,0xc3,0x4c,0xa6,0xb6,0xc4,0xb8,0xe3,0x19,0xc3,0xa9,
+  0x15,0x25,0xcf,0x39,0x5b,0xf3,0xc4,0x20,0xb9,0x25,0x1a,0xf9,0x39,0xaa,0xc7,0x94,
+  0xd6,0x32,0x0c,0x55,0x9e,0x20,0x03,0xf8,0xcc,0x59,0x0c,0xa7,0x0d,0x1c,0x6f,0x70,
+  0x2c,0x7c,0xf8,0x08,0xaa,0x54,0x23,0x41,0xce,0xd9,0x64,0xca,0xba,0x7f,0xe3,0x31,
+  0x7b,0x92,0x24,0x14,0xd7,0x7e,0xcf,0x80,0x12,0x35,0x46,0x6e,0x53,0x03,0xd1,0xab,
+  0x07,0x28,0x41,0x30,0x28,0x06,0x2b,0x28,0x82,0x66,0x26,0xe5,0xc4,0xa5,0x8a,0x0a,
+  0x36,0x40,0xa5,0xfa,0x55,0x6c,0x8a,0x45,0x82,0x14,0x8e,0x2a,0x52,0xe4,0x77,0xe9,
+  0xd2,0x49,0x06,0xc9,0x69,0x8e,0xd2,0x73,0xc1,0x68,0x9d,0x2b,0xa7,0x1f,0xf6,0x53,
+  0x4f,0x46,0xfd,0xcf,0xd0,0xbb,0xcd,0x33,0x85,0x82,0x12,0xe6,0x5b,0x9c,0x74,0xb4,
+  0x11,0xf6,0x32,0x11,0xf4,0xf9,0x74,0x7f,0x15,0x11,0xcd,0x94,0x7d,0x39,0xdc,0x9b,
+  0xf2,0xa8,0xa7,0xea,0xcd,0xbd,0x60,0x32,0x99,0x04,0xec,0x94,0xa9,0xfe,0xc8,0x24,
+  0xc8,0xc7,0xbd,0xe1,0x43,0xb7,0xed,0xa4,0x52,0xc0,0xd3,0x0c,0x3a,0x37,0xa5,0xd2,
+  0x48,0xa6,0x42,0xf0,0x3c,0xa5,0xe2,0x15,0xa1,0xcc,0xb0,0x9d,0xb4,0x71,0x5d,0xeb,
+  0x5c,0xe9,0x41,0xd6,0xdd,0x9b,0x66,0x4d,0x39,0x94,0x24,0x4f,0x69,0x6b,0xcf,0x11,
+  0xf7,0x3f,0x57,0x29,0x44,0xae,0xfd,0xd4,0xc8,0x33,0xec,0x57,0xc6,0x6a,0xce,0x4e,
+  0x2b,0x72,0x01,0xc3,0x53,0x46,0xe9,0x91,0x19,0xa4,0x57,0xb0,0x64,0xb3,0x82,0xba,
+  0x28,0xa7,0xa3,0x44,0xa8,0x8d,0x8d,0x69,0xe5,0x74,0xce,0x1e,0x14,0x98,0x1f,0x5a,
+  0x34,0x1f,0xe4,0xc7,0x8f,0x15,0x97,0x6a,0x0e,0x9a,0x39,0xfb,0xd8,0xe0,0x56,0x38,
+  0x8b,0xa7,0x72,0xa3,0x69,0x57,0x72,0xaf,0x9f,0xe7,0xd4,0x36,0xcc,0xe7,0xb5,0xf5,
+  0x1b,0x87,0x64,0xa5,0x0e,0x4f,0x4b,0x2c,0x3f,0x9e,0x36,0x28,0x0e,0xe0,0xbc,0x3f,
+  0x2d,0x9a,0xde,0xd5,0x02,0x64,0xb5,0x13,0xfa,0x8f,0xc2,0x9e,0xaf,0xb8,0x8d,0x47,
+  0x5b,0xa9,0x8e,0x80,0x0d,0x9b,0x60,0xa5,0x9b,0x16,0xba,0xea,0xf7,0xa7,0x47,0xc0,
+  0x4b,0xa7,0xee,0x60,0x35,0x89,0xbf,0x9c,0x74,0xbf,0xc8,0x4c,0x47,0x8e,0xff,0xf5,
+  0xd3,0x7f,0x9d,0x1f,0xe9,0x75,0x7a,0x84,0x45,0x33,0xca,0x3a,0x76,0x38,0x6d,0x4d,
+  0x95,0xfe,0x70,0x52,0x62,0x1c,0xfa,0xa6,0x89,0xf5,0xae,0xe3,0x99,0x75,0xfa,0xf1,
+  0x58,0xc5,0xb8,0x96,0xe5,0xa7,0x5e,0x59,0xeb,0xfb,0x23,0xca,0x84,0x4b,0xdf,0xf0,
+  0x60,0x43,0xb9,0xf5,0x31,0x0b,0x8a,0xcf,0x80,0x5d,0x14,0x30,0x29,0xcf,0x0d,0x92,
+  0x18,0x96,0xfc,0x17,0xad,0x04,0x31,0xb2,0x3b,0x3e,0x5b,0xd8,0x65,0xd2,0xff,0x06,
+  0xb8,0x5b,0xa7,0xfd,0xa8,0x0b,0x41,0xcb,0x33,0xef,0x15,0xb9,0xf2,0xfe,0xfd,0x92,
+  0xad,0xef,0x07,0xd8,0x3d,0x9f,0x1f,0x5b,0xbe,0x04,0x66,0x65,0xbb,0xd0,0x1f,0xb9,
+  0x62,0x5f,0x1d,0xba,0x98,0x6f,0x9a,0xaa,0xca,0xc2,0x36,0xcb,0xc5,0x31,0xcb,0xb4,
+  0x22,0xbd,0x26,0x28,0x52,0xb1,0xcb,0x9a,0xf5,0xec,0x91,0x58,0xf6,0xe1,0x5a,0x07,
+  0xf1,0xe9,0x29,0x45,0x30,0xc5,0x4e,0xc0,0x28,0x77,0x51,0x4e,0x2b,0x42,0x5a,0x7e,
+  0xec,0x63,0xa2,0x27,0xd9,0xdf,0xd8,0x23,0x0a,0xbe,0xbf,0x93,0x56,0x7e,0x57,0x4e,
+  0x27,0x41,0xbf,0xa5,0xce,0xa2,0xec,0xd7,0x07,0xc4,0x44,0x5b,0xb8,0xac,0x36,0x75,
+  0x59,0xba,0xdb,0x06,0xa9,0x0a,0x7a,0x0d,0x12,0x3c,0x09,0x91,0x8e,0xf3,0x84,0x5b,
+  0xea,0x2d,0x59,0x25,0x5f,0x36,0xe2,0x61,0x48,0xb2,0x41,0x9a,0x7f,0xb1,0xb2,0x65,
+  0x20,0x8a,0x06,0xc9,0x27,0x10,0x34,0x14,0x0b,0xd2,0xf7,0x5f,0x23,0xdd,0x17,0x58,
+  0xd4,0x27,0xb2,0x25,0xfa,0x59,0x4f,0x52,0x13,0xa4,0x25,0xb7,0x7f,0x8b,0x4c,0xb3,
+  0xe7,0x09,0xdf,0x5c,0xb0,0x36,0xc4,0x1f,0x58,0xe8,0x30,0x7c,0x2d,0x36,0xdc,0x4a,
+  0x74,0x69,0x7e,0x47,0x4d,0xad,0x8a,0x85,0x02,0x75,0xc9,0x33,0x64,0xe5,0x0a,0xb6,
+  0xa6,0x0b,0x69,0xa1,0x0d,0x5b,0xa4,0x1e,0x93,0x0a,0x72,0x13,0xef,0x6f,0x64,0x17,
+  0x67,0x95,0xdf,0xd5,0x8a,0xe6,0x3d,0xab,0x26,0x21,0xd8,0xe0,0x56,0x80,0x5e,0x39,
+  0x77,0x31,0x69,0xc6,0xe6,0xc0,0x80,0x45,0x4f,0x52,0xeb,0xfe,0x30,0x8b,0x34,0x69,
+  0xd0,0x4d,0xe8,0x24,0xb9,0xd6,0x29,0xe8,0xba,0xf3,0x2f,0x84,0xdc,0xc4,0xb6,0x93,
+  0x0f,0x50,0xfd,0xae,0x0c,0x5d,0x91,0x6c,0xe7,0x86,0xe4,0x6f,0x6c,0x98,0xc1,0xfd,
+  0x51,0x19,0x38,0xe5,0xba,0x28,0x7d,0xe8,0x7e,0xb6,0xed,0xeb,0x59,0x0d,0x96,0x82,
+  0x95,0x71,0xfd,0x2f,0x5d,0x4d,0x71,0x36,0x74,0x4e,0x87,0xa9,0x27,0x21,0x6b,0xab,
+  0x5e,0xbb,0x22,0xde,0xdb,0x49,0x15,0xe9,0xdd,0xe8,0x92,0x5a,0x9a,0x95,0xce,0xb3,
+  0x10,0x89,0xc9,0x05,0x5e,0x0f,0xd5,0xda,0xd7,0xf2,0x69,0x33,0xdd,0x56,0xad,0x8f,
+  0xd8,0xb1,0xc6,0xa6,0x5e,0xd0,0xb8,0x53,0x36,0xd5,0xe9,0x67,0x46,0x3c,0x8a,0x1c,
+  0xf5,0x4b,0x27,0x84,0xc8,0x7c,0x42,0x13,0x68,0x6a,0x4a,0xf9,0x7a,0x8e,0x12,0xcc,
+  0x5d,0x8a,0xfc,0xc7,0xea,0xcd,0x6b,0x24,0x30,0xdc,0x00,0xfd,0xfc,0x08,0x81,0xce,
+  0xfb,0xd4,0x40,0xfc,0x08,0x76,0x91,0xe4,0xba,0xe0,0xed,0x54,0x74,0x34,0xa7,0xba,
+  0xe0,0x87,0x49,0x4a,0xc7,0x3b,0x2e,0x09,0x45,0x41,0x23,0x23,0x75,0x85,0xd2,0x10,
+  0x24,0xd3,0x14,0xe8,0x95,0x0c,0x2d,0xf6,0xd0,0x7d,0x41,0x49,0x5d,0xee,0x7e,0xe5,
+  0x3a,0x1b,0xa4,0xcc,0x86,0x4e,0x47,0xcb,0x97,0x6f,0x56,0x97,0xcf,0xfa,0xa5,0x15,
+  0xbc,0xdb,0xc0,0x63,0x24,0xbc,0xdc,0x52,0xcb,0xb4,0xa1,0xeb,0xc8,0xcd,0x1e,0x46,
+  0x37,0x22,0x59,0x37,0xd0,0x8f,0x76,0xa8,0x65,0x4a,0xed,0x35,0x25,0x3f,0xe6,0x9a,
+  0xcf,0xdd,0xad,0xbf,0x7b,0x79,0xf7,0xcd,0xe4,0xad,0x10,0x69,0xf9,0xda,0x60,0x34,
+  0xbd,0x03,0x24,0xa2,0xf1,0x12,0x81,0xa2,0xd1,0xe9,0x2b,0x3d,0xd7,0xfa,0xf8,0xae,
+  0x57,0xbf,0x46,0x4f,0x8d,0x68,0xe9,0xb9,0xde,0xba,0x21,0x92,0x7b,0x73,0x28,0xfc,
+  0xc9,0x39,0xc9,0x63,0x23,0x55,0x88,0x5b,0x1f,0x0c,0xe2,0xdb,0x24,0x04,0xf0,0x7d,
+  0x1f,0x67,0x6e,0xb2,0xee,0x83,0x46,0x10,0x43,0xf5,0x2a,0x85,0x67,0x22,0x4d,0xf6,
+  0x75,0x4b,0xea,0x86,0xa3,0xff,0x1a,0x32,0x05,0x39,0xd2,0x01,0xf5,0x61,0x55,0x66,
+  0xcd,0x62,0x7d,0xd0,0x3f,0x15,0x95,0xb1,0x5f,0xde,0x0b,0x8c,0xb0,0xe5,0x71,0xe8,
+  0xac,0x03,0xf6,0xcb,0x64,0xd2,0xf2,0x0f,0x64,0x2f,0x3a,0x55,0xc3,0x17,0xd8,0xb7,
+  0xf6,0x4e,0x5a,0x9e,0xde,0xb4,0x0d,0xae,0xc6,0x5b,0x4e,0x2f,0x2b,0xb8,0x0d,0xb1,
+  0xb7,0x6f,0x56,0xd7,0x22,0x9a,0x36,0x7a,0x63,0x69,0xaa,0x37,0x1b,0xef,0x1d,0x1a,
+  0xaa,0xa3,0xf5,0x3d,0x0c,0x89,0xe4,0x7b,0x23,0x84,0xaa,0xc1,0x78,0x88,0x30,0x01,
+  0xc9,0x80,0xe5,0x2a,0x11,0xc6,0x14,0x0f,0x5b,0x74,0xa3,0x82,0xf7,0xec,0x38,0x75,
+  0xe5,0x7b,0xfc,0x1c,0xda,0x33,0xf4,0x42,0xf4,0x52,0x4e,0x2f,0x2c,0x3a,0x75,0x69,
+  0xb4,0xa1,0x3a,0x6f,0xc2,0xf6,0xea,0x81,0xb6,0xa1,0x00,0x4a,0x3f,0xde,0x51,0xfb,
+  0x1d,0x1d,0x9c,0x7f,0x4d,0x05,0x08,0xdb,0xf2,0x91,0xa2,0x8f,0x20,0xf3,0x0f,0x07,
+  0xcd,0x28,0x3b,0x8c,0x74,0x1f,0xb4,0xb8,0x34,0xd2,0xef,0x33,0xb1,0xe6,0x79,0x62,
+  0x9b,0x11,0x50,0x9e,0x25,0x18,0x97,0xb8,0x03,0xf6,0x79,0x2b,0x6c,0xac,0xa9,0x74,
+  0x90,0x86,0x31,0x41,0xcf,0x35,0x17,0x2e,0xe7,0xfd,0xf6,0xee,0xe5,0x0a,0xce,0x1b,
+  0xc6,0x6f,0x39,0xba,0x15,0xd3,0xfb,0x5c,0xf4,0x2d,0x17,0x47,0x7a,0x9b,0x2f,0xfd,
+  0xc6,0x01,0xa6,0x27,0x47,0xfa,0x2d,0x58,0x07,0xbd,0xf4,0x6d,0x3b,0x4b,0x54,0x22,
+  0x35,0xfa,0x2f,0x17,0x0d,0x71,0xd9,0x84,0xb9,0x11,0x56,0xbb,0xa2,0x7e,0x21,0xad,
+  0x35,0x58,0xb9,0x7b,0xfa,0xf7,0xf8,0x94,0xb1,0x06,0xd2,0xef,0x03,0xd2,0x73,0xcb,
+  0x0f,0x02,0x12,0xe9,0x77,0x01,0xfd,0xbd,0xfd,0xc7,0x10,0x3d,0xed,0xb7,0x21,0xe1,
+  0xd6,0xbf,0x0a,0x5c,0x10,0xe9,0xa5,0x28,0xf2,0xf7,0x47,0x5b,0xdf,0x89,0x91,0x27,
+  0x85,0x73,0xfa,0x8d,0xa6,0x3b,0x26,0xad,0x14,0x46,0x1b,0x50,0xd2,0xff,0xf5,0xf2,
+  0xfd,0xd3,0xff,0x5c,0xbd,0x3e,0xe9,0x96,0x79,0xad,0x6e,0xc5,0x1e,0x95,0x52,0x7d,
+  0xcb,0xd7,0xa8,0xb7,0x0b,0x75,0x44,0x2d,0x83,0x77,0x3b,0xec,0x29,0xba,0x4b,0x6a,
+  0x4f,0xce,0x60,0xc9,0x7a,0x9e,0x1e,0x38,0x97,0x20,0x7e,0x62,0x7b,0x93,0x3e,0xac,
+  0x5a,0xad,0x10,0x69,0x70,0x49,0x7d,0x57,0x80,0x0d,0x67,0xe7,0x58,0x9b,0xb4,0x5b,
+  0x6e,0xc7,0xe3,0xcf,0x3f,0x3d,0xaf,0x05,0x3b,0x9b,0x3c,0x38,0xa7,0xa1,0x47,0x08,
+  0x6d,0x96,0x40,0x03,0xf5,0x04,0xbd,0x99,0x62,0xa2,0xac,0x23,0xff,0x47,0x64,0x90,
+  0xee,0x21,0xd8,0x63,0xe2,0xe7,0x52,0x2e,0x7d,0x1c,0x33,0xc3,0xa1,0xb3,0x97,0x3d,
+  0xc7,0xb4,0x7c,0x88,0xa9,0x9e,0x5e,0x66,0x63,0xff,0x04,0x3a,0x1b,0xfb,0xe7,0xf7,
+  0xff,0x01,0x71,0x84,0x00,0x6a,0x8f,0x17,0x00,0x00
+};
+
+const webAsset webAssets[] = {
+  {"/", "text/html; charset=utf-8", "\"9838ae0ab8245bba\"", webAsset0, 2250},
+};
+
+#define WEB_ASSETS 1
+
+#endif
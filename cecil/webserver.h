@@ -8,102 +8,297 @@
  * @param   WiFiClient  client  The incoming WiFi client
  */
 
+#include "httpwriter.h"
+#include "httprequest.h"
+
+/* A file of the web page, kept gzipped in flash */
+typedef struct{
+  const char    *path;
+  const char    *type;
+  const char    *etag;        // In quotes, as the ETag header has it
+  const uint8_t *data;
+  long           size;
+} webAsset;
+
+#include "webassets.h"
+
 String  progUpdate = "";
+uint32_t webKey;        // The key code sent to /api/key
 //bool    trace = true;
 String  webCmd;
+String  webPath;        // The path asked for by the last request, without any query
+String  webQuery;       // and the query after it, for /api/ requests only
+String  webCookie;      // The Cookie: header of the last request, if any
+String  webIfNoneMatch; // Its If-None-Match: header: the ETags of copies the browser has
+String  setCookie;      // Sent as a Set-Cookie: header with the reply, if set
+bool    webPost;        // The last request was a POST, from the page's script
+const char *webError;   // The status to answer it with if it couldn't be read, else NULL
 
-void tidyProgram(String program){
-  int ptr;
-  // Cut the front of the GET line
-  ptr = program.indexOf("?program=") + 9;
-  progUpdate = program.substring(ptr, program.length()); //program.indexOf(terminator);
-  // Now replace "+" chars with tabs
-  progUpdate.replace("+", " "); 
-  progUpdate.replace("%0D%0A", "\n"); 
-  progUpdate.replace("%3B", ";");
-  progUpdate = progUpdate.substring(0,progUpdate.indexOf("HTTP/"));
-  //Serial.println(progUpdate);
-  return;
+/* What the page is told of a SIM40; see sendState() */
+typedef struct{
+  const uint16_t *memory;       // A copy of memory from address 0
+  int             memoryWords;
+  registers       regs;
+  long            speed;        // Instructions per second, or -1 if not known
+  outputBuffer   *output;       // Its video output
+  bool            running;
+  uint32_t        epoch;        // Of the memory changes the session knows of
+  const uint32_t *changed;      // Words changed since the epoch asked for, a bit
+                                // each; NULL to send all of them
+  bool            paused;       // Halted part way through; a step carries on
+} simView;
+
+/**
+ * queryValue()
+ * 
+ * A number given in the query of an /api/ request, as in ?since=12.
+ * @return bool  whether there was one
+ */
+bool queryValue(const char *name, uint32_t &value){
+  int at = 0, length = strlen(name);
+  while((at = webQuery.indexOf(name, at))>=0){
+    if((at==0 || webQuery[at-1]=='&') && webQuery[at+length]=='='){
+      value = strtoul(webQuery.c_str()+at+length+1, NULL, 10);
+      return true;
+    }
+    at += length;
+  }
+  return false;
+}
+
+/**
+ * sendHeaders()
+ * 
+ * Starts any reply: the status line and the headers every one has. More
+ * may follow before out.endHeaders().
+ * @param long length  of the body, or CHUNKED or NO_BODY; see httpWriter
+ */
+void sendHeaders(httpWriter &out, const char *status, const char *type, long length = CHUNKED){
+  out.begin(status, type, length);
+  if(strncmp(status, "405", 3)==0)out.header("Allow", "GET, POST");
+  if(setCookie.length()>0)out.header("Set-Cookie", setCookie);
 }
 
 /**
  * sendHead()
  * 
- * Sends the HTTP headers and initial HTML that applies for any page we might 
- * wish to return to the requester.
+ * Sends the HTTP headers and initial HTML for a page made up as it goes.
  */
-void sendHead(WiFiClient client, bool simStatus, bool redirect){
+void sendHead(httpWriter &out, const char *status, bool redirect){
   // HTTP headers always start with a response code (e.g. HTTP/1.1 200 OK)
   // and a content-type so the client knows what's coming, then a blank line:
-  client.println("HTTP/1.1 200 OK");
-  client.println("Content-type:text/html");
-  client.println();
+  sendHeaders(out, status, "text/html");
+  out.endHeaders();
   
   // Now send the initial HTML
-  client.println("<!DOCTYPE html>");
-  client.println("<html lang=\"en\">");
-  client.println("  <head>");
-  client.println("    <meta charset=\"UTF-8\">");
-  client.println("    <meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">");
-  if(redirect) client.println("    <meta http-equiv=\"refresh\" content=\"3; url='/'\">");
-  String line = "    <title>";
-  line = line + PROG + "</title>";
-  client.println(line);
-  client.println("    <style>body{font-family: Arial, Helvetica, sans-serif; background-color: cyan;}</style>");
-  client.println("  </head>");
-  client.println("  <body>");
-  client.println("    <h1>CECIL</h1>");
+  out.println("<!DOCTYPE html>");
+  out.println("<html lang=\"en\">");
+  out.println("  <head>");
+  out.println("    <meta charset=\"UTF-8\">");
+  out.println("    <meta name=\"viewport\" content=\"width=device-width, initial-scale=1.0\">");
+  if(redirect) out.println("    <meta http-equiv=\"refresh\" content=\"3; url='/'\">");
+  out.println("    <title>" PROG "</title>");
+  out.println("    <style>body{font-family: Arial, Helvetica, sans-serif; background-color: cyan;}</style>");
+  out.println("  </head>");
+  out.println("  <body>");
+  out.println("    <h1>CECIL</h1>");
   return;
 }
 
 /**
- * sendBody()
+ * findAsset()
  * 
- * Sends the HTML for the default CECIL page 
+ * The file of the web page at a path, if there is one.
+ * @return const webAsset*  or NULL
  */
-void sendBody(WiFiClient client, String program, String memory, String registers, String videoOutput, bool simStatus)
-{
-  client.print("    <p>Current status of SIM40: <strong>");
-  if(simStatus)client.print("running");
-  else client.print("halted");
-  client.println("</strong></p>");
-  client.println("    <section>");
-  client.println("      <h2>Program</h2>");
-  client.println("      <form action=\"compile\" method=\"get\">");
-  client.println("        <pre><textarea name=\"program\" rows=\"15\" cols=\"48\">");
-  client.println(program);
-  client.println("        </textarea></pre>");
-  client.println("        <input type=\"submit\" value=\"Compile\">");
-  client.println("      </form>");
-  client.println("    </section>");
-  client.println("    <section>");
-  client.println("      <h2>Memory</h2>");
-  client.println("      <h3>Main SIM memory</h3>");
-  client.println("      <pre><textarea name=\"code\" rows=\"5\" cols=\"48\">");
-  client.println(memory);
-  client.println("      </textarea></pre>");
-  client.println("      <h3>Registers</h3>");
-  client.println("      <pre><textarea name=\"code\" rows=\"8\" cols=\"48\">");
-  client.println(registers);
-  client.println("      </textarea></pre>");
-  if(simStatus){
-    client.println("      <form action=\"halt\" method=\"get\">");
-    client.println("        <input type=\"submit\" value=\"Halt\">");
+const webAsset *findAsset(const String &path){
+  for(int i=0;i<WEB_ASSETS;i++)if(path==webAssets[i].path)return &webAssets[i];
+  return NULL;
+}
+
+/**
+ * sendAsset()
+ * 
+ * Sends a file of the web page as it is kept, gzipped, straight from
+ * flash. Browsers may keep it but must check it is still current (no-cache)
+ * and, when the ETag they have matches, are just told so.
+ */
+void sendAsset(httpWriter &out, const webAsset &asset){
+  bool current = webIfNoneMatch.indexOf(asset.etag)>=0;
+  if(current)sendHeaders(out, "304 Not Modified", NULL, NO_BODY);
+  else{
+    sendHeaders(out, "200 OK", asset.type, asset.size);
+    out.header("Content-Encoding", "gzip");
+  }
+  out.header("ETag", asset.etag);
+  out.header("Cache-Control", "no-cache");
+  out.endHeaders();
+  if(!current)out.write(asset.data, asset.size);
+}
+
+/* The output a state reply carries: what was written since the cursor
+ * the browser has (from ?output=, or kept by its event stream), or all
+ * that is held if there isn't one or it has been lost. It is copied out of
+ * the ring in one go, so that where it starts is known for certain even
+ * if the SIM40 is busy writing */
+typedef struct{
+  uint32_t start;               // The oldest output held
+  uint32_t from;                // Where text starts
+  int      length;
+  char     text[OUTPUT_BUFFER];
+} outputPart;
+
+void readOutputPart(outputBuffer &output, outputPart &part, const uint32_t *since){
+  part.start = output.oldest();
+  part.from = since ? *since : part.start;
+  if((int32_t)(part.from-output.cursor())>0)part.from = part.start;
+  part.length = output.read(part.from, part.text, OUTPUT_BUFFER);
+  part.from -= part.length;
+}
+
+/**
+ * printState()
+ * 
+ * The SIM40's state, for the page to show, as JSON on one line:
+ *   {"epoch":7, "running":true, "paused":false, "speed":123, "registers":{"acc":0,...},
+ *    "memory":[...] or "changes":[address,value,...],
+ *    "outputStart":0, "outputFrom":0, "output":"..."}
+ * speed is null when it isn't known. With ?since=<epoch> from an earlier
+ * reply, memory is just the words changed since, as address, value
+ * pairs, if that epoch is still remembered; otherwise all of it, with the
+ * program. With ?output=<cursor>, which is outputFrom plus the length of
+ * the output in the earlier reply, output is just what has been written
+ * since. Output older than outputStart has gone, cleared or overwritten.
+ * paused is set when the program was halted part way through, so that a
+ * step carries on from there rather than starting again.
+ */
+void printState(Print &out, const String &program, const simView &sim, const outputPart &part){
+  jsonText text(out);
+  out.printf("{\"epoch\":%lu,\"running\":%s,\"paused\":%s,\"speed\":", (unsigned long)sim.epoch,
+    sim.running ? "true" : "false", sim.paused ? "true" : "false");
+  if(sim.speed>=0)out.printf("%ld", sim.speed);
+  else out.print("null");
+  out.printf(",\"registers\":{\"acc\":%d,\"x\":%d,\"y\":%d,\"pc\":%d,\"zero\":%d,\"negative\":%d,\"carry\":%d}",
+    sim.regs.acc, sim.regs.xReg, sim.regs.yReg, sim.regs.progCounter, sim.regs.zeroFlag, sim.regs.negFlag, sim.regs.carryFlag);
+  if(sim.changed){
+    const char *comma = "";
+    out.print(",\"changes\":[");
+    for(int i=0;i<sim.memoryWords;i++){
+      if(!(sim.changed[i>>5] & (1UL<<(i&31))))continue;
+      out.printf("%s%d,%d", comma, i, sim.memory[i]);
+      comma = ",";
+    }
   }
   else{
-    client.println("      <form action=\"run\" method=\"get\">");
-    client.println("        <input type=\"submit\" value=\"Run\">");
+    out.print(",\"program\":\"");
+    text.print(program);
+    out.print("\",\"memory\":[");
+    for(int i=0;i<sim.memoryWords;i++)out.printf(i>0 ? ",%d" : "%d", sim.memory[i]);
   }
-  client.println("      </form>");
-  client.println("      <h2>Video Output</h2>");
-  client.println("      <form action=\"clear\" method=\"get\">");
-  client.println("        <pre><textarea name=\"output\" rows=\"15\" cols=\"48\">");
-  client.println(videoOutput);
-  client.println("        </textarea></pre>");
-  client.println("        <input type=\"submit\" value=\"Clear\">");
-  client.println("      </form>");
-  client.println("    </section>");
-  return;
+  out.printf("],\"outputStart\":%lu,\"outputFrom\":%lu,\"output\":\"", (unsigned long)part.start, (unsigned long)part.from);
+  text.write((const uint8_t *)part.text, part.length);
+  out.print("\"}");
+}
+
+/**
+ * sendState()
+ * 
+ * Answers /api/state with printState().
+ */
+void sendState(httpWriter &out, const String &program, const simView &sim){
+  outputPart part;
+  uint32_t   since;
+  readOutputPart(*sim.output, part, queryValue("output", since) ? &since : NULL);
+  sendHeaders(out, "200 OK", "application/json");
+  out.header("Cache-Control", "no-store");
+  out.endHeaders();
+  printState(out, program, sim, part);
+}
+
+/**
+ * sendStateBinary()
+ * 
+ * The same as sendState(), without the program, for front ends that poll
+ * too often to want JSON. All numbers are little-endian:
+ *   uint32  epoch
+ *   uint8   flags: 1 running, 2 memory is all of it, 4 speed is known,
+ *           8 paused
+ *   uint8   0
+ *   uint16  acc, x, y, pc, zero, negative, carry
+ *   uint32  speed
+ *   uint32  outputStart, outputFrom
+ *   uint16  words of memory, n
+ *   n x uint16 value, if it is all of memory, or else
+ *   n x (uint16 address, uint16 value)
+ *   uint16  bytes of output, then those bytes
+ */
+void putWord(Print &out, uint32_t value, int bytes){
+  for(int i=0;i<bytes;i++,value>>=8)out.write((uint8_t)(value & 255));
+}
+
+void sendStateBinary(httpWriter &out, const simView &sim){
+  outputPart  part;
+  int         count = 0;
+  uint32_t    since;
+  readOutputPart(*sim.output, part, queryValue("output", since) ? &since : NULL);
+  for(int i=0;i<sim.memoryWords;i++)if(!sim.changed || (sim.changed[i>>5] & (1UL<<(i&31))))count++;
+  sendHeaders(out, "200 OK", "application/octet-stream");
+  out.header("Cache-Control", "no-store");
+  out.endHeaders();
+  putWord(out, sim.epoch, 4);
+  putWord(out, (sim.running ? 1 : 0) | (sim.changed ? 0 : 2) | (sim.speed>=0 ? 4 : 0) | (sim.paused ? 8 : 0), 2);
+  putWord(out, sim.regs.acc, 2);
+  putWord(out, sim.regs.xReg, 2);
+  putWord(out, sim.regs.yReg, 2);
+  putWord(out, sim.regs.progCounter, 2);
+  putWord(out, sim.regs.zeroFlag, 2);
+  putWord(out, sim.regs.negFlag, 2);
+  putWord(out, sim.regs.carryFlag, 2);
+  putWord(out, sim.speed>=0 ? sim.speed : 0, 4);
+  putWord(out, part.start, 4);
+  putWord(out, part.from, 4);
+  putWord(out, count, 2);
+  for(int i=0;i<sim.memoryWords;i++){
+    if(!sim.changed)putWord(out, sim.memory[i], 2);
+    else if(sim.changed[i>>5] & (1UL<<(i&31))){
+      putWord(out, i, 2);
+      putWord(out, sim.memory[i], 2);
+    }
+  }
+  putWord(out, part.length, 2);
+  out.write((const uint8_t *)part.text, part.length);
+}
+
+/**
+ * sendDone()
+ * 
+ * Answers a command POSTed to /api/ or /compile: it has been passed on,
+ * and there is nothing more to say. What it did shows up in the state.
+ */
+void sendDone(httpWriter &out){
+  sendHeaders(out, "204 No Content", NULL, NO_BODY);
+  out.endHeaders();
+}
+
+/**
+ * sendError()
+ * 
+ * Sends the page for a request that couldn't be read.
+ * @param const char* status  e.g. "400 Bad Request"
+ */
+void sendError(httpWriter &out, const char *status){
+  sendHead(out, status, false);
+  out.printf("    <p>CECIL couldn't make sense of that: %s. <a href=\"/\">Back to CECIL</a></p>\n", status);
+}
+
+/**
+ * sendNotFound()
+ * 
+ * Sends the page for a path there's nothing at.
+ */
+void sendNotFound(httpWriter &out){
+  sendHead(out, "404 Not Found", false);
+  out.println("    <p>There's nothing here. <a href=\"/\">Back to CECIL</a></p>");
 }
 
 /**
@@ -111,13 +306,13 @@ void sendBody(WiFiClient client, String program, String memory, String registers
  * 
  * Sends the body HTML if the SIM status has been changed
  */
-void sendResponseBody(WiFiClient client, bool simStatus){
-  client.println("      <p>Status of SIM40 is now: <strong>");
-  if(simStatus)client.print("running");
-  else client.print("halted");
-  client.println("</strong></p>");
-  client.println("      <p>Returning to main page shortly</p>");
-  client.println("      <p>Or <a href=\"/\"><button>Return</button></a> manually</p>");
+void sendResponseBody(httpWriter &out, bool simStatus){
+  out.println("      <p>Status of SIM40 is now: <strong>");
+  if(simStatus)out.print("running");
+  else out.print("halted");
+  out.println("</strong></p>");
+  out.println("      <p>Returning to main page shortly</p>");
+  out.println("      <p>Or <a href=\"/\"><button>Return</button></a> manually</p>");
   return;
 }
 
@@ -126,78 +321,139 @@ void sendResponseBody(WiFiClient client, bool simStatus){
  * 
  * Sends the final HTML to end the page for any web page
  */
-void sendTail(WiFiClient client)
+void sendTail(httpWriter &out)
 {
   // Send the final HTML
-  client.println("  </body>");
-  client.println("</html>");
+  out.println("  </body>");
+  out.println("</html>");
   return;
 }
 
-String serviceWebRequest(WiFiClient client, String program, String memory, String registers, String videoOutput, bool simStatus)
+/**
+ * readWebRequest()
+ * 
+ * Reads a request, with its body if it has one, noting any command and
+ * cookie in it, but doesn't answer it: see sendWebResponse(). The bytes
+ * are taken as they come, a buffer full at a time, by an httpRequest.
+ * Commands come as GETs from the old forms, or are POSTed to /api/run,
+ * /api/halt, /api/step and /api/clear; a key pressed on the page is
+ * POSTed to /api/key?code=65, and goes to KEYB_IN. A program comes POSTed
+ * to /compile, or in the old form's GET /compile?program=.
+ * @return String  the command: none/halt/compile/run/clear/step/key
+ */
+String readWebRequest(WiFiClient client)
 {
+    httpRequest   request;
+    uint8_t       data[128];
+    unsigned long start = millis();
+    if(trace)Serial.print("Servicing new client: ");
+    request.expect("/compile", "program");
+    while(!request.finished() && client.connected() && millis()-start<HTTP_REQUEST_TIMEOUT){
+      int count = client.available();
+      if(count<=0){
+        delay(1);
+        continue;
+      }
+      count = client.read(data, count<(int)sizeof(data) ? count : sizeof(data));
+      if(count<=0)continue;
+      if(trace)Serial.write(data, count);
+      request.parse(data, count);
+    }
+    if(!request.finished() && !request.status)request.status = "408 Request Timeout";
+
     webCmd = "none";
-    if(trace)Serial.print("Servicing new client: ");           // print a message out the serial port
-    String currentLine = "";                // make a String to hold incoming data from the client
-    while (client.connected()) {            // loop while the client's connected
-      if (client.available()) {             // if there's bytes to read from the client,
-        char c = client.read();             // read a byte, then
-        if(trace)Serial.write(c);           // print it out the serial monitor
-        if (c == '\n') {                    // if the byte is a newline character
-
-          if (currentLine.startsWith("Referer:"))Serial.println("Requesting "+ currentLine);
-          if (currentLine.startsWith("GET /compile?program="))tidyProgram(currentLine);
-//Serial.println(currentLine); // Trace; lets you see what's coming in via the GET parameter
-          // if the current line is blank, you got two newline characters in a row.
-          // that's the end of the client HTTP request, so break out & send a response:
-          if (currentLine.length() == 0) {
-            // break out of the while loop:
-            break;
-          } else {    // if you got a newline, then clear currentLine:
-            currentLine = "";
-          }
-        } else if (c != '\r') {  // if you got anything else but a carriage return character,
-          currentLine += c;      // add it to the end of the currentLine
-        }
-        // Check to see what the client is requesting:
-        if (currentLine.endsWith("GET /compile")) {
-          Serial.println("\nStarting compilation");
-          tidyProgram(currentLine);
-          webCmd = "compile";
-        }
-        if (currentLine.endsWith("GET /run")) {
-          Serial.println("\nBeginning program run");
-          webCmd = "run";
-        }
-        if (currentLine.endsWith("GET /halt")) {
-          Serial.println("\nTerminating program run");
-          webCmd = "halt";
-        }
-        if (currentLine.endsWith("GET /clear")) {
-          Serial.println("\nClearing output");
-          webCmd = "clear";
-        }
+    webPath = request.path;
+    webQuery = request.query;
+    webCookie = request.cookie;
+    webIfNoneMatch = request.ifNoneMatch;
+    webPost = strcmp(request.method, "POST")==0;
+    webError = request.status;
+    if(!webError && !webPost && strcmp(request.method, "GET")!=0)webError = "405 Method Not Allowed";
+    if(webError){
+      Serial.printf("\nBad request: %s\n", webError);
+      return webCmd;
+    }
+    if(request.hasProgram){
+      Serial.println("\nStarting compilation");
+      progUpdate = request.program;
+      webCmd = "compile";
+    }
+    else if(webPost && webPath.startsWith("/api/")){
+      String name = webPath.substring(5);
+      if(name == "run" || name == "halt" || name == "step" || name == "clear" || name == "save") webCmd = name;
+      if(name == "key"){
+        if(queryValue("code", webKey) && webKey<=WORD_MASK)webCmd = name;
+        else webError = "400 Bad Request";
       }
     }
+    else if(!webPost){
+      if(webPath == "/run") webCmd = "run";
+      if(webPath == "/halt") webCmd = "halt";
+      if(webPath == "/clear") webCmd = "clear";
+    }
+    if(webCmd == "run") Serial.println("\nBeginning program run");
+    if(webCmd == "halt") Serial.println("\nTerminating program run");
+    if(webCmd == "clear") Serial.println("\nClearing output");
+    return webCmd;
+}
+
+/**
+ * wantsSession()
+ * 
+ * Whether the request just read needs a SIM40 of its own: the page, a
+ * command, or /api/state or /api/events, read without error. Anything
+ * else (a favicon, say) is answered without taking one.
+ */
+bool wantsSession()
+{
+    if(webError)return false;
+    return webCmd != "none" || webPath == "/api/state" || webPath == "/api/state.bin" ||
+           webPath == "/api/events" || findAsset(webPath);
+}
+
+/**
+ * sendWebResponse()
+ * 
+ * Answers the request just read by readWebRequest(), and closes the
+ * connection. The page itself comes from flash (webassets.h); what the
+ * SIM40 is doing, it fetches from /api/state. The reply is collected a
+ * TCP segment's worth at a time by an httpWriter rather than sent line by
+ * line.
+ */
+void sendWebResponse(WiFiClient client, const String &program, const simView &sim)
+{
     // We need to send a response before closing the connection:
+    httpWriter out(client);
+    const webAsset *asset;
 
-    // Send the headers, then the content of the HTTP response
-    // If there's no button pressed, we want the default page
-    if(webCmd == "none"){
-     sendHead(client, simStatus, false); // Don't redirect
-     sendBody(client, program, memory, registers, videoOutput, simStatus);
+    // A command from the page's script needs no page back; a button
+    // that's been pressed on an old form is acknowledged, with a redirect
+    if(webError){
+     sendError(out, webError);
+     sendTail(out);
+    }
+    else if(webCmd != "none" && webPost)sendDone(out);
+    else if(webCmd != "none"){
+     sendHead(out, "200 OK", true); // Do redirect after 3 seconds
+     sendResponseBody(out, sim.running);
+     sendTail(out);
     }
-    // But if a button's been pressed, we want to acknowledge the action, then redirect
+    else if(webPath == "/api/state")sendState(out, program, sim);
+    else if(webPath == "/api/state.bin")sendStateBinary(out, sim);
+    else if((asset = findAsset(webPath)))sendAsset(out, *asset);
     else{
-     sendHead(client, simStatus, true); // Do redirect after 3 seconds
-     sendResponseBody(client, simStatus);
+     sendNotFound(out);
+     sendTail(out);
     }
-    // Now round off the HTML
-    sendTail(client);
-    // The HTTP response ends with another blank line:
-    client.println();
+    out.end();
     // close the connection:
     client.stop();
     Serial.println("Client Disconnected.");
+}
+
+String serviceWebRequest(WiFiClient client, const String &program, const simView &sim)
+{
+    readWebRequest(client);
+    sendWebResponse(client, program, sim);
     return webCmd;
 }
@@ -0,0 +1,278 @@
+/**
+ * Arduino shim for the CECIL host build
+ *
+ * Provides just enough of the Arduino core (String, Serial, delay, millis,
+ * bitRead, random) for the sketch headers to compile and run on Linux.
+ * It is not a general Arduino emulation - only what CECIL uses is here.
+ * ARDUINO is deliberately left undefined, which is how the sketch headers
+ * tell that they are being built for the host.
+ */
+
+#ifndef CECIL_HOST_ARDUINO_H
+#define CECIL_HOST_ARDUINO_H
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <thread>
+
+#define BIN 2
+#define OCT 8
+#define DEC 10
+#define HEX 16
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+
+/* ----- String ---------------------------------------------------------- */
+
+class String
+{
+  private:
+  std::string s;
+
+  static std::string fromLong(long value, int base){
+    if(base==DEC) return std::to_string(value);
+    std::string digits;
+    unsigned long v = (unsigned long)value;
+    if(v==0) return "0";
+    while(v>0){
+      digits.insert(digits.begin(), "0123456789abcdef"[v % base]);
+      v /= base;
+    }
+    return digits;
+  }
+
+  public:
+  String() {}
+  String(const char *str) : s(str ? str : "") {}
+  String(const std::string &str) : s(str) {}
+  String(char c) : s(1, c) {}
+  String(unsigned char value, int base = DEC) : s(fromLong(value, base)) {}
+  String(int value, int base = DEC) : s(fromLong(value, base)) {}
+  String(unsigned int value, int base = DEC) : s(fromLong((long)value, base)) {}
+  String(long value, int base = DEC) : s(fromLong(value, base)) {}
+  String(unsigned long value, int base = DEC) : s(fromLong((long)value, base)) {}
+  String(double value, int decimals = 2){
+    char buff[40];
+    snprintf(buff, sizeof(buff), "%.*f", decimals, value);
+    s = buff;
+  }
+
+  unsigned int length() const { return s.length(); }
+  const char *c_str() const { return s.c_str(); }
+  bool reserve(unsigned int size){ s.reserve(size); return true; }
+  bool isEmpty() const { return s.empty(); }
+
+  char charAt(unsigned int index) const { return index<s.length() ? s[index] : 0; }
+  char operator[](unsigned int index) const { return charAt(index); }
+  char &operator[](unsigned int index) { return s[index]; }
+
+  String &operator+=(const String &rhs){ s += rhs.s; return *this; }
+  String &operator+=(const char *rhs){ s += rhs; return *this; }
+  String &operator+=(char c){ s += c; return *this; }
+  String &operator+=(int value){ s += std::to_string(value); return *this; }
+  String &operator+=(unsigned int value){ s += std::to_string(value); return *this; }
+  String &operator+=(long value){ s += std::to_string(value); return *this; }
+  String &operator+=(unsigned long value){ s += std::to_string(value); return *this; }
+  bool concat(const String &rhs){ s += rhs.s; return true; }
+  bool concat(const char *rhs, unsigned int len){ s.append(rhs, len); return true; }
+  bool concat(char c){ s += c; return true; }
+
+  bool operator==(const String &rhs) const { return s==rhs.s; }
+  bool operator==(const char *rhs) const { return s==rhs; }
+  bool operator!=(const String &rhs) const { return s!=rhs.s; }
+  bool operator!=(const char *rhs) const { return s!=rhs; }
+  bool operator<(const String &rhs) const { return s<rhs.s; }
+  bool equals(const String &rhs) const { return s==rhs.s; }
+
+  int indexOf(char c, unsigned int from = 0) const {
+    size_t p = s.find(c, from);
+    return p==std::string::npos ? -1 : (int)p;
+  }
+  int indexOf(const String &str, unsigned int from = 0) const {
+    size_t p = s.find(str.s, from);
+    return p==std::string::npos ? -1 : (int)p;
+  }
+  int lastIndexOf(char c) const {
+    size_t p = s.rfind(c);
+    return p==std::string::npos ? -1 : (int)p;
+  }
+  bool startsWith(const String &prefix) const {
+    return s.compare(0, prefix.s.length(), prefix.s)==0;
+  }
+  bool endsWith(const String &suffix) const {
+    return s.length()>=suffix.s.length() &&
+      s.compare(s.length()-suffix.s.length(), suffix.s.length(), suffix.s)==0;
+  }
+
+  // Arduino semantics: out-of-range indices are clamped, not thrown
+  String substring(unsigned int from) const {
+    if(from>=s.length()) return String();
+    return String(s.substr(from));
+  }
+  String substring(unsigned int from, unsigned int to) const {
+    if(from>to){ unsigned int t = from; from = to; to = t; }
+    if(from>=s.length()) return String();
+    if(to>s.length()) to = s.length();
+    return String(s.substr(from, to-from));
+  }
+
+  void trim(){
+    size_t begin = 0;
+    while(begin<s.length() && isspace((unsigned char)s[begin])) begin++;
+    size_t end = s.length();
+    while(end>begin && isspace((unsigned char)s[end-1])) end--;
+    s = s.substr(begin, end-begin);
+  }
+  void replace(const String &find, const String &with){
+    if(find.s.empty()) return;
+    size_t p = 0;
+    while((p = s.find(find.s, p))!=std::string::npos){
+      s.replace(p, find.s.length(), with.s);
+      p += with.s.length();
+    }
+  }
+  void toLowerCase(){ for(auto &c : s) c = tolower((unsigned char)c); }
+  void toUpperCase(){ for(auto &c : s) c = toupper((unsigned char)c); }
+  long toInt() const { return strtol(s.c_str(), nullptr, 10); }
+
+  friend String operator+(const String &lhs, const String &rhs){
+    String result(lhs);
+    result += rhs;
+    return result;
+  }
+  friend String operator+(const String &lhs, const char *rhs){
+    String result(lhs);
+    result += rhs;
+    return result;
+  }
+  friend String operator+(const char *lhs, const String &rhs){
+    String result(lhs);
+    result += rhs;
+    return result;
+  }
+  friend String operator+(const String &lhs, char rhs){
+    String result(lhs);
+    result += rhs;
+    return result;
+  }
+  friend String operator+(const String &lhs, int rhs){
+    String result(lhs);
+    result += rhs;
+    return result;
+  }
+};
+
+/* ----- Print / Serial -------------------------------------------------- */
+
+class Print
+{
+  public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size){
+    size_t n = 0;
+    while(size--) n += write(*buffer++);
+    return n;
+  }
+  size_t write(const char *str){ return write((const uint8_t *)str, strlen(str)); }
+  size_t write(const char *buffer, size_t size){ return write((const uint8_t *)buffer, size); }
+
+  size_t print(const String &str){ return write(str.c_str(), str.length()); }
+  size_t print(const char *str){ return write(str); }
+  size_t print(char c){ return write((uint8_t)c); }
+  size_t print(int value, int base = DEC){ return print(String((long)value, base)); }
+  size_t print(unsigned int value, int base = DEC){ return print(String((unsigned long)value, base)); }
+  size_t print(long value, int base = DEC){ return print(String(value, base)); }
+  size_t print(unsigned long value, int base = DEC){ return print(String(value, base)); }
+  size_t print(double value, int decimals = 2){ return print(String(value, decimals)); }
+
+  size_t println(){ return write("\r\n"); }
+  template<typename T> size_t println(T value){ size_t n = print(value); return n + println(); }
+  template<typename T> size_t println(T value, int format){ size_t n = print(value, format); return n + println(); }
+
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))){
+    char buff[512];
+    va_list args, again;
+    va_start(args, format);
+    va_copy(again, args);
+    int len = vsnprintf(buff, sizeof(buff), format, args);
+    va_end(args);
+    if(len<0 || (size_t)len<sizeof(buff)){
+      va_end(again);
+      return len<0 ? 0 : write(buff, len);
+    }
+    // As on the ESP32, longer text is formatted again into a buffer that fits
+    std::string longer(len+1, '\0');
+    vsnprintf(&longer[0], len+1, format, again);
+    va_end(again);
+    return write(longer.data(), len);
+  }
+};
+
+/**
+ * The host Serial port writes to stderr so that it never mixes with the
+ * SIM40's own video output, which the host tools send to stdout. It can be
+ * silenced entirely, which is what the command line tools do by default.
+ */
+class HostSerial : public Print
+{
+  public:
+  bool enabled = true;
+
+  void begin(unsigned long baudrate){ (void)baudrate; }
+  void setDebugOutput(bool on){ (void)on; }
+  int  available(){ return 0; }
+  int  read(){ return -1; }
+  operator bool() const { return true; }
+
+  size_t write(uint8_t c) override {
+    if(enabled) fputc(c, stderr);
+    return 1;
+  }
+  size_t write(const uint8_t *buffer, size_t size) override {
+    if(enabled) fwrite(buffer, 1, size, stderr);
+    return size;
+  }
+  using Print::write;
+};
+
+inline HostSerial Serial;
+
+/* ----- Timing and maths ------------------------------------------------ */
+
+inline unsigned long millis(){
+  static const auto start = std::chrono::steady_clock::now();
+  return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+inline unsigned long micros(){
+  static const auto start = std::chrono::steady_clock::now();
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+inline void delay(unsigned long ms){
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline void yield(){
+  std::this_thread::yield();
+}
+
+inline long random(long howbig){
+  return howbig<=0 ? 0 : ::random() % howbig;
+}
+
+inline long random(long howsmall, long howbig){
+  return howsmall>=howbig ? howsmall : howsmall + random(howbig - howsmall);
+}
+
+#endif
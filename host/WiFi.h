@@ -0,0 +1,96 @@
+/**
+ * WiFi shim for the CECIL host build
+ *
+ * A WiFiClient here is a connection held in memory: the request it will
+ * "receive" is given to it up front, and everything printed to it is kept
+ * for the caller to look at afterwards. The far end is taken to have
+ * finished sending once the request has all been read, so connected()
+ * goes false then, as it would on the ESP32; unless the client is made
+ * held, like a browser listening to an event stream, in which case it
+ * stays connected until hangUp(). As there too, copies of a
+ * client share the one connection, since webserver.h passes clients
+ * around by value.
+ */
+
+#ifndef CECIL_HOST_WIFI_H
+#define CECIL_HOST_WIFI_H
+
+#include <memory>
+#include <vector>
+#include "Arduino.h"
+
+class WiFiClient : public Print
+{
+  private:
+  struct connection{
+    std::string request;
+    size_t      position = 0;
+    std::string response;
+    std::vector<size_t> writes;   // The size of each write() of a buffer
+    bool        open = true;
+    bool        held = false;
+  };
+  std::shared_ptr<connection> link;
+
+  public:
+  WiFiClient() {}
+  WiFiClient(const std::string &request, bool held = false) : link(std::make_shared<connection>()){
+    link->request = request;
+    link->held = held;
+  }
+
+  operator bool() const { return link!=nullptr; }
+  bool connected(){ return link && link->open && (available()>0 || link->held); }
+  void stop(){ if(link) link->open = false; }
+  void hangUp(){ if(link) link->held = false; }
+  void setNoDelay(bool){}
+
+  int available(){
+    return link ? (int)(link->request.length()-link->position) : 0;
+  }
+  int read(){
+    if(!available()) return -1;
+    return (unsigned char)link->request[link->position++];
+  }
+  int read(uint8_t *buffer, size_t size){
+    int count = available()<(int)size ? available() : (int)size;
+    for(int i=0;i<count;i++)buffer[i] = link->request[link->position++];
+    return count;
+  }
+
+  size_t write(uint8_t c) override {
+    if(!link || !link->open) return 0;
+    link->response += (char)c;
+    return 1;
+  }
+  size_t write(const uint8_t *buffer, size_t size) override {
+    if(!link || !link->open) return 0;
+    link->response.append((const char *)buffer, size);
+    link->writes.push_back(size);
+    return size;
+  }
+  using Print::write;
+
+  /**
+   * response
+   *
+   * Everything that has been sent to the client.
+   */
+  const std::string &response() const {
+    static const std::string none;
+    return link ? link->response : none;
+  }
+
+  /**
+   * writes
+   *
+   * How it was sent: the size of each buffer written, which on the ESP32
+   * would each be a TCP segment or more.
+   */
+  const std::vector<size_t> &writes() const {
+    static const std::vector<size_t> none;
+    return link ? link->writes : none;
+  }
+};
+
+#endif
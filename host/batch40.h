@@ -0,0 +1,538 @@
+/**
+ * Class definition for running many SIM40s in lockstep on the host
+ *
+ * A batch40 holds a number of SIM40s, its lanes, all loaded with the same
+ * program, so that one program can be run against many inputs at once
+ * (for marking, say). Rather than one sim40 object per run, the lanes are
+ * kept as structure of arrays: each register is an array with an entry
+ * per lane, and memory is held address by address, with the lanes' copies
+ * of each word side by side. Each step, the lanes whose program counter is
+ * lowest are run together. Those of them that find the same instruction
+ * there (as they do unless the program has rewritten itself differently
+ * in each) go through one loop over the lanes, with each lane's result
+ * picked by a mask rather than a branch, which the compiler turns into
+ * SIMD code; the rest, and instructions that need more than plain memory
+ * and registers, are run one lane at a time. Taking the lowest program
+ * counter first lets lanes that branched different ways fall back into
+ * step when their paths join again.
+ *
+ * Lanes behave as a sim40 does in fast-forward mode, with no input
+ * arriving: the values a program is given should be poked into memory
+ * before the run. There is no clock, so a pause ends at once and nothing
+ * can interrupt; a program that starts the TIMER stops with
+ * LANE_UNSUPPORTED, and should be run on a sim40 instead. Every
+ * instruction a lane starts counts towards its instructions, including
+ * the stop, or the one that failed.
+ */
+
+#ifndef CECIL_BATCH40_H
+#define CECIL_BATCH40_H
+
+#include <string>
+#include <vector>
+// sim40.h has to have been included before this
+
+typedef enum{
+  LANE_RUNNING,
+  LANE_HALTED,        // The program stopped
+  LANE_ERROR,         // A run error ended the program
+  LANE_WAITING,       // wait, with nothing to wake it
+  LANE_LIMIT,         // The instruction limit was reached
+  LANE_UNSUPPORTED    // The program needs the clock; see above
+} laneState;
+
+class batch40
+{
+  private:
+  int       lanes;
+  std::vector<int16_t>  acc, xReg, yReg, pc;
+  std::vector<uint8_t>  zero, neg, carry;
+  std::vector<uint8_t>  state;
+  std::vector<uint8_t>  mask;       // Lanes taking part in the current step
+  std::vector<uint32_t> count;      // Instructions run by each lane
+  std::vector<uint16_t> memory;     // Word a of lane l is at a*lanes+l
+  std::vector<std::string> output;  // What each lane has sent to VID_OUT
+
+  uint16_t &mem(int address, int lane){
+    return memory[(size_t)address*lanes+lane];
+  }
+
+ /**
+  * Single lane helpers
+  *
+  * These do for one lane what the sim40's helpers of the same names do, so
+  * that a lane run on its own behaves exactly as a sim40 would.
+  */
+  int readMem(int l, int address){
+    address &= 1023;
+    if(address==RANDOM_GEN)mem(address, l) = random(1024);
+    return mem(address, l);
+  }
+
+  void doStore(int l, int address, int data){
+    address &= 1023;
+    data &= WORD_MASK;
+    mem(address, l) = data;
+    if(address==VID_OUT)output[l] += (char)data;
+    else if(address==SERIAL_OUT)Serial.write((uint8_t)data);
+    else if(address==TIMER && data>0)state[l] = LANE_UNSUPPORTED;
+  }
+
+  void runError(int l, const char *message){
+    output[l] += message;
+    state[l] = LANE_ERROR;
+  }
+
+  bool stackPush(int l, int value){
+    int sp = mem(STACK_PTR, l);
+    if(sp>=STACK+STACK_SIZE){
+      runError(l, "!!RUN ERROR: Stack overflow\n");
+      return false;
+    }
+    mem(sp, l) = value & WORD_MASK;
+    mem(STACK_PTR, l) = (sp+1) & WORD_MASK;
+    return true;
+  }
+
+  int stackPull(int l){
+    int sp = mem(STACK_PTR, l);
+    if(sp<=STACK){
+      runError(l, "!!RUN ERROR: Stack underflow\n");
+      return -1;
+    }
+    mem(STACK_PTR, l) = sp-1;
+    return mem(sp-1, l);
+  }
+
+  void doAdd(int l, int data){
+    int a = acc[l] + data + carry[l];
+    if(a>1023){
+      a %= 1024;
+      carry[l] = true;
+    }
+    if(a==0)zero[l] = true;
+    acc[l] = a;
+  }
+
+  void doSub(int l, int data){
+    int a = acc[l] + (data ^ 1023) + carry[l];
+    if(a>1023){
+      a %= 1024;
+      carry[l] = true;
+      neg[l] = false;
+    }
+    else{
+      a = (a ^ 1023) + 1;
+      carry[l] = false;
+      neg[l] = true;
+    }
+    if(a==0)zero[l] = true;
+    acc[l] = a;
+  }
+
+  void doCompare(int l, int reg, int data){
+    zero[l] = reg==data;
+    neg[l] = reg<data;
+  }
+
+  void doIncrement(int l, int16_t &reg){
+    reg++;
+    zero[l] = reg==0;
+    carry[l] = reg>1023;
+    if(reg>1023)reg %= 1024;
+  }
+
+  void doDecrement(int l, int16_t &reg){
+    reg--;
+    zero[l] = reg==0;
+    neg[l] = reg<0;
+    if(reg<0)reg += 1024;
+  }
+
+ /**
+  * step
+  *
+  * Runs lane l's next instruction on its own, the way doInstruction would.
+  */
+  void step(int l){
+    int p = pc[l];
+    int opcode = mem(p, l);
+    if(opcode>50)opcode = DECODE_UNKNOWN;
+    int length = opcode>=1 && opcode<=22 && p<1023 ? 2 : 1;
+    int address = length==2 ? mem(p+1, l) : 0;
+    int top;
+    char digits[12];
+    pc[l] = p+length;
+    count[l]++;
+    switch(opcode){
+      case  0: //stop
+        output[l] += "\n===\nProgram run concluded\n";
+        state[l] = LANE_HALTED;
+        break;
+      case  1: acc[l] = readMem(l, address); break;
+      case  2: doStore(l, address, acc[l]); break;
+      case  3: doAdd(l, readMem(l, address)); break;
+      case  4: doSub(l, readMem(l, address)); break;
+      case  5: acc[l] &= readMem(l, address); zero[l] = acc[l]==0; break;
+      case  6: acc[l] |= readMem(l, address); zero[l] = acc[l]==0; break;
+      case  7: acc[l] ^= readMem(l, address); zero[l] = acc[l]==0; break;
+      case  8: pc[l] = address; break;
+      case  9: doCompare(l, acc[l], readMem(l, address)); break;
+      case 10: if(neg[l])pc[l] = address; break;
+      case 11: if(!neg[l])pc[l] = address; break;
+      case 12: if(zero[l])pc[l] = address; break;
+      case 13: stackPush(l, pc[l]); pc[l] = address; break;
+      case 14: if(carry[l])pc[l] = address; break;
+      case 15: xReg[l] = readMem(l, address); break;
+      case 16: doStore(l, address, xReg[l]); break;
+      case 17: acc[l] = readMem(l, address+xReg[l]); break;
+      case 18: doCompare(l, xReg[l], readMem(l, address)); break;
+      case 19: yReg[l] = readMem(l, address); break;
+      case 20: doStore(l, address, yReg[l]); break;
+      case 21: readMem(l, address); break;   // pause: over at once
+      case 22: //printd
+        snprintf(digits, sizeof(digits), "%d", readMem(l, address) + readMem(l, (address+1) & WORD_MASK)*1024);
+        output[l] += digits;
+        break;
+      case 23: pc[l] = stackPull(l); break;
+      case 24: stackPush(l, acc[l]); break;
+      case 25: acc[l] = stackPull(l); break;
+      case 26: stackPush(l, xReg[l]); break;
+      case 27: xReg[l] = stackPull(l); break;
+      case 28: doIncrement(l, xReg[l]); break;
+      case 29: doDecrement(l, xReg[l]); break;
+      case 30: //lshift
+        acc[l] = acc[l]*2 + carry[l];
+        carry[l] = acc[l]>1023;
+        acc[l] %= 1024;
+        break;
+      case 31: //rshift
+        top = acc[l] & 1;
+        acc[l] = acc[l]/2 + (carry[l] ? 512 : 0);
+        carry[l] = top;
+        break;
+      case 32: carry[l] = true; break;
+      case 33: carry[l] = false; break;
+      case 34: //getkey
+        acc[l] = readMem(l, KEYB_IN);
+        mem(KEYB_IN, l) = 0;
+        break;
+      case 35: state[l] = LANE_WAITING; break;
+      case 36: //retfint
+        pc[l] = stackPull(l);
+        mem(INT_ENABLE, l) = 1;
+        break;
+      case 37: //printb
+        for(int i=9;i>=0;i--)output[l] += bitRead(acc[l],i) ? '1' : '0';
+        break;
+      case 38: //print
+        snprintf(digits, sizeof(digits), "%d", acc[l]);
+        output[l] += digits;
+        break;
+      case 39: output[l] += (char)acc[l]; break;
+      case 40: stackPush(l, yReg[l]); break;
+      case 41: yReg[l] = stackPull(l); break;
+      case 42: doIncrement(l, yReg[l]); break;
+      case 43: doDecrement(l, yReg[l]); break;
+      case 44: std::swap(acc[l], xReg[l]); break;
+      case 45: std::swap(acc[l], yReg[l]); break;
+      case 46: std::swap(xReg[l], yReg[l]); break;
+      case 47: //swapas
+        top = stackPull(l);
+        if(state[l]!=LANE_RUNNING)break;
+        stackPush(l, acc[l]);
+        acc[l] = top;
+        break;
+      case 48: mem(INT_ENABLE, l) = 1; break;
+      case 49: mem(INT_ENABLE, l) = 0; break;
+      case 50: break;
+      default:
+        snprintf(digits, sizeof(digits), "%d", mem(p, l));
+        runError(l, "!!RUN ERROR: unknown program instruction: ");
+        output[l] += digits;
+        break;
+    }
+    if(pc[l]>1023)runError(l, "!!RUN ERROR: program counter overflow");
+  }
+
+ /**
+  * stepTogether
+  *
+  * Runs the instruction opcode (with data field address), which every lane
+  * in mask has at p, in all of them at once; run() has already stepped
+  * their program counters past it. Each case goes over every lane, working
+  * out its new values whether it is in the mask or not, then keeping them
+  * only if it is; there are no branches for the compiler to stop at. Only
+  * instructions that touch plain memory below the I/O page come here.
+  */
+  void stepTogether(int opcode, int address){
+    const int                 n = lanes;
+    const uint8_t  *__restrict m = mask.data();
+    int16_t        *__restrict a = acc.data();
+    int16_t        *__restrict x = xReg.data();
+    int16_t        *__restrict y = yReg.data();
+    int16_t        *__restrict pcs = pc.data();
+    uint8_t        *__restrict z = zero.data();
+    uint8_t        *__restrict ng = neg.data();
+    uint8_t        *__restrict c = carry.data();
+    uint16_t       *__restrict row = &memory[(size_t)address*n];
+
+    switch(opcode){
+      case  1: for(int l=0;l<n;l++)a[l] = pick(m[l], row[l], a[l]); break;
+      case  2: for(int l=0;l<n;l++)row[l] = pick(m[l], a[l] & WORD_MASK, row[l]); break;
+      case  3: //add
+        for(int l=0;l<n;l++){
+          int s = a[l] + row[l] + c[l];
+          int over = s>1023;
+          s = pick(over, s & 1023, s);
+          a[l] = pick(m[l], s, a[l]);
+          c[l] = pick(m[l] & over, 1, c[l]);
+          z[l] = pick(m[l] & (s==0), 1, z[l]);
+        }
+        break;
+      case  4: //sub
+        for(int l=0;l<n;l++){
+          int s = a[l] + (row[l] ^ 1023) + c[l];
+          int over = s>1023;
+          s = pick(over, s & 1023, (s ^ 1023) + 1);
+          a[l] = pick(m[l], s, a[l]);
+          c[l] = pick(m[l], over, c[l]);
+          ng[l] = pick(m[l], !over, ng[l]);
+          z[l] = pick(m[l] & (s==0), 1, z[l]);
+        }
+        break;
+      case  5: for(int l=0;l<n;l++){ int s = a[l] & row[l]; a[l] = pick(m[l], s, a[l]); z[l] = pick(m[l], s==0, z[l]); } break;
+      case  6: for(int l=0;l<n;l++){ int s = a[l] | row[l]; a[l] = pick(m[l], s, a[l]); z[l] = pick(m[l], s==0, z[l]); } break;
+      case  7: for(int l=0;l<n;l++){ int s = a[l] ^ row[l]; a[l] = pick(m[l], s, a[l]); z[l] = pick(m[l], s==0, z[l]); } break;
+      case  8: for(int l=0;l<n;l++)pcs[l] = pick(m[l], address, pcs[l]); break;
+      case  9: //comp
+        for(int l=0;l<n;l++){
+          int d = row[l];
+          z[l] = pick(m[l], a[l]==d, z[l]);
+          ng[l] = pick(m[l], a[l]<d, ng[l]);
+        }
+        break;
+      case 10: for(int l=0;l<n;l++)pcs[l] = pick(m[l] & ng[l], address, pcs[l]); break;
+      case 11: for(int l=0;l<n;l++)pcs[l] = pick(m[l] & !ng[l], address, pcs[l]); break;
+      case 12: for(int l=0;l<n;l++)pcs[l] = pick(m[l] & z[l], address, pcs[l]); break;
+      case 14: for(int l=0;l<n;l++)pcs[l] = pick(m[l] & c[l], address, pcs[l]); break;
+      case 15: for(int l=0;l<n;l++)x[l] = pick(m[l], row[l], x[l]); break;
+      case 16: for(int l=0;l<n;l++)row[l] = pick(m[l], x[l] & WORD_MASK, row[l]); break;
+      case 18: //xcomp
+        for(int l=0;l<n;l++){
+          int d = row[l];
+          z[l] = pick(m[l], x[l]==d, z[l]);
+          ng[l] = pick(m[l], x[l]<d, ng[l]);
+        }
+        break;
+      case 19: for(int l=0;l<n;l++)y[l] = pick(m[l], row[l], y[l]); break;
+      case 20: for(int l=0;l<n;l++)row[l] = pick(m[l], y[l] & WORD_MASK, row[l]); break;
+      case 28: stepIncrement(x); break;
+      case 29: stepDecrement(x); break;
+      case 32: for(int l=0;l<n;l++)c[l] = pick(m[l], 1, c[l]); break;
+      case 33: for(int l=0;l<n;l++)c[l] = pick(m[l], 0, c[l]); break;
+      case 42: stepIncrement(y); break;
+      case 43: stepDecrement(y); break;
+      case 44: stepSwap(a, x); break;
+      case 45: stepSwap(a, y); break;
+      case 46: stepSwap(x, y); break;
+      default: break;   // nop
+    }
+  }
+
+  void stepIncrement(int16_t *reg){
+    const int      n = lanes;
+    const uint8_t *m = mask.data();
+    uint8_t       *z = zero.data(), *c = carry.data();
+    for(int l=0;l<n;l++){
+      int s = reg[l]+1;
+      z[l] = pick(m[l], s==0, z[l]);
+      c[l] = pick(m[l], s>1023, c[l]);
+      reg[l] = pick(m[l], s & 1023, reg[l]);
+    }
+  }
+
+  void stepDecrement(int16_t *reg){
+    const int      n = lanes;
+    const uint8_t *m = mask.data();
+    uint8_t       *z = zero.data(), *ng = neg.data();
+    for(int l=0;l<n;l++){
+      int s = reg[l]-1;
+      z[l] = pick(m[l], s==0, z[l]);
+      ng[l] = pick(m[l], s<0, ng[l]);
+      reg[l] = pick(m[l], pick(s<0, s+1024, s), reg[l]);
+    }
+  }
+
+  void stepSwap(int16_t *first, int16_t *second){
+    const int      n = lanes;
+    const uint8_t *m = mask.data();
+    for(int l=0;l<n;l++){
+      int held = first[l];
+      first[l] = pick(m[l], second[l], held);
+      second[l] = pick(m[l], held, second[l]);
+    }
+  }
+
+  /* A select without a branch: yes if m is 1, no if it is 0 */
+  static inline int pick(int m, int yes, int no){
+    return no ^ ((yes ^ no) & -m);
+  }
+
+  /* Whether stepTogether() can run opcode, given its data field */
+  static bool together(int opcode, int address){
+    switch(opcode){
+      case 1: case 2: case 3: case 4: case 5: case 6: case 7: case 9:
+      case 15: case 16: case 18: case 19: case 20:
+        return address<IO_BASE;
+      case 8: case 10: case 11: case 12: case 14:
+      case 28: case 29: case 32: case 33: case 42: case 43:
+      case 44: case 45: case 46: case 50:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  public:
+  unsigned long stepsTogether = 0;  // Steps run by stepTogether()
+  unsigned long stepsAlone = 0;     // Lane instructions run by step()
+
+  batch40(int width) : lanes(width), acc(width), xReg(width), yReg(width), pc(width),
+    zero(width), neg(width), carry(width), state(width), mask(width), count(width),
+    memory((size_t)1024*width), output(width) {
+    for(int l=0;l<lanes;l++)mem(STACK_PTR, l) = STACK;
+  }
+
+  int size(){
+    return lanes;
+  }
+
+  /**
+   * loadMem
+   *
+   * Loads the same words into every lane's memory, masked to 10 bits.
+   * @return bool success
+   */
+  template<typename word>
+  bool loadMem(int startAddress, const word values[], int noOfEntries){
+    if(startAddress<0 || startAddress+noOfEntries>1024)return false;
+    for(int i=0;i<noOfEntries;i++){
+      for(int l=0;l<lanes;l++)mem(startAddress+i, l) = values[i] & WORD_MASK;
+    }
+    return true;
+  }
+
+  void setStartVector(int address){
+    for(int l=0;l<lanes;l++)mem(START_V, l) = address & WORD_MASK;
+  }
+
+  /**
+   * poke / peek
+   *
+   * One word of one lane's memory: how a lane is given its input before a
+   * run, and how its results are found afterwards.
+   */
+  void poke(int lane, int address, int value){
+    mem(address & 1023, lane) = value & WORD_MASK;
+  }
+
+  int peek(int lane, int address){
+    return mem(address & 1023, lane);
+  }
+
+  /**
+   * beginRun
+   *
+   * Gets every lane ready to run from its start vector, as sim40's
+   * beginRun() does, with its output and instruction count cleared.
+   */
+  void beginRun(){
+    for(int l=0;l<lanes;l++){
+      pc[l] = mem(START_V, l);
+      state[l] = LANE_RUNNING;
+      count[l] = 0;
+      output[l].clear();
+    }
+  }
+
+  /**
+   * run
+   *
+   * Runs the lanes until every one has stopped, or has run limit
+   * instructions.
+   * @param  uint32_t limit  Most instructions for each lane
+   * @return unsigned long long  Instructions run, over all the lanes
+   */
+  unsigned long long run(uint32_t limit){
+    const int       n = lanes;
+    uint8_t        *st = state.data(), *m = mask.data();
+    int16_t        *pcs = pc.data();
+    uint32_t       *counts = count.data();
+    unsigned long long total = 0;
+    for(;;){
+      // The lowest program counter of the lanes still running
+      int p = 1024, first = -1;
+      for(int l=0;l<n;l++){
+        int live = st[l]==LANE_RUNNING;
+        int over = live & (counts[l]>=limit);
+        st[l] = pick(over, LANE_LIMIT, st[l]);
+        int at = pick(live & !over, pcs[l], 1024);
+        p = at<p ? at : p;
+      }
+      if(p==1024)break;
+      for(int l=0;l<n && first<0;l++)if(st[l]==LANE_RUNNING && pcs[l]==p)first = l;
+
+      // Which of them have the same instruction there as the first
+      int opcode = mem(p, first);
+      int address = p<1023 ? mem(p+1, first) : 0;
+      int length = opcode>=1 && opcode<=22 ? 2 : 1;
+      int here = n, joined = 0;
+      if(p+length<=1023 && together(opcode, address)){
+        const uint16_t *ops = &memory[(size_t)p*n], *data = &memory[(size_t)(p+1)*n];
+        here = 0;
+        for(int l=0;l<n;l++){
+          int at = (st[l]==LANE_RUNNING) & (pcs[l]==p);
+          int same = at & (ops[l]==opcode) & ((length==1) | (data[l]==address));
+          m[l] = same;
+          pcs[l] = pick(same, p+length, pcs[l]);
+          counts[l] += same;
+          here += at;
+          joined += same;
+        }
+        stepTogether(opcode, address);
+        stepsTogether++;
+        total += joined;
+      }
+      // Everything else at p goes on its own
+      if(joined==here)continue;
+      for(int l=0;l<n;l++){
+        if(st[l]==LANE_RUNNING && pcs[l]==p && (joined==0 || !m[l])){
+          step(l);
+          stepsAlone++;
+          total++;
+        }
+      }
+    }
+    return total;
+  }
+
+  laneState getState(int lane){
+    return (laneState)state[lane];
+  }
+
+  registers getRegisters(int lane){
+    registers regs = {acc[lane], xReg[lane], yReg[lane], pc[lane], zero[lane]!=0, neg[lane]!=0, carry[lane]!=0};
+    return regs;
+  }
+
+  unsigned long instructions(int lane){
+    return count[lane];
+  }
+
+  const std::string &getOutput(int lane){
+    return output[lane];
+  }
+};
+
+#endif
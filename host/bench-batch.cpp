@@ -0,0 +1,118 @@
+/**
+ * Program: bench-batch
+ * Purpose:
+ *   Runs one CECIL program in many lanes of a batch40, and the same runs
+ *   one after another on sim40s, checks that every lane ended the same way
+ *   with the same output as its sim40, and compares the two in instructions
+ *   per second, counted over all the runs. If an address is given, each
+ *   run gets its own input: its number is poked into that address first.
+ *
+ *   Usage: bench-batch file [lanes] [address] [limit]
+ */
+
+#include <Arduino.h>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+bool    trace = false;
+
+#include "sim40.h"
+#include "compiler.h"
+#include "batch40.h"
+
+#define DEFAULT_LANES 256
+#define DEFAULT_LIMIT 1000000UL
+
+compiler Compiler;
+
+/* The laneState a sim40 run that stopped for reason would have ended in */
+laneState endState(stopReason reason){
+  switch(reason){
+    case STOP_HALTED:  return LANE_HALTED;
+    case STOP_ERROR:   return LANE_ERROR;
+    case STOP_WAITING: return LANE_WAITING;
+    default:           return LANE_LIMIT;
+  }
+}
+
+int main(int argc, char *argv[]){
+  if(argc<2){
+    fprintf(stderr, "Usage: %s file [lanes] [address] [limit]\n", argv[0]);
+    return 1;
+  }
+  int           lanes = argc>2 ? atoi(argv[2]) : DEFAULT_LANES;
+  int           address = argc>3 ? atoi(argv[3]) : -1;
+  unsigned long limit = argc>4 ? strtoul(argv[4], NULL, 10) : DEFAULT_LIMIT;
+  std::ifstream file(argv[1]);
+  std::stringstream text;
+  if(!file || lanes<1){
+    fprintf(stderr, "%s: can't read %s\n", argv[0], argv[1]);
+    return 1;
+  }
+  text << file.rdbuf();
+
+  Serial.enabled = false;
+  Compiler.program = text.str().c_str();
+  int sv = Compiler.compile(0);
+  if(sv==-1){
+    fputs(Compiler.output.c_str(), stdout);
+    return 2;
+  }
+
+  // One run after another, each on a fresh sim40
+  std::vector<std::string> outputs(lanes);
+  std::vector<laneState>   states(lanes);
+  unsigned long long       plainTotal = 0;
+  auto start = std::chrono::steady_clock::now();
+  for(int l=0;l<lanes;l++){
+    std::unique_ptr<sim40> sim(new sim40);
+    uint32_t cursor = 0;
+    char     chunk[256];
+    int      got;
+    sim->trace = false;
+    sim->setFastForward(true);
+    sim->loadMem(Compiler.startLoc, Compiler.code, Compiler.endLoc);
+    sim->setStartVector(sv);
+    if(address>=0)sim->loadMem(address, &l, 1);
+    sim->setRunStatus(sim->beginRun());
+    stopReason reason = STOP_BUDGET;
+    while(reason==STOP_BUDGET && sim->instructionCount<limit){
+      reason = sim->run(limit-sim->instructionCount<RUN_BATCH ? limit-sim->instructionCount : RUN_BATCH);
+      while((got = sim->output.read(cursor, chunk, sizeof(chunk)))>0)outputs[l].append(chunk, got);
+    }
+    states[l] = endState(reason);
+    plainTotal += sim->instructionCount;
+  }
+  auto middle = std::chrono::steady_clock::now();
+
+  // All of them at once
+  batch40 batch(lanes);
+  batch.loadMem(Compiler.startLoc, Compiler.code, Compiler.endLoc);
+  batch.setStartVector(sv);
+  for(int l=0;l<lanes && address>=0;l++)batch.poke(l, address, l);
+  batch.beginRun();
+  unsigned long long batchTotal = batch.run(limit);
+  auto end = std::chrono::steady_clock::now();
+
+  int differ = 0;
+  for(int l=0;l<lanes;l++){
+    if(batch.getState(l)!=states[l] || batch.getOutput(l)!=outputs[l]){
+      if(differ++<5)printf("Lane %i differs: state %i, not %i; output %s\n", l, batch.getState(l), states[l],
+        batch.getOutput(l)==outputs[l] ? "the same" : "differs");
+    }
+  }
+
+  double plainSecs = std::chrono::duration<double>(middle-start).count();
+  double batchSecs = std::chrono::duration<double>(end-middle).count();
+  printf("%i lanes, %llu instructions on sim40s, %llu in the batch\n", lanes, plainTotal, batchTotal);
+  printf("%lu steps run together, %lu lane instructions run alone\n", batch.stepsTogether, batch.stepsAlone);
+  printf("sim40s:  %10.0f instructions/s\n", plainTotal/plainSecs);
+  printf("batch40: %10.0f instructions/s (%.1fx)\n", batchTotal/batchSecs, (batchTotal/batchSecs)/(plainTotal/plainSecs));
+  if(differ>0){
+    printf("%i lanes differ\n", differ);
+    return 3;
+  }
+  return 0;
+}
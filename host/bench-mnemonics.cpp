@@ -0,0 +1,72 @@
+/**
+ * Program: bench-mnemonics
+ * Purpose:
+ *   Times the compiler's perfect hash lookup of mnemonics against the
+ *   linear scan it replaced, which copied each word into a String and
+ *   compared it with a table of Strings one by one. Both are run over the
+ *   same words: every mnemonic, plus some words that aren't mnemonics.
+ *
+ *   Usage: bench-mnemonics [rounds]
+ */
+
+#include <Arduino.h>
+#include <chrono>
+
+bool    trace = false;
+
+#include "compiler.h"
+
+#define DEFAULT_ROUNDS 20000
+
+compiler Compiler;
+String   scanTable[MNEMONICS];
+
+/**
+ * scanDecypher()
+ *
+ * The old lookup: a String per word, then String comparisons in order.
+ */
+int scanDecypher(const String &program, token word){
+  String keyword = program.substring(word.start, word.start+word.length);
+  for(int i=0;i<MNEMONICS;i++)if(keyword==scanTable[i])return i;
+  return -1;
+}
+
+int main(int argc, char *argv[]){
+  long rounds = argc>1 ? atol(argv[1]) : DEFAULT_ROUNDS;
+  token words[MNEMONICS+8];
+  int   count = 0;
+  long  checksum = 0;
+
+  Serial.enabled = false;
+  for(int i=0;i<MNEMONICS;i++){
+    scanTable[i] = mnemonics[i];
+    Compiler.program += mnemonics[i];
+    Compiler.program += "\n";
+  }
+  Compiler.program += "insert start loop data1 ld stopp x printchar\n";
+  Compiler.rewind();
+  while(count<MNEMONICS+8 && (words[count] = Compiler.getWord()).length>0)count++;
+
+  // Both must agree before either is worth timing
+  for(int i=0;i<count;i++){
+    if(Compiler.decypher(words[i])!=scanDecypher(Compiler.program, words[i])){
+      printf("Lookups disagree on word %i\n", i);
+      return 1;
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for(long r=0;r<rounds;r++)for(int i=0;i<count;i++)checksum += scanDecypher(Compiler.program, words[i]);
+  auto middle = std::chrono::steady_clock::now();
+  for(long r=0;r<rounds;r++)for(int i=0;i<count;i++)checksum += Compiler.decypher(words[i]);
+  auto end = std::chrono::steady_clock::now();
+
+  double lookups = (double)rounds*count;
+  double scanNs = std::chrono::duration<double, std::nano>(middle-start).count()/lookups;
+  double hashNs = std::chrono::duration<double, std::nano>(end-middle).count()/lookups;
+  printf("%i words x %ld rounds (checksum %ld)\n", count, rounds, checksum);
+  printf("String scan:  %8.1f ns per lookup\n", scanNs);
+  printf("perfect hash: %8.1f ns per lookup (%.1fx)\n", hashNs, scanNs/hashNs);
+  return 0;
+}
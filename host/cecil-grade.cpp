@@ -0,0 +1,451 @@
+/**
+ * Program: cecil-grade
+ * Purpose:
+ *   Marks a class's worth of CECIL programs. Every .cecil file in a
+ *   directory is compiled, and run once for each test in a test spec, on
+ *   sim40s built from the same headers as the ESP32 sketch. Each test
+ *   pokes its inputs into memory, runs the program in fast-forward with a
+ *   limit on the instructions it may take, and checks how it stopped, what
+ *   it printed and what it left in memory. The runs are shared out over
+ *   all the cores by a work-stealing thread pool (see workpool.h), and the
+ *   results written as a JSON report.
+ *
+ *   Usage: cecil-grade [-j threads] [-n limit] [-o report] spec directory
+ *     -j threads  worker threads (default: one per core)
+ *     -n limit    instructions allowed per run, unless the spec says
+ *                 otherwise (default 1000000)
+ *     -o report   write the report to file report rather than stdout
+ *
+ *   A spec is a text file of tests, one directive per line; # starts a
+ *   comment, and text in double quotes may contain \n, \t, \" and \\.
+ *   Memory is named by a label of the program or by an address.
+ *     limit 50000          before any test, the limit for them all; in a
+ *                          test, for that test only
+ *     test  small          starts a test called small
+ *     poke  num1 2         puts 2 in the word at label num1, before the
+ *                          run; more values go in the words after it
+ *     expect total 5       the word at label total should then hold 5
+ *     output "5"           what the program prints should be exactly this
+ *                          (not counting the "Program run concluded")
+ *     status error         how the run should end: halted (the default),
+ *                          error, waiting or limit
+ *
+ *   Exit status: 0 every run passed, 1 bad usage, spec or directory, 2
+ *   some program failed to compile or some run failed.
+ */
+
+#include <Arduino.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <unistd.h>
+
+bool    trace = false;
+
+#include "sim40.h"
+#include "compiler.h"
+#include "workpool.h"
+
+#define DEFAULT_LIMIT 1000000UL
+#define RUN_TRAILER   "\n===\nProgram run concluded\n"
+
+/* Some words of memory, by label or address, and what goes in them */
+typedef struct{
+  std::string      where;
+  std::vector<int> values;
+} memoryWords;
+
+typedef struct{
+  std::string   name;
+  unsigned long limit;
+  std::vector<memoryWords> pokes;
+  std::vector<memoryWords> expects;
+  bool          checkOutput;
+  std::string   output;
+  std::string   status;
+} gradeTest;
+
+typedef struct{
+  bool          passed;
+  std::string   status;
+  unsigned long instructions;
+  std::string   output;
+  std::vector<std::string> failures;
+} gradeResult;
+
+typedef struct{
+  std::string   file;
+  bool          compiled;
+  std::vector<std::string> errors;    // From the compiler, if it failed
+  std::vector<uint16_t>    code;
+  int           startLoc;
+  int           startVector;
+  std::map<std::string, int> labels;  // Those the spec refers to; -1 if missing
+  std::vector<gradeResult> results;   // One per test
+} gradeProgram;
+
+std::vector<gradeTest>    tests;
+std::vector<gradeProgram> programs;
+
+/**
+ * readQuoted()
+ *
+ * Reads a string in double quotes from a spec line, starting at the quote.
+ * @return bool  false if it doesn't end on the line
+ */
+bool readQuoted(const std::string &line, size_t &at, std::string &text){
+  text.clear();
+  for(at++;at<line.length();at++){
+    char c = line[at];
+    if(c=='"'){
+      at++;
+      return true;
+    }
+    if(c=='\\' && at+1<line.length()){
+      c = line[++at];
+      if(c=='n')c = '\n';
+      else if(c=='t')c = '\t';
+      else if(c=='r')c = '\r';
+      else if(c=='0')c = '\0';
+    }
+    text += c;
+  }
+  return false;
+}
+
+/**
+ * splitLine()
+ *
+ * Splits a spec line into words, dropping any comment. A quoted string is
+ * one word, marked by starting with a quote (which is then dropped).
+ * @return bool  false if a quote isn't closed
+ */
+bool splitLine(const std::string &line, std::vector<std::string> &words){
+  size_t at = 0;
+  words.clear();
+  while(at<line.length()){
+    char c = line[at];
+    if(c=='#')break;
+    if(isspace((unsigned char)c)){
+      at++;
+      continue;
+    }
+    std::string word;
+    if(c=='"'){
+      if(!readQuoted(line, at, word))return false;
+      word.insert(0, 1, '"');
+    }
+    else while(at<line.length() && !isspace((unsigned char)line[at]) && line[at]!='#')word += line[at++];
+    words.push_back(word);
+  }
+  return true;
+}
+
+bool readNumber(const std::string &word, long &value){
+  char *end;
+  value = strtol(word.c_str(), &end, 10);
+  return !word.empty() && *end=='\0';
+}
+
+/**
+ * readSpec()
+ *
+ * Reads the tests from a spec file into tests, reporting the first thing
+ * wrong with it on stderr.
+ * @return bool  success
+ */
+bool readSpec(const char *name, unsigned long limit){
+  std::ifstream file(name);
+  std::string   line;
+  std::vector<std::string> words;
+  int           number = 0;
+  if(!file){
+    fprintf(stderr, "cecil-grade: can't read %s\n", name);
+    return false;
+  }
+  while(std::getline(file, line)){
+    number++;
+    std::string problem;
+    long value;
+    if(!splitLine(line, words))problem = "no closing quote";
+    else if(words.empty())continue;
+    else if(words[0]=="test" && words.size()==2){
+      gradeTest test = {words[1], limit, {}, {}, false, "", "halted"};
+      tests.push_back(test);
+    }
+    else if(words[0]=="limit" && words.size()==2 && readNumber(words[1], value) && value>0){
+      if(tests.empty())limit = value;
+      else tests.back().limit = value;
+    }
+    else if(tests.empty())problem = "expected test or limit";
+    else if((words[0]=="poke" || words[0]=="expect") && words.size()>=3 && words[1][0]!='"'){
+      memoryWords patch;
+      patch.where = words[1];
+      for(size_t i=2;i<words.size() && problem.empty();i++){
+        if(readNumber(words[i], value))patch.values.push_back(value & WORD_MASK);
+        else problem = "not a number: "+words[i];
+      }
+      if(words[0]=="poke")tests.back().pokes.push_back(patch);
+      else tests.back().expects.push_back(patch);
+    }
+    else if(words[0]=="output" && words.size()==2 && words[1][0]=='"'){
+      tests.back().checkOutput = true;
+      tests.back().output = words[1].substr(1);
+    }
+    else if(words[0]=="status" && words.size()==2 &&
+      (words[1]=="halted" || words[1]=="error" || words[1]=="waiting" || words[1]=="limit")){
+      tests.back().status = words[1];
+    }
+    else problem = "can't make sense of this";
+    if(!problem.empty()){
+      fprintf(stderr, "%s:%i: %s\n", name, number, problem.c_str());
+      return false;
+    }
+  }
+  if(tests.empty()){
+    fprintf(stderr, "%s: there are no tests in it\n", name);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * addressOf()
+ *
+ * The address a spec names for a program: a label of it, or a number.
+ * @return int  -1 if there is no such label
+ */
+int addressOf(const gradeProgram &program, const std::string &where){
+  long value;
+  if(readNumber(where, value))return value>=0 && value<=1023 ? value : -1;
+  auto found = program.labels.find(where);
+  return found==program.labels.end() ? -1 : found->second;
+}
+
+void runTask(int index, size_t t);
+
+/**
+ * compileTask()
+ *
+ * Compiles a program with the worker's own compiler, notes where the
+ * labels the spec refers to are, and pushes a task for each test.
+ */
+void compileTask(workPool &pool, compiler *compilers, int index, int worker){
+  gradeProgram &program = programs[index];
+  compiler     &comp = compilers[worker];
+  std::ifstream file(program.file);
+  std::stringstream text;
+  text << file.rdbuf();
+  comp.program = text.str().c_str();
+  program.startVector = comp.compile(0);
+  program.compiled = program.startVector!=-1;
+  if(!program.compiled){
+    std::istringstream listing(comp.output.c_str());
+    std::string line;
+    while(std::getline(listing, line))if(line.compare(0, 5, "Line ")==0)program.errors.push_back(line);
+    return;
+  }
+  program.startLoc = comp.startLoc;
+  program.code.assign(comp.code+comp.startLoc, comp.code+comp.endLoc);
+  for(const gradeTest &test : tests){
+    for(const memoryWords &words : test.pokes)program.labels[words.where] = comp.labelLocation(words.where.c_str());
+    for(const memoryWords &words : test.expects)program.labels[words.where] = comp.labelLocation(words.where.c_str());
+  }
+  program.results.resize(tests.size());
+  for(size_t t=0;t<tests.size();t++){
+    pool.push(worker, [index, t](int){ runTask(index, t); });
+  }
+}
+
+/**
+ * runTask()
+ *
+ * Runs one program on one test, on a sim40 of its own, and checks the
+ * result against what the test expects.
+ */
+void runTask(int index, size_t t){
+  gradeProgram    &program = programs[index];
+  const gradeTest &test = tests[t];
+  gradeResult     &result = program.results[t];
+  std::unique_ptr<sim40> sim(new sim40);
+  uint32_t   cursor = 0;
+  char       chunk[256];
+  int        got;
+  stopReason reason = STOP_BUDGET;
+
+  sim->trace = false;
+  sim->setFastForward(true);
+  sim->loadMem(program.startLoc, program.code.data(), program.code.size());
+  sim->setStartVector(program.startVector);
+  for(const memoryWords &words : test.pokes){
+    int address = addressOf(program, words.where);
+    if(address<0)result.failures.push_back("no label "+words.where+" to poke");
+    else if(!sim->loadMem(address, words.values.data(), words.values.size()))
+      result.failures.push_back("can't poke past the end of memory at "+words.where);
+  }
+  sim->setRunStatus(sim->beginRun());
+  while(sim->instructionCount<test.limit){
+    unsigned long left = test.limit-sim->instructionCount;
+    reason = sim->run(left<RUN_BATCH ? left : RUN_BATCH);
+    while((got = sim->output.read(cursor, chunk, sizeof(chunk)))>0)result.output.append(chunk, got);
+    if(reason!=STOP_BUDGET)break;
+  }
+  switch(reason){
+    case STOP_HALTED:  result.status = "halted"; break;
+    case STOP_ERROR:   result.status = "error"; break;
+    case STOP_WAITING: result.status = "waiting"; break;
+    default:           result.status = "limit"; break;
+  }
+  result.instructions = sim->instructionCount;
+
+  // The program's own output is what comes before stop's announcement
+  size_t trailer = strlen(RUN_TRAILER);
+  if(reason==STOP_HALTED && result.output.length()>=trailer &&
+     result.output.compare(result.output.length()-trailer, trailer, RUN_TRAILER)==0)result.output.resize(result.output.length()-trailer);
+  if(result.status!=test.status)result.failures.push_back("ended with "+result.status+", not "+test.status);
+  if(test.checkOutput && result.output!=test.output)result.failures.push_back("printed the wrong output");
+  for(const memoryWords &words : test.expects){
+    int address = addressOf(program, words.where);
+    if(address<0){
+      result.failures.push_back("no label "+words.where+" to check");
+      continue;
+    }
+    for(size_t i=0;i<words.values.size();i++){
+      int value = sim->peekMem((address+i) & 1023);
+      if(value!=words.values[i]){
+        result.failures.push_back(words.where+(i>0 ? "+"+std::to_string(i) : "")+" holds "+
+          std::to_string(value)+", not "+std::to_string(words.values[i]));
+      }
+    }
+  }
+  result.passed = result.failures.empty();
+}
+
+/**
+ * jsonString()
+ *
+ * text as a JSON string. Bytes from 128 up, which a SIM40 can print but
+ * which needn't be UTF-8, are taken as Latin-1.
+ */
+std::string jsonString(const std::string &text){
+  std::string json = "\"";
+  char escaped[8];
+  for(unsigned char c : text){
+    if(c=='"' || c=='\\'){
+      json += '\\';
+      json += c;
+    }
+    else if(c=='\n')json += "\\n";
+    else if(c=='\t')json += "\\t";
+    else if(c<0x20 || c>=0x7f){
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      json += escaped;
+    }
+    else json += c;
+  }
+  return json + "\"";
+}
+
+/**
+ * writeReport()
+ *
+ * The JSON report: each program, with each test's result, and totals.
+ */
+void writeReport(FILE *out, int workers, double seconds, long steals){
+  int runs = 0, passed = 0, compiled = 0;
+  unsigned long long instructions = 0;
+  fprintf(out, "{\n  \"programs\": [");
+  for(size_t p=0;p<programs.size();p++){
+    const gradeProgram &program = programs[p];
+    int programPassed = 0;
+    for(const gradeResult &result : program.results)programPassed += result.passed;
+    compiled += program.compiled;
+    fprintf(out, "%s\n    {\"file\": %s, \"compiled\": %s, \"passed\": %i, \"tests\": %i,", p>0 ? "," : "",
+      jsonString(std::filesystem::path(program.file).filename().string()).c_str(),
+      program.compiled ? "true" : "false", programPassed, (int)tests.size());
+    fprintf(out, "\n     \"errors\": [");
+    for(size_t e=0;e<program.errors.size();e++)fprintf(out, "%s%s", e>0 ? ", " : "", jsonString(program.errors[e]).c_str());
+    fprintf(out, "],\n     \"results\": [");
+    for(size_t t=0;t<program.results.size();t++){
+      const gradeResult &result = program.results[t];
+      runs++;
+      passed += result.passed;
+      instructions += result.instructions;
+      fprintf(out, "%s\n       {\"test\": %s, \"passed\": %s, \"status\": \"%s\", \"instructions\": %lu, \"output\": %s, \"failures\": [",
+        t>0 ? "," : "", jsonString(tests[t].name).c_str(), result.passed ? "true" : "false", result.status.c_str(),
+        result.instructions, jsonString(result.output).c_str());
+      for(size_t f=0;f<result.failures.size();f++)fprintf(out, "%s%s", f>0 ? ", " : "", jsonString(result.failures[f]).c_str());
+      fprintf(out, "]}");
+    }
+    fprintf(out, "]}");
+  }
+  fprintf(out, "\n  ],\n  \"programsCompiled\": %i, \"runs\": %i, \"runsPassed\": %i,\n", compiled, runs, passed);
+  fprintf(out, "  \"threads\": %i, \"steals\": %ld, \"seconds\": %.3f, \"instructions\": %llu, \"instructionsPerSecond\": %.0f\n}\n",
+    workers, steals, seconds, instructions, seconds>0 ? instructions/seconds : 0.0);
+  fprintf(stderr, "%i of %i programs compiled; %i of %i runs passed; %llu instructions in %.3f s on %i threads\n",
+    compiled, (int)programs.size(), passed, runs, instructions, seconds, workers);
+}
+
+int main(int argc, char *argv[]){
+  int           workers = std::thread::hardware_concurrency();
+  unsigned long limit = DEFAULT_LIMIT;
+  const char   *reportFile = NULL;
+  int           option;
+
+  Serial.enabled = false;
+  while((option = getopt(argc, argv, "j:n:o:"))!=-1){
+    switch(option){
+      case 'j': workers = atoi(optarg); break;
+      case 'n': limit = strtoul(optarg, NULL, 10); break;
+      case 'o': reportFile = optarg; break;
+      default:
+        fprintf(stderr, "Usage: %s [-j threads] [-n limit] [-o report] spec directory\n", argv[0]);
+        return 1;
+    }
+  }
+  if(optind!=argc-2 || workers<1 || limit<1){
+    fprintf(stderr, "Usage: %s [-j threads] [-n limit] [-o report] spec directory\n", argv[0]);
+    return 1;
+  }
+  if(!readSpec(argv[optind], limit))return 1;
+
+  std::error_code problem;
+  for(const auto &entry : std::filesystem::directory_iterator(argv[optind+1], problem)){
+    if(entry.is_regular_file() && entry.path().extension()==".cecil"){
+      gradeProgram program;
+      program.file = entry.path().string();
+      program.compiled = false;
+      programs.push_back(program);
+    }
+  }
+  if(problem){
+    fprintf(stderr, "%s: can't read %s\n", argv[0], argv[optind+1]);
+    return 1;
+  }
+  std::sort(programs.begin(), programs.end(), [](const gradeProgram &a, const gradeProgram &b){ return a.file<b.file; });
+
+  workPool pool(workers);
+  std::unique_ptr<compiler[]> compilers(new compiler[workers]);
+  for(size_t p=0;p<programs.size();p++){
+    pool.push(p, [&pool, &compilers, p](int worker){ compileTask(pool, compilers.get(), p, worker); });
+  }
+  auto start = std::chrono::steady_clock::now();
+  pool.run();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+  FILE *out = reportFile ? fopen(reportFile, "w") : stdout;
+  if(!out){
+    fprintf(stderr, "%s: can't write %s\n", argv[0], reportFile);
+    return 1;
+  }
+  writeReport(out, workers, seconds, pool.steals.load());
+  if(reportFile)fclose(out);
+  for(const gradeProgram &program : programs){
+    if(!program.compiled)return 2;
+    for(const gradeResult &result : program.results)if(!result.passed)return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,338 @@
+/**
+ * Program: cecil-host
+ * Purpose:
+ *   Runs CECIL programs on a Linux machine, using the same compiler.h,
+ *   sim40.h and webserver.h as the ESP32 sketch, built against the shims
+ *   in this directory. It compiles a .cecil file, runs it, and sends the
+ *   SIM40's video output to stdout. With -w, it also hands a saved HTTP
+ *   request to the web server code, prints the reply, and carries out the
+ *   command just as loop() does on the board. With -O, the program is
+ *   put through the peephole optimiser, and then run alongside the plain
+ *   version to check that the two behave the same. With -o, the compiled
+ *   program is also saved as an image (see image.h); given an image
+ *   instead of a .cecil file, cecil-host maps it into memory and loads it
+ *   without compiling anything.
+ *
+ *   Usage: cecil-host [-c] [-O] [-o image] [-s] [-t] [-r] [-n count] [-w request] file
+ *     -c          compile only, printing the compiler's listing; for an
+ *                 image, list its header and labels
+ *     -O          optimise; when running, compare with the unoptimised code
+ *     -o image    save the compiled program in file image
+ *     -s          show the serial port (the sketch's debug output) on stderr
+ *     -t          trace each instruction; implies -s
+ *     -r          real time: pause and the timer take as long as on the board
+ *     -n count    give up after count instructions (default 100000000)
+ *     -w request  after the run, service the HTTP request in file request
+ *
+ *   Exit status: 0 the program stopped, 1 bad usage or file, 2 it failed
+ *   to compile (or the image is damaged), 3 run error, 4 it was still running (or waiting for input
+ *   that can't come) when the instruction limit was reached, 5 the
+ *   optimised program did something different from the plain one.
+ */
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PROG    "Cecil"
+
+bool    trace = false; // As in cecil.ino, this has to come before the headers
+
+#include "sim40.h"
+#include "compiler.h"
+#include "webserver.h"
+
+#define DEFAULT_LIMIT 100000000UL
+
+sim40     sim;
+sim40     plain;    // Runs the unoptimised code, for -O to compare with
+compiler  Compiler;
+uint32_t  outputCursor = 0;
+
+bool readFile(const char *name, std::string &text){
+  std::ifstream file(name, std::ios::binary);
+  if(!file)return false;
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+  text = buffer.str();
+  return true;
+}
+
+/**
+ * mapFile()
+ *
+ * Maps a whole file into memory, read only.
+ * @return the mapping, or NULL (also for an empty file)
+ */
+const uint8_t *mapFile(const char *name, size_t &size){
+  struct stat info;
+  int file = open(name, O_RDONLY);
+  if(file<0)return NULL;
+  if(fstat(file, &info)!=0 || info.st_size==0){
+    close(file);
+    return NULL;
+  }
+  size = info.st_size;
+  void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  return mapping==MAP_FAILED ? NULL : (const uint8_t *)mapping;
+}
+
+bool isImage(const uint8_t *data, size_t size){
+  return size>=4 && memcmp(data, "C40I", 4)==0;
+}
+
+/**
+ * listImage()
+ *
+ * Prints an image's header and labels.
+ * @return bool  whether it is a valid image
+ */
+bool listImage(const uint8_t *data, size_t size){
+  imageInfo info;
+  int       offset = 0, location;
+  String    name;
+  if(!image::read(data, size, info))return false;
+  printf("%i words at %i, starting at %i; %i labels\n", info.length, info.loadAddress, info.startVector, info.labelCount);
+  while(image::label(info, offset, location, name))printf("%5i %s\n", location, name.c_str());
+  return true;
+}
+
+/**
+ * saveImage()
+ *
+ * Writes an image of what the compiler last compiled to a file.
+ */
+bool saveImage(const char *name){
+  std::string data(Compiler.imageSize(), 0);
+  Compiler.writeImage((uint8_t *)&data[0]);
+  std::ofstream file(name, std::ios::binary);
+  file.write(data.data(), data.length());
+  return file.good();
+}
+
+/**
+ * flushOutput()
+ *
+ * Copies any new video output from a machine to stdout, or, if capture is
+ * given, onto the end of that instead.
+ */
+void flushOutput(sim40 &machine, uint32_t &cursor, std::string *capture = NULL){
+  char chunk[256];
+  int  count;
+  while((count = machine.output.read(cursor, chunk, sizeof(chunk)))>0){
+    if(capture)capture->append(chunk, count);
+    else fwrite(chunk, 1, count, stdout);
+  }
+  if(!capture)fflush(stdout);
+}
+
+/**
+ * compileProgram()
+ *
+ * Compiles text and loads it into a SIM40, as the SIM40 task does for
+ * the board. The compiler's listing only goes to the video output if
+ * listing is set.
+ * @return bool success
+ */
+bool compileProgram(sim40 &machine, const String &text, bool listing){
+  int sv;
+  Compiler.program = text;
+  sv = Compiler.compile(machine.getStartVector());
+  if(sv==-1 || listing){
+    machine.output.write(Compiler.output.c_str());
+    if(sv==-1)return false;
+  }
+  machine.setStartVector(sv);
+  if(!machine.loadMem(Compiler.startLoc, Compiler.code, Compiler.endLoc)){
+    Serial.println("Oops! Memory write failed");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * runProgram()
+ *
+ * Runs a machine from its start vector until the program stops, or limit
+ * instructions have been run, passing its output to flushOutput() as it
+ * goes.
+ * @return stopReason
+ */
+stopReason runProgram(sim40 &machine, uint32_t &cursor, std::string *capture, unsigned long limit, bool realTime){
+  stopReason    reason = STOP_BUDGET;
+  unsigned long start = machine.instructionCount;
+  machine.setFastForward(!realTime);
+  machine.setRunStatus(machine.beginRun());
+  while(machine.instructionCount-start<limit){
+    reason = machine.run(RUN_BATCH);
+    flushOutput(machine, cursor, capture);
+    if(reason==STOP_HALTED || reason==STOP_ERROR)break;
+    // In real time, a paused program is waiting for the clock to catch up;
+    // in fast-forward, it can only be waiting for input that won't come
+    if(reason==STOP_WAITING){
+      if(!realTime)break;
+      delay(1);
+    }
+  }
+  machine.setRunStatus(false);
+  return reason;
+}
+
+/**
+ * compareOptimised()
+ *
+ * Runs the optimised program already in sim, and the same program compiled
+ * without optimising in plain, and checks that they stop for the same
+ * reason having produced the same output. The optimised run's output goes
+ * to stdout; how the two compare goes to stderr.
+ * @param  stopReason reason  Set to why the optimised run stopped
+ * @return bool       whether the two agreed
+ */
+bool compareOptimised(const String &text, unsigned long limit, bool realTime, stopReason &reason){
+  std::string   optimisedOutput, plainOutput;
+  uint32_t      plainCursor = plain.output.cursor();
+  int           optimisedWords = Compiler.endLoc;
+
+  Compiler.optimise = false;
+  bool compiled = compileProgram(plain, text, false);
+  Compiler.optimise = true;
+  if(!compiled){
+    fprintf(stderr, "The unoptimised program failed to compile\n");
+    return false;
+  }
+  int plainWords = Compiler.endLoc;
+  reason = runProgram(sim, outputCursor, &optimisedOutput, limit, realTime);
+  stopReason plainReason = runProgram(plain, plainCursor, &plainOutput, limit, realTime);
+  fwrite(optimisedOutput.data(), 1, optimisedOutput.length(), stdout);
+  fflush(stdout);
+  fprintf(stderr, "Optimised: %i words instead of %i, %lu instructions run instead of %lu\n",
+    optimisedWords, plainWords, sim.instructionCount, plain.instructionCount);
+  if(reason!=plainReason || optimisedOutput!=plainOutput){
+    fprintf(stderr, "Optimised program behaved differently: stopped with %i, not %i; output %s\n",
+      reason, plainReason, optimisedOutput==plainOutput ? "the same" : "differs");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * serviceRequest()
+ *
+ * Feeds the request in a file to serviceWebRequest(), prints the reply,
+ * and then acts on the resulting command the way loop() does.
+ */
+int serviceRequest(const std::string &request, unsigned long limit, bool realTime){
+  WiFiClient client(request);
+  String program = Compiler.program;
+  uint16_t memory[1024];
+  for(int i=0;i<1024;i++)memory[i] = sim.peekMem(i);
+  simView view = {memory, 1024, sim.getRegisters(), -1, &sim.output, false, 0, NULL, false};
+  String command = serviceWebRequest(client, program, view);
+  fwrite(client.response().data(), 1, client.response().length(), stdout);
+  if(command=="compile"){
+    if(!compileProgram(sim, progUpdate, true)){
+      flushOutput(sim, outputCursor);
+      return 2;
+    }
+  }
+  if(command=="clear")sim.output.clear();
+  if(command=="key")sim.keyPress(webKey);
+  if(command=="run"){
+    outputCursor = sim.output.cursor();
+    stopReason reason = runProgram(sim, outputCursor, NULL, limit, realTime);
+    if(reason==STOP_ERROR)return 3;
+    if(reason!=STOP_HALTED)return 4;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]){
+  bool          compileOnly = false;
+  bool          compare = false;
+  bool          realTime = false;
+  unsigned long limit = DEFAULT_LIMIT;
+  const char   *requestFile = NULL;
+  const char   *imageFile = NULL;
+  int           option;
+  std::string   text;
+  const uint8_t *mapped;
+  size_t        size;
+
+  Serial.enabled = false;
+  while((option = getopt(argc, argv, "cOo:strn:w:"))!=-1){
+    switch(option){
+      case 'c': compileOnly = true; break;
+      case 'O': Compiler.optimise = compare = true; break;
+      case 'o': imageFile = optarg; break;
+      case 's': Serial.enabled = true; break;
+      case 't': trace = true; Serial.enabled = true; break;
+      case 'r': realTime = true; break;
+      case 'n': limit = strtoul(optarg, NULL, 10); break;
+      case 'w': requestFile = optarg; break;
+      default:
+        fprintf(stderr, "Usage: %s [-c] [-O] [-o image] [-s] [-t] [-r] [-n count] [-w request] file\n", argv[0]);
+        return 1;
+    }
+  }
+  if(optind!=argc-1){
+    fprintf(stderr, "Usage: %s [-c] [-O] [-o image] [-s] [-t] [-r] [-n count] [-w request] file\n", argv[0]);
+    return 1;
+  }
+  // An empty file can't be mapped, but is still a (failing) program
+  if((mapped = mapFile(argv[optind], size))==NULL && !readFile(argv[optind], text)){
+    fprintf(stderr, "%s: can't read %s\n", argv[0], argv[optind]);
+    return 1;
+  }
+  sim.trace = plain.trace = trace;
+
+  if(mapped && isImage(mapped, size)){
+    if(compare || imageFile){
+      fprintf(stderr, "%s: -O and -o need a .cecil file\n", argv[0]);
+      return 1;
+    }
+    bool loaded = compileOnly ? listImage(mapped, size) : sim.loadImage(mapped, size);
+    munmap((void *)mapped, size);
+    if(!loaded){
+      fprintf(stderr, "%s: %s is a damaged image\n", argv[0], argv[optind]);
+      return 2;
+    }
+    if(compileOnly)return 0;
+  }
+  else{
+    if(mapped){
+      text.assign((const char *)mapped, size);
+      munmap((void *)mapped, size);
+    }
+    bool compiled = compileProgram(sim, String(text), compileOnly);
+    flushOutput(sim, outputCursor);
+    if(!compiled)return 2;
+    if(imageFile && !saveImage(imageFile)){
+      fprintf(stderr, "%s: can't write %s\n", argv[0], imageFile);
+      return 1;
+    }
+    if(compileOnly)return 0;
+  }
+
+  stopReason reason;
+  if(compare){
+    if(!compareOptimised(String(text), limit, realTime, reason))return 5;
+  }
+  else reason = runProgram(sim, outputCursor, NULL, limit, realTime);
+  if(requestFile){
+    std::string request;
+    if(!readFile(requestFile, request)){
+      fprintf(stderr, "%s: can't read %s\n", argv[0], requestFile);
+      return 1;
+    }
+    return serviceRequest(request, limit, realTime);
+  }
+  if(reason==STOP_ERROR)return 3;
+  if(reason!=STOP_HALTED)return 4;
+  return 0;
+}
@@ -0,0 +1,130 @@
+/**
+ * Program: make-assets
+ * Purpose:
+ *   Turns the files of the web page (in web) into cecil/webassets.h, for
+ *   the ESP32 to serve from flash. Each file is gzipped, as browsers can
+ *   take it, and given a strong ETag made from a hash of what is sent, so
+ *   a browser that already has it is told 304 Not Modified instead. The
+ *   header is kept in the repository, so the Arduino IDE needn't run this;
+ *   after changing the page, run
+ *
+ *     cmake --build build --target web-assets
+ *
+ *   Usage: make-assets header file...
+ *   index.html is served as /; every other file as /its-name.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+typedef struct{
+  const char *extension;
+  const char *type;
+} mimeType;
+
+const mimeType mimeTypes[] = {
+  {".html", "text/html; charset=utf-8"},
+  {".css",  "text/css"},
+  {".js",   "text/javascript"},
+  {".svg",  "image/svg+xml"},
+  {".ico",  "image/x-icon"},
+};
+
+const char *typeOf(const std::string &name){
+  for(const mimeType &mime : mimeTypes){
+    size_t length = strlen(mime.extension);
+    if(name.length()>length && name.compare(name.length()-length, length, mime.extension)==0)return mime.type;
+  }
+  return "application/octet-stream";
+}
+
+/**
+ * gzip()
+ *
+ * text, compressed as hard as zlib can, in gzip form. The gzip header has
+ * no time or name in it, so the same file always comes out the same.
+ */
+bool gzip(const std::string &text, std::vector<uint8_t> &packed){
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if(deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15+16, 9, Z_DEFAULT_STRATEGY)!=Z_OK)return false;
+  packed.resize(deflateBound(&stream, text.length())+32);
+  stream.next_in = (Bytef *)text.data();
+  stream.avail_in = text.length();
+  stream.next_out = packed.data();
+  stream.avail_out = packed.size();
+  int result = deflate(&stream, Z_FINISH);
+  packed.resize(stream.total_out);
+  deflateEnd(&stream);
+  return result==Z_STREAM_END;
+}
+
+uint64_t fnv1a(const std::vector<uint8_t> &data){
+  uint64_t hash = 14695981039346656037ULL;
+  for(uint8_t b : data)hash = (hash ^ b) * 1099511628211ULL;
+  return hash;
+}
+
+int main(int argc, char *argv[]){
+  if(argc<3){
+    fprintf(stderr, "Usage: %s header file...\n", argv[0]);
+    return 1;
+  }
+  std::ostringstream arrays, table;
+  for(int f=2;f<argc;f++){
+    std::ifstream file(argv[f], std::ios::binary);
+    std::stringstream text;
+    if(!file){
+      fprintf(stderr, "%s: can't read %s\n", argv[0], argv[f]);
+      return 1;
+    }
+    text << file.rdbuf();
+    std::vector<uint8_t> packed;
+    if(!gzip(text.str(), packed)){
+      fprintf(stderr, "%s: can't compress %s\n", argv[0], argv[f]);
+      return 1;
+    }
+    std::string name = argv[f];
+    size_t slash = name.find_last_of('/');
+    if(slash!=std::string::npos)name = name.substr(slash+1);
+    std::string path = name=="index.html" ? "/" : "/"+name;
+    char etag[24];
+    snprintf(etag, sizeof(etag), "%016llx", (unsigned long long)fnv1a(packed));
+
+    arrays << "\n/* " << name << ": " << text.str().length() << " bytes, " << packed.size() << " gzipped */\n";
+    arrays << "const uint8_t webAsset" << f-2 << "[] PROGMEM = {";
+    for(size_t i=0;i<packed.size();i++){
+      char byte[8];
+      snprintf(byte, sizeof(byte), "0x%02x", packed[i]);
+      arrays << (i%16==0 ? "\n  " : "") << byte << (i+1<packed.size() ? "," : "");
+    }
+    arrays << "\n};\n";
+    table << "  {\"" << path << "\", \"" << typeOf(name) << "\", \"\\\"" << etag << "\\\"\", webAsset"
+          << f-2 << ", " << packed.size() << "},\n";
+    fprintf(stderr, "%s: %zu bytes, %zu gzipped, served as %s\n", name.c_str(), text.str().length(), packed.size(), path.c_str());
+  }
+
+  FILE *out = fopen(argv[1], "w");
+  if(!out){
+    fprintf(stderr, "%s: can't write %s\n", argv[0], argv[1]);
+    return 1;
+  }
+  fprintf(out, "/**\n"
+               " * The web page, gzipped, for serving from flash\n"
+               " *\n"
+               " * Made by host/make-assets from the files in web; don't edit it, but\n"
+               " * change those and run make-assets again. See webserver.h.\n"
+               " */\n\n"
+               "#ifndef CECIL_WEBASSETS_H\n"
+               "#define CECIL_WEBASSETS_H\n");
+  fputs(arrays.str().c_str(), out);
+  fprintf(out, "\nconst webAsset webAssets[] = {\n%s};\n\n#define WEB_ASSETS %i\n\n#endif\n", table.str().c_str(), argc-2);
+  fclose(out);
+  return 0;
+}
@@ -0,0 +1,113 @@
+/**
+ * Class definition for a work-stealing thread pool on the host
+ *
+ * Each worker thread has a deque of tasks of its own. It takes tasks from
+ * the back of its own deque, newest first, so that a task and the tasks
+ * it pushes are done together while their data is still in the cache;
+ * when its deque is empty, it steals the oldest task from another worker,
+ * trying each in turn from a random one. Tasks are given the number of the
+ * worker running them, so that each worker can keep its own things to work
+ * with (a compiler, say) without any locking. run() returns once every
+ * task, including those pushed by other tasks, is done.
+ */
+
+#ifndef CECIL_WORKPOOL_H
+#define CECIL_WORKPOOL_H
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+typedef std::function<void(int worker)> poolTask;
+
+class workPool
+{
+  private:
+  struct taskDeque{
+    std::mutex           lock;
+    std::deque<poolTask> tasks;
+  };
+  std::vector<std::unique_ptr<taskDeque>> deques;
+  std::atomic<long> pending{0};     // Tasks pushed but not yet finished
+
+  bool take(int worker, poolTask &task){
+    taskDeque &own = *deques[worker];
+    std::lock_guard<std::mutex> hold(own.lock);
+    if(own.tasks.empty())return false;
+    task = std::move(own.tasks.back());
+    own.tasks.pop_back();
+    return true;
+  }
+
+  bool steal(int worker, int first, poolTask &task){
+    int count = deques.size();
+    for(int i=0;i<count;i++){
+      int victim = (first+i)%count;
+      if(victim==worker)continue;
+      taskDeque &other = *deques[victim];
+      std::lock_guard<std::mutex> hold(other.lock);
+      if(other.tasks.empty())continue;
+      task = std::move(other.tasks.front());
+      other.tasks.pop_front();
+      steals++;
+      return true;
+    }
+    return false;
+  }
+
+  void work(int worker){
+    std::minstd_rand pick(worker+1);
+    poolTask task;
+    while(pending.load()>0){
+      if(take(worker, task) || steal(worker, pick()%deques.size(), task)){
+        task(worker);
+        task = nullptr;
+        pending.fetch_sub(1);
+      }
+      else std::this_thread::yield();
+    }
+  }
+
+  public:
+  std::atomic<long> steals{0};      // Tasks taken from another worker
+
+  workPool(int workers) : deques(workers>0 ? workers : 1) {
+    for(auto &d : deques)d.reset(new taskDeque);
+  }
+
+  int workers(){
+    return deques.size();
+  }
+
+  /**
+   * push
+   *
+   * Adds a task to a worker's deque: before run(), to share the work out,
+   * and from a running task, to its own worker's.
+   */
+  void push(int worker, poolTask task){
+    pending.fetch_add(1);
+    taskDeque &own = *deques[worker % deques.size()];
+    std::lock_guard<std::mutex> hold(own.lock);
+    own.tasks.push_back(std::move(task));
+  }
+
+  /**
+   * run
+   *
+   * Runs every task on the pool's threads, and waits until all are done.
+   */
+  void run(){
+    std::vector<std::thread> threads;
+    for(int i=1;i<workers();i++)threads.emplace_back(&workPool::work, this, i);
+    work(0);
+    for(auto &t : threads)t.join();
+  }
+};
+
+#endif
@@ -0,0 +1,156 @@
+/**
+ * Test: compiler
+ * Purpose:
+ *   The compiler is used over and over for the same session, with its
+ *   symbol table kept (and perhaps grown) from one compile to the next.
+ *   Nothing left over from an earlier compile may change the result. This
+ *   makes a run of random edits to a program, compiling each version with
+ *   the same compiler and with a new one, and checks that the two give the
+ *   same listing, errors, code and start vector. The kept compiler reads
+ *   only the lines it hasn't seen before, and replays the rest from its
+ *   line cache, so this also checks that it does reuse them. It also
+ *   checks that labels that are never defined are reported in the order
+ *   they were first used.
+ *
+ *   Exit status: 0 all well, 1 something differs.
+ */
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+
+bool    trace = false;
+
+#include "sim40.h"
+#include "compiler.h"
+
+#define EDITS 500     // Versions of the program compiled
+
+/* Lines the edits are made from: labels defined and used, and mistakes */
+const char *pool[] = {
+  ".start  load a",
+  "        add b",
+  "        store c",
+  "        jump start",
+  "        jizero d",
+  ".a      insert 5",
+  ".b      insert 7",
+  ".c      insert 0",
+  ".d      stop",
+  ".e      print",
+  "        load e",
+  "        load f",
+  "        printd g",
+  "        nop",
+  "        bogus",
+  "        insert 12",
+  "; a comment",
+  "",
+  ".a      nop",
+  ".start  nop",
+  "        load",
+  "        insert",
+  ".f",
+  ".g      load a .h store c",
+  "        jump start ; back to the start",
+};
+#define POOL_SIZE (int)(sizeof(pool)/sizeof(pool[0]))
+
+uint32_t seed = 12345;
+
+int randomNumber(int below){
+  seed = seed*1103515245UL+12345;
+  return (seed>>16)%below;
+}
+
+String source(const std::vector<std::string> &lines){
+  String text = "program edits\nauthor test\ndate today\n";
+  for(const std::string &line : lines)text += String(line.c_str()) + "\n";
+  return text + ";---end of code---\n";
+}
+
+/* What a compile gave, to compare */
+std::string result(compiler &comp, const String &text){
+  comp.program = text;
+  int start = comp.compile(0);
+  std::string got = comp.output.c_str();
+  got += "start " + std::to_string(start) + ", errors " + std::to_string(comp.errors) + "\n";
+  if(start!=-1)for(int i=comp.startLoc;i<comp.endLoc;i++)got += std::to_string(comp.code[i]) + " ";
+  return got;
+}
+
+/* Each version compiled by one compiler, kept throughout, and a new one */
+int checkEdits(){
+  compiler kept;
+  std::vector<std::string> lines = {".start  load a", "        add b", "        store c", "        stop",
+                                    ".a      insert 5", ".b      insert 7", ".c      insert 0"};
+  int read = 0, reused = 0;
+  for(int n=0;n<EDITS;n++){
+    int at = randomNumber(lines.size()+1);
+    switch(randomNumber(3)){
+      case 0:
+        lines.insert(lines.begin()+at, pool[randomNumber(POOL_SIZE)]);
+        break;
+      case 1:
+        if(at<(int)lines.size())lines.erase(lines.begin()+at);
+        break;
+      default:
+        if(at<(int)lines.size())lines[at] = pool[randomNumber(POOL_SIZE)];
+        break;
+    }
+    String text = source(lines);
+    compiler fresh;
+    std::string expected = result(fresh, text);
+    if(result(kept, text)!=expected){
+      printf("Edit %i: recompiling gives something different from a new compiler for\n%s", n, text.c_str());
+      return 1;
+    }
+    read += kept.linesRead;
+    reused += kept.linesReused;
+  }
+  // A program without errors, compiled again unchanged, should come
+  // from the cache entirely; lines that gave errors are always read
+  compiler again;
+  String text = source({".start  load a", "        add b", ".g      load a .h store c", "        load", "a",
+                        "        stop", ".a      insert 5", ".b      insert", "7", ".c      insert 0"});
+  result(again, text);
+  result(again, text);
+  if(again.linesReused!=again.linesRead || reused==0){
+    printf("The line cache isn't being used: %i of %i lines reused, then %i of %i\n", reused, read,
+           again.linesReused, again.linesRead);
+    return 1;
+  }
+  printf("%i edits compile the same as from scratch, with %i of %i lines from the cache\n", EDITS, reused, read);
+  return 0;
+}
+
+/* Undefined labels come out in source order, after a big program has
+   grown the symbol table */
+int checkLabelOrder(){
+  compiler comp;
+  std::vector<std::string> lines;
+  for(int i=0;i<200;i++)lines.push_back(".l" + std::to_string(i) + "    insert " + std::to_string(i));
+  result(comp, source(lines));
+  const char *names[] = {"zulu", "alpha", "mike", "bravo", "yankee", "charlie", "xray", "delta"};
+  lines.clear();
+  for(const char *name : names)lines.push_back(std::string("        load ") + name);
+  lines.push_back("        load alpha");
+  lines.push_back("        stop");
+  result(comp, source(lines));
+  std::string listing = comp.output.c_str(), expected, got;
+  for(const char *name : names)expected += std::string("Label not found: ") + name + "\n";
+  for(size_t at=0;(at = listing.find("Label not found: ", at))!=std::string::npos;at = listing.find('\n', at)+1)
+    got += listing.substr(at, listing.find('\n', at)+1-at);
+  if(got!=expected){
+    printf("Undefined labels reported as\n%sand not as\n%s", got.c_str(), expected.c_str());
+    return 1;
+  }
+  printf("Undefined labels are reported in the order they are used\n");
+  return 0;
+}
+
+int main(){
+  Serial.enabled = false;
+  int failures = checkEdits()+checkLabelOrder();
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,337 @@
+/**
+ * Test: engines
+ * Purpose:
+ *   The SIM40 has several ways of running a program: doInstruction() one
+ *   instruction at a time, runThreaded() with and without trace, the block
+ *   cache in runBlocks(), run() on top of that, and step(). They must all
+ *   give exactly the same results. This runs a set of programs, some of
+ *   which rewrite their own code, through each of them, and checks that
+ *   the registers, memory, output, how the run stopped and how many
+ *   instructions it took all agree with doInstruction().
+ *
+ *   Exit status: 0 all agree, 1 something differs or failed to compile.
+ */
+
+#include <Arduino.h>
+#include <string>
+#include <vector>
+
+bool    trace = false;
+
+#include "sim40.h"
+#include "compiler.h"
+
+#define LIMIT 20000   // Instructions a program may take
+
+typedef struct{
+  const char *name;
+  const char *source;
+} testProgram;
+
+const testProgram programs[] = {
+  // Prints the letters A to Z, then how far it got
+  {"count",
+   ".start  load c\n"
+   "        add one\n"
+   "        store c\n"
+   "        printch\n"
+   "        comp last\n"
+   "        jizero done\n"
+   "        jump start\n"
+   ".done   print\n"
+   "        stop\n"
+   ".c      insert 64\n"
+   ".one    insert 1\n"
+   ".last   insert 90\n"},
+  // Rewrites the instruction straight after the store, in the same block,
+  // turning it from a nop into a printch and back each time round
+  {"patch-opcode",
+   ".start  load code\n"
+   "        store slot\n"
+   ".slot   nop\n"
+   "        load code\n"
+   "        eor flip\n"
+   "        store code\n"
+   "        load count\n"
+   "        sub one\n"
+   "        store count\n"
+   "        jizero done\n"
+   "        jump start\n"
+   ".done   stop\n"
+   ".code   insert 39\n"
+   ".flip   insert 21\n"
+   ".count  insert 40\n"
+   ".one    insert 1\n"},
+  // Rewrites the operand of a load, to print the program's own words
+  {"patch-operand",
+   ".start  load ptr\n"
+   "        store opnd\n"
+   "        insert 1\n"
+   ".opnd   insert 0\n"
+   "        print\n"
+   "        load ptr\n"
+   "        add one\n"
+   "        store ptr\n"
+   "        comp end\n"
+   "        jizero done\n"
+   "        jump start\n"
+   ".done   stop\n"
+   ".ptr    insert 0\n"
+   ".one    insert 1\n"
+   ".end    insert 40\n"},
+  // Rewrites a jump's target while the block holding it is cached
+  {"patch-jump",
+   ".start  load count\n"
+   "        cset\n"
+   "        sub one\n"
+   "        store count\n"
+   "        comp zero\n"
+   "        jizero done\n"
+   "        and one\n"
+   "        jizero even\n"
+   "        load oddat\n"
+   "        store target\n"
+   "        jump go\n"
+   ".even   load evenat\n"
+   "        store target\n"
+   ".go     insert 8\n"
+   ".target insert 0\n"
+   ".odd    load o\n"
+   "        printch\n"
+   "        jump start\n"
+   ".evn    load e\n"
+   "        printch\n"
+   "        jump start\n"
+   ".done   stop\n"
+   ".count  insert 30\n"
+   ".one    insert 1\n"
+   ".o      insert 79\n"
+   ".e      insert 69\n"
+   ".zero   insert 0\n"
+   ".oddat  insert 27\n"
+   ".evenat insert 32\n"},
+  // Subroutines, the stacks, the registers, shifts, logic and loadmx
+  {"registers",
+   ".start  xload three\n"
+   ".loop   jmptosr sub\n"
+   "        xdec\n"
+   "        xcomp zero\n"
+   "        jizero next\n"
+   "        jump loop\n"
+   ".next   load big\n"
+   "        lshift\n"
+   "        jicarry carry\n"
+   "        jump nocarry\n"
+   ".carry  load one\n"
+   "        printch\n"
+   ".nocarry rshift\n"
+   "        printb\n"
+   "        yload three\n"
+   "        yinc\n"
+   "        swapay\n"
+   "        print\n"
+   "        swapxy\n"
+   "        swapax\n"
+   "        print\n"
+   "        xload far\n"
+   "        loadmx three\n"
+   "        print\n"
+   "        push\n"
+   "        xpush\n"
+   "        ypush\n"
+   "        ypull\n"
+   "        xpull\n"
+   "        pull\n"
+   "        printd three\n"
+   "        cset\n"
+   "        cclear\n"
+   "        or big\n"
+   "        eor three\n"
+   "        print\n"
+   "        stop\n"
+   ".sub    loadmx table\n"
+   "        print\n"
+   "        return\n"
+   ".table  insert 11\n"
+   "        insert 22\n"
+   "        insert 33\n"
+   "        insert 44\n"
+   ".three  insert 3\n"
+   "        insert 2\n"
+   ".zero   insert 0\n"
+   ".one    insert 1\n"
+   ".big    insert 700\n"
+   ".far    insert 1020\n"},
+  // Turns interrupts on and off with nothing to take, and stores to INT_ENABLE
+  {"intenable",
+   ".start  intenable\n"
+   "        load one\n"
+   "        intdisable\n"
+   "        store count\n"
+   "        load count\n"
+   "        print\n"
+   "        stop\n"
+   ".count  insert 5\n"
+   ".one    insert 1\n"},
+  // Runs into an instruction that doesn't exist
+  {"unknown",
+   ".start  load one\n"
+   "        print\n"
+   "        insert 60\n"
+   "        stop\n"
+   ".one    insert 1\n"},
+  // Puts nops at the top of memory, jumps to them and runs off the end
+  {"overflow",
+   ".start  load nop\n"
+   "        insert 2\n"
+   "        insert 1022\n"
+   "        insert 2\n"
+   "        insert 1023\n"
+   "        insert 8\n"
+   "        insert 1022\n"
+   ".nop    insert 50\n"},
+  // Prints the number in the last word of memory, whose high word wraps
+  // round to address 0
+  {"printd-top",
+   ".start  load big\n"
+   "        insert 2\n"
+   "        insert 1023\n"
+   "        insert 22\n"
+   "        insert 1023\n"
+   "        stop\n"
+   ".big    insert 700\n"},
+  // Never stops, so the limit ends it
+  {"forever",
+   ".start  load c\n"
+   "        add one\n"
+   "        store c\n"
+   "        jump start\n"
+   ".c      insert 0\n"
+   ".one    insert 1\n"},
+};
+
+typedef enum{
+  ENGINE_INSTRUCTION,
+  ENGINE_THREADED,
+  ENGINE_TRACED,
+  ENGINE_BLOCKS,
+  ENGINE_RUN,
+  ENGINE_STEP,
+  ENGINES
+} engine;
+
+const char *engineNames[ENGINES] = {"doInstruction", "runThreaded", "runThreaded<true>", "runBlocks", "run", "step"};
+
+typedef struct{
+  registers     regs;
+  uint16_t      memory[1024];
+  std::string   output;
+  stopReason    reason;
+  unsigned long count;
+} result;
+
+/* A program's code and start vector, compiled once */
+typedef struct{
+  int                   startLoc;
+  int                   startVector;
+  std::vector<uint16_t> code;
+} compiled;
+
+compiler comp;
+
+bool compileProgram(const testProgram &test, compiled &program){
+  comp.program = String("program ") + test.name + "\nauthor test\ndate today\n" + test.source + ";---end of code---\n";
+  program.startVector = comp.compile(0);
+  if(program.startVector==-1){
+    printf("%s failed to compile:\n%s\n", test.name, comp.output.c_str());
+    return false;
+  }
+  program.startLoc = comp.startLoc;
+  program.code.assign(comp.code+comp.startLoc, comp.code+comp.endLoc);
+  return true;
+}
+
+void runOn(engine which, const compiled &program, result &out){
+  sim40   *sim = new sim40;
+  uint32_t count = 0, ran;
+  sim->loadMem(program.startLoc, program.code.data(), program.code.size());
+  sim->setStartVector(program.startVector);
+  sim->setFastForward(true);
+  sim->beginRun();
+  switch(which){
+    case ENGINE_INSTRUCTION:
+      for(;sim->getRunStatus() && count<LIMIT;count++)sim->doInstruction();
+      break;
+    case ENGINE_THREADED:
+    case ENGINE_TRACED:
+    case ENGINE_BLOCKS:
+      // In small budgets, so that runs end in the middle of blocks
+      for(uint32_t budget=1;sim->getRunStatus() && count<LIMIT;budget = budget%13+1){
+        if(budget>LIMIT-count)budget = LIMIT-count;
+        if(which==ENGINE_THREADED)ran = sim->runThreaded<false>(budget);
+        else if(which==ENGINE_TRACED)ran = sim->runThreaded<true>(budget);
+        else ran = sim->runBlocks(budget);
+        if(ran==0)break;
+        count += ran;
+      }
+      break;
+    case ENGINE_RUN:
+      sim->run(LIMIT);
+      count = sim->instructionCount;
+      break;
+    case ENGINE_STEP:
+      sim->setRunStatus(false);
+      for(stopReason reason=STOP_BUDGET;reason==STOP_BUDGET && count<LIMIT;){
+        reason = sim->step();
+        count = sim->instructionCount;
+      }
+      if(count>=LIMIT)sim->setRunStatus(true);  // As the other engines leave it
+      break;
+    default:
+      break;
+  }
+  out.regs = sim->getRegisters();
+  for(int i=0;i<1024;i++)out.memory[i] = sim->peekMem(i);
+  out.output.assign(sim->output.text().c_str(), sim->output.cursor()-sim->output.oldest());
+  out.reason = sim->run(0);
+  out.count = count;
+  delete sim;
+}
+
+bool sameRegisters(const registers &a, const registers &b){
+  return a.acc==b.acc && a.xReg==b.xReg && a.yReg==b.yReg && a.progCounter==b.progCounter &&
+         a.zeroFlag==b.zeroFlag && a.negFlag==b.negFlag && a.carryFlag==b.carryFlag;
+}
+
+int main(){
+  int      failures = 0;
+  compiled program;
+  result  *expected = new result, *got = new result;
+  Serial.enabled = false;
+  for(const testProgram &test : programs){
+    if(!compileProgram(test, program)){
+      failures++;
+      continue;
+    }
+    runOn(ENGINE_INSTRUCTION, program, *expected);
+    for(int e=ENGINE_INSTRUCTION+1;e<ENGINES;e++){
+      runOn((engine)e, program, *got);
+      std::string wrong;
+      if(!sameRegisters(got->regs, expected->regs))wrong += " registers";
+      if(memcmp(got->memory, expected->memory, sizeof(got->memory))!=0)wrong += " memory";
+      if(got->output!=expected->output)wrong += " output";
+      if(got->reason!=expected->reason)wrong += " stop reason";
+      if(got->count!=expected->count)wrong += " instruction count (" + std::to_string(got->count) + ", not " + 
+                                              std::to_string(expected->count) + ")";
+      if(wrong.length()>0){
+        printf("%s: %s differs from doInstruction in%s\n", test.name, engineNames[e], wrong.c_str());
+        failures++;
+      }
+    }
+    printf("%s: %lu instructions, stopped with %i\n", test.name, expected->count, expected->reason);
+  }
+  delete expected;
+  delete got;
+  printf(failures ? "%i differences\n" : "All engines agree\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,127 @@
+/**
+ * Test: httprequest
+ * Purpose:
+ *   Feeds requests to an httpRequest in pieces of random sizes, as they
+ *   might come off the network, and checks what it makes of them: that a
+ *   program sent as a form, as plain text or in the old GET query comes
+ *   out exactly as it was typed, and that requests that are malformed,
+ *   too big, or sent to /compile without a program are answered with the
+ *   right status.
+ *
+ *   Exit status: 0 all well, 1 something was wrong.
+ */
+
+#include <Arduino.h>
+#include <string>
+
+#include "httprequest.h"
+
+#define SEEDS 40      // Ways of cutting up each request
+
+/* A program with everything in it that needs escaping, and CR LF endings */
+const char *typed = "program t\r\n; 100% of chars: & = + ? # / \\ \"quoted\" \xc3\xa9\r\n"
+                    ".start  load c\r\n\tstop\r\nlone\rcr\r\n";
+
+int failures = 0;
+
+std::string formEncode(const std::string &text){
+  std::string out;
+  char        hex[4];
+  for(unsigned char c : text){
+    if(isalnum(c) || c=='-' || c=='_' || c=='.' || c=='~')out += c;
+    else if(c==' ')out += '+';
+    else{
+      snprintf(hex, sizeof(hex), "%%%02X", c);
+      out += hex;
+    }
+  }
+  return out;
+}
+
+/* Parses a request cut into pieces of 1 to most bytes */
+void parse(httpRequest &request, const std::string &text, uint32_t seed, int most){
+  size_t at = 0;
+  request.expect("/compile", "program");
+  while(!request.finished() && at<text.size()){
+    seed = seed*1103515245UL+12345;
+    size_t length = 1+(seed>>16)%most;
+    if(length>text.size()-at)length = text.size()-at;
+    at += request.parse((const uint8_t*)text.data()+at, length);
+  }
+}
+
+std::string post(const char *type, const std::string &body){
+  return std::string("POST /compile HTTP/1.1\r\nHost: cecil\r\nContent-Type: ") + type +
+         "\r\nCookie: cecil=abc\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+/* Each way of sending a program gets it through as it was typed */
+void checkPrograms(){
+  std::string program = typed, expected;
+  for(size_t i=0;i<program.size();i++)if(!(program[i]=='\r' && program[i+1]=='\n'))expected += program[i];
+  const std::string requests[] = {
+    post("application/x-www-form-urlencoded", "x=" + formEncode("1&program=no") + "&program=" + formEncode(program) + "&y=2"),
+    post("text/plain", program),
+    "GET /compile?program=" + formEncode(program) + " HTTP/1.1\r\nIf-None-Match: \"x\"\r\n\r\n",
+  };
+  const char *names[] = {"form", "text", "query"};
+  for(int r=0;r<3;r++){
+    for(uint32_t seed=0;seed<SEEDS;seed++){
+      httpRequest request;
+      parse(request, requests[r], seed, seed%2 ? 7 : 200);
+      std::string got(request.program.c_str(), request.program.length());
+      if(!request.finished() || request.status || !request.hasProgram || got!=expected){
+        printf("Wrong: the %s program, cut up with seed %u, came out as \"%s\" (%s)\n", names[r], seed,
+               got.c_str(), request.status ? request.status : "no error");
+        failures++;
+        break;
+      }
+    }
+  }
+}
+
+typedef struct{
+  std::string request;
+  const char *status;     // NULL if it is fine
+  bool        hasProgram;
+} statusTest;
+
+/* Each request is answered as it should be */
+void checkStatuses(){
+  const statusTest tests[] = {
+    {"GET /api/state?since=3&output=9 HTTP/1.1\r\n\r\n", NULL, false},
+    {"\r\nGET / HTTP/1.1\r\n\r\n", NULL, false},
+    {"POST /api/run HTTP/1.1\r\nContent-Length: 0\r\n\r\n", NULL, false},
+    {"GET /compile?program= HTTP/1.1\r\n\r\n", NULL, true},
+    {"POST /compile HTTP/1.1\r\nContent-Length: 99999\r\n\r\nx", "413 Payload Too Large", false},
+    {"POST /compile HTTP/1.1\r\nContent-Length: -1\r\n\r\n", "400 Bad Request", false},
+    {"GET nopath HTTP/1.1\r\n\r\n", "400 Bad Request", false},
+    {"GET /" + std::string(100, 'a') + " HTTP/1.1\r\n\r\n", "414 URI Too Long", false},
+    {"PROPFINDXX / HTTP/1.1\r\n\r\n", "501 Not Implemented", false},
+    {"GET /compile?program=" + std::string(HTTP_BODY_MAX+1, 'a') + " HTTP/1.1\r\n\r\n", "414 URI Too Long", false},
+    {"GET /compile?program=" + std::string(HTTP_BODY_MAX, 'a') + " HTTP/1.1\r\n\r\n", NULL, true},
+    {"GET /compile HTTP/1.1\r\n\r\n", "400 Bad Request", false},
+    {"GET /compile?programme=1 HTTP/1.1\r\n\r\n", "400 Bad Request", false},
+    {post("application/x-www-form-urlencoded", "x=1&y=2"), "400 Bad Request", false},
+    {"POST /compile HTTP/1.1\r\nContent-Length: 0\r\n\r\n", "400 Bad Request", false},
+  };
+  for(const statusTest &test : tests){
+    httpRequest request;
+    parse(request, test.request, 1, 5);
+    const char *status = request.status ? request.status : "no error";
+    const char *expected = test.status ? test.status : "no error";
+    if(!request.finished() || strcmp(status, expected)!=0 || request.hasProgram!=test.hasProgram){
+      int line = test.request.find('\r', 2);
+      printf("Wrong: %.*s gave %s, program %i, not %s, program %i\n", line<60 ? line : 60, test.request.c_str(),
+             status, request.hasProgram, expected, test.hasProgram);
+      failures++;
+    }
+  }
+}
+
+int main(){
+  checkPrograms();
+  checkStatuses();
+  printf(failures ? "%i things wrong\n" : "Requests are read as they should be\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,123 @@
+/**
+ * Test: httpwriter
+ * Purpose:
+ *   Prints replies to an httpWriter in pieces of random sizes and checks
+ *   what reaches the client: that a chunked body decodes to exactly what
+ *   was printed, that nothing is written in more than HTTP_SEND_BUFFER
+ *   bytes at a time, that no chunk is split between two writes, and that
+ *   replies with a known length, or none, are sent plain. It is built
+ *   with several buffer sizes, down to the smallest that works (see
+ *   CMakeLists.txt).
+ *
+ *   Exit status: 0 all well, 1 something was wrong.
+ */
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <string>
+
+#include "httpwriter.h"
+
+#define REPLIES 50    // Chunked replies, each printed differently
+
+int      failures = 0;
+uint32_t seed = 1;
+
+int randomNumber(int below){
+  seed = seed*1103515245UL+12345;
+  return (seed>>16)%below;
+}
+
+void wrong(const char *what, int reply){
+  printf("Wrong (buffer %i, reply %i): %s\n", HTTP_SEND_BUFFER, reply, what);
+  failures++;
+}
+
+/* Checks a chunked reply against the body printed, and how it was written */
+void checkChunked(const WiFiClient &client, const std::string &body, int reply){
+  const std::string &sent = client.response();
+  size_t at = sent.find("\r\n\r\n");
+  if(at==std::string::npos || sent.find("Transfer-Encoding: chunked\r\n")>at){
+    wrong("the headers don't say the body is chunked", reply);
+    return;
+  }
+  // Where each write ended, to see that chunks aren't split
+  std::vector<size_t> ends;
+  size_t total = 0;
+  for(size_t size : client.writes()){
+    if(size>HTTP_SEND_BUFFER)wrong("more than a buffer was written at once", reply);
+    ends.push_back(total += size);
+  }
+  std::string decoded;
+  at += 4;
+  for(;;){
+    size_t line = sent.find("\r\n", at);
+    if(line==std::string::npos){
+      wrong("a chunk's size line is missing", reply);
+      return;
+    }
+    size_t length = strtoul(sent.c_str()+at, NULL, 16);
+    size_t end = line+2+length+2;
+    if(end>sent.size() || sent.compare(end-2, 2, "\r\n")!=0){
+      wrong("a chunk doesn't end where its size says", reply);
+      return;
+    }
+    size_t w = 0;
+    while(ends[w]<=at)w++;
+    if(end>ends[w])wrong("a chunk was split between writes", reply);
+    if(length==0)break;
+    decoded.append(sent, line+2, length);
+    at = end;
+  }
+  if(at+5!=sent.size())wrong("there is something after the last chunk", reply);
+  if(decoded!=body)wrong("the body doesn't decode to what was printed", reply);
+}
+
+void checkChunkedReplies(){
+  for(int reply=0;reply<REPLIES;reply++){
+    WiFiClient client("");
+    httpWriter out(client);
+    std::string body;
+    out.begin("200 OK", "text/plain");
+    out.header("Set-Cookie", "cecil=0000abcd; Path=/");
+    out.endHeaders();
+    // Small prints like a page's lines, and big ones like the output
+    int pieces = randomNumber(40);
+    for(int p=0;p<pieces;p++){
+      std::string piece(randomNumber(p%5==4 ? 3000 : 60), ' ');
+      for(char &c : piece)c = 32+randomNumber(95);
+      if(p%3==0)out.printf("%s", piece.c_str());
+      else out.print(piece.c_str());
+      body += piece;
+    }
+    out.end();
+    checkChunked(client, body, reply);
+  }
+}
+
+void checkPlainReplies(){
+  std::string body(3*HTTP_SEND_BUFFER+5, 'x');
+  WiFiClient client("");
+  httpWriter out(client);
+  out.begin("200 OK", "text/plain", body.size());
+  out.endHeaders();
+  out.print(body.c_str());
+  out.end();
+  std::string expected = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: " + std::to_string(body.size()) +
+                         "\r\nConnection: close\r\n\r\n" + body;
+  if(client.response()!=expected)wrong("a reply of known length isn't sent as it was printed", 0);
+
+  WiFiClient empty("");
+  httpWriter none(empty);
+  none.begin("304 Not Modified", NULL, NO_BODY);
+  none.endHeaders();
+  none.end();
+  if(empty.response()!="HTTP/1.1 304 Not Modified\r\nConnection: close\r\n\r\n")wrong("a reply with no body has one", 0);
+}
+
+int main(){
+  checkChunkedReplies();
+  checkPlainReplies();
+  printf(failures ? "%i things wrong\n" : "Replies are sent as they should be\n", failures);
+  return failures ? 1 : 0;
+}
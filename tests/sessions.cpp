@@ -0,0 +1,56 @@
+/**
+ * Test: sessions
+ * Purpose:
+ *   Checks how sessionTable hands out SIM40s: a browser's cookie is only
+ *   recognised by its exact name, a newcomer is given a free session, and
+ *   once they are all taken, only one that has been left alone for
+ *   SESSION_IDLE can be given to someone else; until then there is none.
+ *
+ *   Exit status: 0 all well, 1 something was wrong.
+ */
+
+#include <Arduino.h>
+#include <string>
+
+#define SIM_POOL_SIZE 2
+#define SESSION_IDLE  100   // ms, so that the test needn't wait long
+
+#include "sessions.h"
+
+int failures = 0;
+
+void check(bool ok, const char *what){
+  if(!ok){
+    printf("Wrong: %s\n", what);
+    failures++;
+  }
+}
+
+/* The Cookie: header a browser sends back after being given a session */
+String cookieOf(sessionTable &table, int slot){
+  String set = table.cookie(slot);
+  return set.substring(0, set.indexOf(';'));
+}
+
+int main(){
+  sessionTable table;
+  check(table.find("")==-1, "no cookie finds a session");
+  int first = table.take(), second = table.take();
+  check(first>=0 && second>=0 && first!=second, "two newcomers aren't each given a free session");
+  String cookie = cookieOf(table, first);
+  check(table.find(cookie)==first, "a session isn't found from its cookie");
+  check(table.find("theme=dark; " + cookie + "; lang=en")==first, "a session isn't found among other cookies");
+  check(table.find("x" + cookie)==-1, "a cookie with a longer name is taken for the session's");
+  check(table.find(cookie.substring(1))==-1, "a cookie with a shorter name is taken for the session's");
+  check(table.take()==-1, "a session in use is given away");
+  delay(SESSION_IDLE/2);
+  table.find(cookie);
+  delay(SESSION_IDLE*3/4);
+  int third = table.take();
+  check(third==second, "the session left alone is not the one given away");
+  check(table.find(cookieOf(table, third))==third, "the new owner's cookie doesn't find its session");
+  check(table.find(cookie)==first, "the session still in use was lost");
+  check(table.take()==-1, "a session is given away again straight away");
+  printf(failures ? "%i things wrong\n" : "Sessions are handed out as they should be\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * Test: snapshot
+ * Purpose:
+ *   The SIM40 task publishes snapshots of each SIM40 through a
+ *   snapshotBuffer, which the web side reads from another thread without
+ *   any locking. This has one thread publish snapshots as fast as it can,
+ *   every word of each one set to the number of the snapshot, while
+ *   another reads them, and checks that no snapshot read is a mixture of
+ *   two, and that the numbers read never go backwards.
+ *
+ *   Exit status: 0 all well, 1 a torn or stale snapshot was read.
+ */
+
+#include <Arduino.h>
+#include <thread>
+
+#define TEST_TIME 2000  // ms of reading snapshots while they're being written
+
+bool    trace = false;
+
+#include "sim40.h"
+#include "compiler.h"
+#include "simtask.h"
+
+snapshotBuffer       buffer;
+std::atomic<bool>    done{false};
+
+void writer(){
+  for(unsigned long n=1;!done.load(std::memory_order_relaxed);n++){
+    simSnapshot &snap = buffer.begin();
+    snap.instructionCount = n;
+    for(int i=0;i<SNAPSHOT_MEM;i++){
+      snap.memory[i] = n;
+      if(i==SNAPSHOT_MEM/2)std::this_thread::yield();  // Let the reader in half way, even on one core
+    }
+    snap.outputCursor = n;
+    buffer.publish();
+    std::this_thread::yield();
+  }
+}
+
+int main(){
+  simSnapshot  *snap = new simSnapshot;
+  unsigned long last = 0;
+  int           reads = 0, torn = 0, backwards = 0, changed = 0;
+  std::thread   thread(writer);
+  for(unsigned long start=millis();millis()-start<TEST_TIME;reads++){
+    buffer.read(*snap);
+    uint16_t n = snap->instructionCount;
+    bool whole = snap->outputCursor==snap->instructionCount && snap->memory[0]==n && snap->memory[SNAPSHOT_MEM-1]==n;
+    if(!whole)torn++;
+    if(snap->instructionCount<last)backwards++;
+    if(snap->instructionCount!=last)changed++;
+    last = snap->instructionCount;
+  }
+  done = true;
+  thread.join();
+  delete snap;
+  if(torn || backwards)printf("Wrong: %i torn snapshots and %i that went backwards, in %i reads\n", torn, backwards, reads);
+  else printf("%i reads, %i of them of a new snapshot, none torn\n", reads, changed);
+  return torn || backwards ? 1 : 0;
+}
@@ -0,0 +1,246 @@
+/**
+ * Test: state
+ * Purpose:
+ *   A browser polling /api/state?since=<epoch>&output=<cursor> is sent
+ *   only the memory words and output that have changed, and rebuilds the
+ *   rest from what it had. This runs a program that keeps writing to
+ *   memory and printing, in a session of a running simTask, and polls it
+ *   at random intervals as two browsers would, one reading the JSON and
+ *   one /api/state.bin. Once the program has been halted, each rebuilds
+ *   memory and output from the last of the changes, and they must match a
+ *   full read of the state. Requests with methods other than GET and
+ *   POST must be turned away with 405 Method Not Allowed.
+ *
+ *   Exit status: 0 all well, 1 something was wrong.
+ */
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <string>
+#include <vector>
+
+#define PROG          "Cecil"
+#define SIM_POOL_SIZE 2
+#define OUTPUT_BUFFER 1024  // Small, so that the output wraps round
+#define POLLS         200
+
+bool    trace = false;
+
+#include "sim40.h"
+#include "compiler.h"
+#include "simtask.h"
+#include "sessions.h"
+#include "webserver.h"
+#include "eventstreams.h"
+
+const char *program =
+  "program state\nauthor test\ndate today\n"
+  ".start  load c\n"
+  "        add one\n"
+  "        store c\n"
+  "        store d\n"
+  "        printch\n"
+  "        jump start\n"
+  ".c      insert 0\n"
+  ".d      insert 0\n"
+  ".one    insert 1\n"
+  ";---end of code---\n";
+
+simTask     *runner;
+sessionTable sessions;
+simSnapshot  snap;
+int          slot;           // The session being polled
+uint32_t     seed = 1;
+int          failures = 0;
+
+int randomNumber(int below){
+  seed = seed*1103515245UL+12345;
+  return (seed>>16)%below;
+}
+
+/* What a browser knows of the SIM40 */
+typedef struct{
+  std::vector<long> memory;
+  uint32_t          epoch;
+  std::string       output;
+  uint32_t          outputStart;    // Where output starts
+  bool              sentAll;        // The last reply had all of memory
+} browser;
+
+std::string unchunk(const std::string &reply){
+  std::string body;
+  size_t at = reply.find("\r\n\r\n")+4;
+  for(size_t length;(length = strtoul(reply.c_str()+at, NULL, 16))>0;at += length+2){
+    at = reply.find("\r\n", at)+2;
+    body.append(reply, at, length);
+  }
+  return body;
+}
+
+std::string request(const std::string &path){
+  WiFiClient client("GET " + path + " HTTP/1.1\r\nHost: cecil\r\n\r\n");
+  uint32_t changed[32];
+  uint32_t since = 0;
+  simView  view;
+  readWebRequest(client);
+  viewSession(*runner, sessions, slot, queryValue("since", since) ? &since : NULL, snap, changed, view);
+  sendWebResponse(client, sessions.program(slot), view);
+  return unchunk(client.response());
+}
+
+/* Bits of the JSON reply */
+long jsonNumber(const std::string &json, const char *name){
+  size_t at = json.find("\"" + std::string(name) + "\":");
+  return at==std::string::npos ? -1 : strtol(json.c_str()+at+strlen(name)+3, NULL, 10);
+}
+
+bool jsonNumbers(const std::string &json, const char *name, std::vector<long> &numbers){
+  size_t at = json.find("\"" + std::string(name) + "\":[");
+  if(at==std::string::npos)return false;
+  const char *text = json.c_str()+at+strlen(name)+4;
+  numbers.clear();
+  while(*text!=']'){
+    char *end;
+    numbers.push_back(strtol(text, &end, 10));
+    text = *end==',' ? end+1 : end;
+  }
+  return true;
+}
+
+std::string jsonString(const std::string &json, const char *name){
+  std::string text;
+  size_t at = json.find("\"" + std::string(name) + "\":\"")+strlen(name)+4;
+  for(;json[at]!='"';at++){
+    if(json[at]!='\\')text += json[at];
+    else if(json[++at]=='n')text += '\n';
+    else if(json[at]=='u'){
+      text += (char)strtol(json.substr(at+1, 4).c_str(), NULL, 16);
+      at += 4;
+    }
+    else text += json[at];
+  }
+  return text;
+}
+
+/* Adds output sent from outputFrom on, which starts at outputStart now */
+void addOutput(browser &b, uint32_t start, uint32_t from, const std::string &text){
+  if(from==b.outputStart+b.output.size()){
+    b.output += text;
+    if(start>b.outputStart){
+      b.output.erase(0, start-b.outputStart<b.output.size() ? start-b.outputStart : b.output.size());
+      b.outputStart = start;
+    }
+  }
+  else{
+    b.output = text;
+    b.outputStart = from;
+  }
+}
+
+void pollJson(browser &b, bool all){
+  uint32_t cursor = b.outputStart+b.output.size();
+  std::string json = request(all ? "/api/state" : "/api/state?since=" + std::to_string(b.epoch) + "&output=" +
+                                                  std::to_string(cursor));
+  std::vector<long> changes;
+  b.sentAll = jsonNumbers(json, "memory", b.memory);
+  if(!b.sentAll && jsonNumbers(json, "changes", changes))
+    for(size_t i=0;i+1<changes.size();i+=2)b.memory[changes[i]] = changes[i+1];
+  b.epoch = jsonNumber(json, "epoch");
+  addOutput(b, jsonNumber(json, "outputStart"), jsonNumber(json, "outputFrom"), jsonString(json, "output"));
+}
+
+uint32_t binaryNumber(const std::string &data, size_t at, int bytes){
+  uint32_t value = 0;
+  for(int i=bytes-1;i>=0;i--)value = value<<8 | (uint8_t)data[at+i];
+  return value;
+}
+
+void pollBinary(browser &b){
+  uint32_t cursor = b.outputStart+b.output.size();
+  std::string data = request("/api/state.bin?since=" + std::to_string(b.epoch) + "&output=" + std::to_string(cursor));
+  uint32_t flags = binaryNumber(data, 4, 2);
+  int      words = binaryNumber(data, 32, 2);
+  size_t   at = 34;
+  b.sentAll = flags & 2;
+  if(b.sentAll)b.memory.assign(words, 0);
+  for(int i=0;i<words;i++){
+    if(b.sentAll)b.memory[i] = binaryNumber(data, at, 2);
+    else b.memory[binaryNumber(data, at, 2)] = binaryNumber(data, at+2, 2);
+    at += b.sentAll ? 2 : 4;
+  }
+  b.epoch = binaryNumber(data, 0, 4);
+  int length = binaryNumber(data, at, 2);
+  addOutput(b, binaryNumber(data, 24, 4), binaryNumber(data, 28, 4), data.substr(at+2, length));
+  if(at+2+length!=data.size()){
+    printf("Wrong: /api/state.bin is %u bytes, not %u\n", (unsigned)data.size(), (unsigned)(at+2+length));
+    failures++;
+  }
+}
+
+/* Only GET and POST are answered; anything else mustn't be taken as a command */
+void checkMethods(){
+  const char *methods[] = {"DELETE", "HEAD", "PUT"};
+  for(const char *method : methods){
+    WiFiClient client(std::string(method) + " /run HTTP/1.1\r\nHost: cecil\r\n\r\n");
+    simView view = {};
+    String command = readWebRequest(client);
+    sendWebResponse(client, "", view);
+    if(command!="none" || client.response().rfind("HTTP/1.1 405 Method Not Allowed\r\n", 0)!=0 ||
+       client.response().find("Allow: GET, POST\r\n")==std::string::npos){
+      printf("Wrong: %s /run wasn't answered 405 Method Not Allowed\n", method);
+      failures++;
+    }
+  }
+}
+
+int main(){
+  Serial.enabled = false;
+  checkMethods();
+  sim40    *sims = new sim40[SIM_POOL_SIZE];
+  compiler *compilers = new compiler[SIM_POOL_SIZE];
+  runner = new simTask(sims, compilers, SIM_POOL_SIZE);
+  slot = sessions.take();
+  runner->begin();
+  runner->send({CMD_COMPILE, new String(program), 0, slot});
+  runner->send({CMD_RUN, NULL, 0, slot});
+
+  browser json = {}, binary = {};
+  int deltas = 0;
+  pollJson(json, true);
+  binary = json;
+  for(int n=0;n<POLLS;n++){
+    delay(randomNumber(4)*3);
+    bool asJson = randomNumber(2);
+    if(asJson)pollJson(json, randomNumber(20)==0);
+    else pollBinary(binary);
+    if(!(asJson ? json : binary).sentAll)deltas++;
+  }
+  runner->send({CMD_HALT, NULL, 0, slot});
+  delay(100);
+  pollJson(json, false);
+  pollBinary(binary);
+  browser full = {};
+  pollJson(full, true);
+  runner->end();
+
+  const char *names[] = {"JSON", "binary"};
+  browser *browsers[] = {&json, &binary};
+  for(int b=0;b<2;b++){
+    browser &got = *browsers[b];
+    if(got.memory!=full.memory){
+      printf("Wrong: memory rebuilt from %s changes differs from all of it\n", names[b]);
+      failures++;
+    }
+    if(got.output.size()<full.output.size() || got.output.compare(got.output.size()-full.output.size(),
+                                                                  full.output.size(), full.output)!=0){
+      printf("Wrong: output rebuilt from %s changes differs from all of it\n", names[b]);
+      failures++;
+    }
+  }
+  if(full.memory[11]==0 || deltas==0){   // c, which counts
+    printf("Wrong: the program didn't run, or no changes were sent\n");
+    failures++;
+  }
+  if(!failures)printf("Memory and output rebuilt from %i polls for changes match all of it\n", deltas);
+  return failures ? 1 : 0;
+}